@@ -1,21 +1,62 @@
 /* finance_buddy.c
    Finance Buddy - CLI finance manager demonstrating data structures in C.
-   Compile: gcc -o finance_buddy finance_buddy.c
+   Compile: gcc -O2 -o finance_buddy finance_buddy.c -lm -pthread
 */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
 #include <time.h>
+#include <math.h>
+#include <limits.h>
+#include <pthread.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
 /* ------------------------------
    Data structure definitions
    ------------------------------*/
+/* Spending categories, same set as the web app's expense picker */
+enum {
+    CAT_NONE = 0, // deposits, transfers
+    CAT_SHOPPING,
+    CAT_HOTEL,
+    CAT_STUDY,
+    CAT_TRAVEL,
+    CAT_FOOD,
+    CAT_MISC,
+    NUM_CATEGORIES
+};
+
+const char *category_names[NUM_CATEGORIES] = {
+    "None", "Shopping", "Hotel", "Study", "Travel", "Food", "Misc"
+};
+
 typedef struct Transaction {
     int id;
     char type[16]; // "DEPOSIT", "WITHDRAW", "TRANSFER"
     double amount;
-    int to_account; // for transfer: destination account id (0 if N/A)
+    int to_account; // for transfer: destination account id; GOAL_SAVE/GOAL_RETURN: goal id (0 if N/A)
+    int category;   // CAT_* for withdrawals, CAT_NONE otherwise
     char timestamp[64];
     struct Transaction *next;
 } Transaction;
@@ -23,17 +64,54 @@ typedef struct Transaction {
 typedef struct Account {
     int id;
     char name[64];
-    double balance;
+    int slot;             // row in the account table; balance lives in balance_col[slot], -1 once deleted
+    double gone_balance;  // balance when deleted, for readers still holding the node
     Transaction *tx_head; // linked list of transactions (newest at head)
+    double cat_spent[NUM_CATEGORIES]; // net withdrawals per category
+    uint64_t bal_ts;      // commit that last changed the balance
+    unsigned mv_seq;      // odd while the writer is changing balance/bal_ts/versions
+    struct BalanceVersion *versions; // older balances kept for open snapshots
+    uint64_t shm;         // record in the shared-memory mirror, 0 = none
+    struct Velocity *velocity; // spending counters for the velocity limits, NULL until needed
+    uint64_t cold_head;   // newest block of this account's history on disk, 0 = none
+    long cold_count;      // transactions in those blocks
+    long lazy_count;      // TX lines still only in the data file (lazy load), 0 = none
+    uint64_t lazy_off;    // where they start there
+    uint64_t lazy_bytes;
+    uint32_t lazy_crc;    // CRC-32 of the ACC line, continued over the TX lines on page-in
+    uint32_t lazy_want;   // the block's CRC-32 from the footer index, if lazy_verify
+    int lazy_verify;
+    int savings;          // earns interest (accrue_interest); fixed when the account is opened
     struct Account *next; // linked list of accounts
 } Account;
 
+/* Savings goal (the web app's createGoal) */
+typedef struct Goal {
+    int id;
+    char name[64];
+    double target;
+    double saved;
+    int target_date; // yyyymmdd, 0 = no deadline
+    int heap_pos;    // index in goal_heap, -1 when not indexed
+} Goal;
+
+/* One account's share of a grouped operation (interest accrual) */
+typedef struct GroupEntry {
+    int acc_id;
+    int slot;      // table row at the time, checked against acc_id on undo
+    double amount;
+} GroupEntry;
+
 /* Stack node for undo */
 typedef struct OpNode {
-    char op_type[16]; // "DEPOSIT","WITHDRAW","TRANSFER","CREATE"
+    char op_type[16]; // "DEPOSIT","WITHDRAW","TRANSFER","CREATE","CREATE_GOAL","GOAL_SAVE","ACCRUE"
     int acc_id;
-    int acc_id_to; // transfer destination
+    int acc_id_to; // transfer destination; goal id for CREATE_GOAL/GOAL_SAVE
     double amount;
+    int category; // WITHDRAW: category to take back out of the totals
+    uint32_t velocity_at; // WITHDRAW/TRANSFER: ledger time the velocity counters took it, 0 = not counted
+    GroupEntry *group; // ACCRUE: every credited account
+    int group_len;
     struct OpNode *next;
 } OpNode;
 
@@ -41,335 +119,7412 @@ typedef struct OpNode {
    Global heads
    ------------------------------*/
 Account *accounts_head = NULL;
+
+/* Account table, structure-of-arrays: the hot balance column is contiguous
+   and dense (rows 0..account_rows-1), the cold rest (name, tx list) stays in
+   the Account node reached through slot_account. */
+double *balance_col = NULL;
+Account **slot_account = NULL;
+int account_rows = 0, account_rows_cap = 0;
+#define BALANCE(acc) (balance_col[(acc)->slot])
+double balance_read(Account *acc);
+#define BALANCE_READ(acc) balance_read(acc) // lock-free readers
+
+/* Running ledger-wide aggregates, updated by every mutation (including
+   undo and load) so reading them is O(1). Inflow is money entering the
+   ledger (deposits, interest), outflow money leaving it (withdrawals, goal
+   savings); transfers are internal. Both only count today's transactions. */
+typedef struct LedgerStats {
+    double total_assets;
+    long transactions;
+    char day[11];          // "YYYY-MM-DD" the flows belong to
+    double inflow_today;
+    double outflow_today;
+} LedgerStats;
+
+LedgerStats ledger_stats;
 OpNode *undo_stack = NULL;
 int next_account_id = 1;
 int next_tx_id = 1;
+double cat_spent_total[NUM_CATEGORIES]; // ledger-wide, kept in step with every Account.cat_spent
+
+Goal **goal_table = NULL; // indexed by goal id
+int goal_table_cap = 0;
+Goal **goal_heap = NULL;  // min-heap on target_date of open goals with a deadline
+int goal_heap_len = 0, goal_heap_cap = 0;
+int next_goal_id = 1;
+int goal_count = 0, goals_completed = 0;
+double goals_saved_total = 0, goals_target_total = 0;
 
 /* ------------------------------
-   Utility functions
+   Metrics
+   Per-operation call counts and latency histograms. Buckets are
+   log-linear (HDR style): one group per power of two, 16 linear
+   sub-buckets each, so any latency is kept to within ~6%. Timing uses the
+   TSC where available and is converted to ns when dumped. Each thread
+   records into its own set of histograms with plain stores; a dump sums
+   the sets. Only the top-level operations are probed: a probe costs more
+   than a find_account, so lookups and transaction allocation are not
+   timed on their own. Build with -DFB_NO_METRICS to compile every probe
+   out.
    ------------------------------*/
-char *current_time_str(char *buf, size_t n) {
-    time_t t = time(NULL);
-    struct tm *tm = localtime(&t);
-    strftime(buf, n, "%Y-%m-%d %H:%M:%S", tm);
-    return buf;
+enum {
+    M_CREATE_ACCOUNT,
+    M_DEPOSIT,
+    M_WITHDRAW,
+    M_TRANSFER,
+    M_UNDO,
+    M_SAVE,
+    M_LOAD,
+    M_LOAD_READ,
+    M_LOAD_PARSE,
+    M_LOAD_LOOKUP,
+    M_LOAD_ALLOC,
+    M_LOAD_APPLY,
+    M_PROBE,            // --bench's empty scope
+    NUM_METRICS
+};
+
+const char *metric_names[NUM_METRICS] = {
+    "create_account", "deposit", "withdraw", "transfer_funds", "undo_last",
+    "save_data", "load_data", "load_data.read", "load_data.parse",
+    "load_data.lookup", "load_data.alloc", "load_data.apply", "metric_probe"
+};
+
+#define HIST_SUB_BITS 4
+#define HIST_BUCKETS (64 << HIST_SUB_BITS)
+
+typedef struct Histogram {
+    uint64_t count;
+    uint64_t total;
+    uint64_t max;
+    uint64_t buckets[HIST_BUCKETS];
+} Histogram;
+
+typedef struct MetricSet {
+    Histogram h[NUM_METRICS];
+    int in_use;                      // owned by a live thread
+    struct MetricSet *next;
+} MetricSet;
+
+MetricSet *metric_sets = NULL;       // never freed: a dump may walk it from a signal handler
+pthread_mutex_t metric_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_key_t metric_key;
+pthread_once_t metric_key_once = PTHREAD_ONCE_INIT;
+__thread MetricSet *metric_set = NULL;
+MetricSet *metric_set_get();         // with the memory accounting below
+uint64_t metric_tick0;   // ticks and ns at the first reading, to scale ticks to ns
+double metric_ns0;
+
+uint64_t metric_now() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
 }
 
-Account* find_account(int id) {
-    Account *cur = accounts_head;
-    while (cur) {
-        if (cur->id == id) return cur;
-        cur = cur->next;
+int hist_bucket(uint64_t v) {
+    if (v < (1u << HIST_SUB_BITS)) return (int)v;
+    int msb = 63 - __builtin_clzll(v);
+    int shift = msb - HIST_SUB_BITS;
+    return ((shift + 1) << HIST_SUB_BITS) + (int)((v >> shift) & ((1u << HIST_SUB_BITS) - 1));
+}
+
+/* smallest value that lands in bucket b */
+uint64_t hist_bucket_floor(int b) {
+    if (b < (1 << HIST_SUB_BITS)) return (uint64_t)b;
+    int shift = (b >> HIST_SUB_BITS) - 1;
+    return ((uint64_t)(1u << HIST_SUB_BITS) + (b & ((1u << HIST_SUB_BITS) - 1))) << shift;
+}
+
+/* only the owning thread writes its set, so each field is a plain load
+   and store; relaxed so that a dump from another thread reads whole
+   values */
+void metric_add(uint64_t *field, uint64_t v) {
+    __atomic_store_n(field, *field + v, __ATOMIC_RELAXED);
+}
+
+void metric_record(int op, uint64_t ticks) {
+    MetricSet *s = metric_set ? metric_set : metric_set_get();
+    if (!s) return;
+    Histogram *h = &s->h[op];
+    metric_add(&h->count, 1);
+    metric_add(&h->total, ticks);
+    metric_add(&h->buckets[hist_bucket(ticks)], 1);
+    if (ticks > h->max) __atomic_store_n(&h->max, ticks, __ATOMIC_RELAXED);
+}
+
+/* time spent in op by the calling thread so far */
+uint64_t metric_thread_total(int op) {
+    return metric_set ? metric_set->h[op].total : 0;
+}
+
+/* the sum of every thread's histogram for op */
+void metric_merge(int op, Histogram *out) {
+    memset(out, 0, sizeof(*out));
+    for (MetricSet *s = __atomic_load_n(&metric_sets, __ATOMIC_ACQUIRE); s; s = s->next) {
+        Histogram *h = &s->h[op];
+        uint64_t count = __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+        if (!count) continue;
+        out->count += count;
+        out->total += __atomic_load_n(&h->total, __ATOMIC_RELAXED);
+        uint64_t max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+        if (max > out->max) out->max = max;
+        for (int b = 0; b < HIST_BUCKETS; b++) out->buckets[b] += __atomic_load_n(&h->buckets[b], __ATOMIC_RELAXED);
     }
-    return NULL;
 }
 
-void push_undo(const char *op, int acc_id, int acc_id_to, double amount) {
-    OpNode *n = malloc(sizeof(OpNode));
-    strcpy(n->op_type, op);
-    n->acc_id = acc_id;
-    n->acc_id_to = acc_id_to;
-    n->amount = amount;
-    n->next = undo_stack;
-    undo_stack = n;
+uint64_t metric_lap(int op, uint64_t start) {
+    uint64_t now = metric_now();
+    metric_record(op, now - start);
+    return now;
 }
 
-OpNode* pop_undo() {
-    if (!undo_stack) return NULL;
-    OpNode *top = undo_stack;
-    undo_stack = undo_stack->next;
-    return top;
+typedef struct MetricScope {
+    int op;
+    uint64_t start;
+} MetricScope;
+
+void metric_scope_end(MetricScope *s) {
+    metric_record(s->op, metric_now() - s->start);
+}
+
+void metrics_init() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    metric_tick0 = metric_now();
+    metric_ns0 = ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* TSC rate measured since metrics_init (1.0 when metric_now is in ns) */
+double metric_ns_per_tick() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    double ns = ts.tv_sec * 1e9 + ts.tv_nsec - metric_ns0;
+    uint64_t ticks = metric_now() - metric_tick0;
+    return ticks && ns > 0 ? ns / ticks : 1.0;
 }
 
+#ifndef FB_NO_METRICS
+/* times the rest of the enclosing block, whichever way it is left */
+#define METRIC_SCOPE(op) MetricScope metric_scope_ __attribute__((cleanup(metric_scope_end))) = { (op), metric_now() }
+/* lap timers for the phases of a loop's pass; METRIC_LAP_EVERY at the end
+   of a pass times only one pass in `every` (var is 0 on the others), as a
+   probe costs about as much as a short pass */
+#define METRIC_LAP_START(var) uint64_t var = metric_now(); unsigned var##_pass = 0
+#define METRIC_LAP(op, var) ((var) ? (void)((var) = metric_lap((op), (var))) : (void)0)
+#define METRIC_LAP_EVERY(var, every) ((var) = ++var##_pass % (every) ? 0 : metric_now())
+#else
+#define METRIC_SCOPE(op) do { } while (0)
+#define METRIC_LAP_START(var) do { } while (0)
+#define METRIC_LAP(op, var) do { } while (0)
+#define METRIC_LAP_EVERY(var, every) do { } while (0)
+#endif
+
 /* ------------------------------
-   Transaction helpers
+   Memory accounting
+   Every long-lived allocation is tagged with the subsystem that owns it.
+   Pools report their chunks as reserved and their live nodes as used; the
+   gap is free-list holes plus the unused tail of the newest chunk.
    ------------------------------*/
-Transaction* create_transaction(const char *type, double amount, int to_account) {
-    Transaction *t = malloc(sizeof(Transaction));
-    t->id = next_tx_id++;
-    strncpy(t->type, type, sizeof(t->type)-1);
-    t->amount = amount;
-    t->to_account = to_account;
-    current_time_str(t->timestamp, sizeof(t->timestamp));
-    t->next = NULL;
-    return t;
+enum {
+    MEM_ACCOUNTS,
+    MEM_ACCOUNT_TABLE,
+    MEM_TRANSACTIONS,
+    MEM_UNDO,
+    MEM_GOALS,
+    MEM_SCHEDULES,
+    MEM_IMPORT,
+    MEM_TRACE,
+    MEM_EPOCH,
+    MEM_VERSIONS,
+    MEM_OPLOG,
+    MEM_SHM,
+    MEM_IDEM,
+    MEM_VELOCITY,
+    MEM_METRICS,
+    NUM_MEM_TAGS
+};
+
+const char *mem_tag_names[NUM_MEM_TAGS] = {
+    "accounts", "account_table", "transactions", "undo_stack", "goals", "schedules", "import", "trace", "epoch_retired", "versions", "oplog", "shared_mirror", "idempotency", "velocity", "metrics"
+};
+
+typedef struct MemStats {
+    long long objects;   // live allocations / pool nodes
+    long long used;      // bytes those objects occupy
+    long long reserved;  // bytes held from malloc
+    long long peak;      // high-water mark of reserved
+} MemStats;
+
+MemStats mem_stats[NUM_MEM_TAGS];
+long long mem_reserved_total = 0, mem_peak_total = 0;
+
+void mem_raise_peak(long long *peak, long long v) {
+    long long p = __atomic_load_n(peak, __ATOMIC_RELAXED);
+    while (v > p && !__atomic_compare_exchange_n(peak, &p, v, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
 }
 
-void add_transaction(Account *acc, Transaction *tx) {
-    // insert at head for newest-first order
-    tx->next = acc->tx_head;
-    acc->tx_head = tx;
+/* atomic: trace rings are allocated from worker threads */
+void mem_reserve(int tag, long long delta) {
+    MemStats *m = &mem_stats[tag];
+    mem_raise_peak(&m->peak, __atomic_add_fetch(&m->reserved, delta, __ATOMIC_RELAXED));
+    mem_raise_peak(&mem_peak_total, __atomic_add_fetch(&mem_reserved_total, delta, __ATOMIC_RELAXED));
+}
+
+void mem_use(int tag, long long objects, long long bytes) {
+    __atomic_add_fetch(&mem_stats[tag].objects, objects, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&mem_stats[tag].used, bytes, __ATOMIC_RELAXED);
+}
+
+void *mem_alloc(int tag, size_t size) {
+    void *p = malloc(size);
+    if (p) {
+        mem_reserve(tag, (long long)size);
+        mem_use(tag, 1, (long long)size);
+    }
+    return p;
+}
+
+void *mem_calloc(int tag, size_t count, size_t size) {
+    void *p = calloc(count, size);
+    if (p) {
+        mem_reserve(tag, (long long)(count * size));
+        mem_use(tag, 1, (long long)(count * size));
+    }
+    return p;
+}
+
+/* old_size is what p was allocated with (0 when p is NULL) */
+void *mem_realloc(int tag, void *p, size_t old_size, size_t new_size) {
+    void *np = realloc(p, new_size);
+    if (np) {
+        mem_reserve(tag, (long long)new_size - (long long)old_size);
+        mem_use(tag, p ? 0 : 1, (long long)new_size - (long long)old_size);
+    }
+    return np;
+}
+
+void mem_free(int tag, void *p, size_t size) {
+    if (!p) return;
+    free(p);
+    mem_reserve(tag, -(long long)size);
+    mem_use(tag, -1, -(long long)size);
+}
+
+/* thread exit: the metric set (and what it recorded) passes to the next
+   new thread */
+void metric_set_release(void *set) {
+    pthread_mutex_lock(&metric_lock);
+    ((MetricSet *)set)->in_use = 0;
+    pthread_mutex_unlock(&metric_lock);
+}
+
+void metric_key_create() {
+    pthread_key_create(&metric_key, metric_set_release);
+}
+
+MetricSet *metric_set_get() {
+    if (metric_set) return metric_set;
+    pthread_once(&metric_key_once, metric_key_create);
+    pthread_mutex_lock(&metric_lock);
+    MetricSet *s = metric_sets;
+    while (s && s->in_use) s = s->next;
+    if (!s && (s = mem_calloc(MEM_METRICS, 1, sizeof(MetricSet)))) {
+        s->next = metric_sets;
+        __atomic_store_n(&metric_sets, s, __ATOMIC_RELEASE);
+    }
+    if (s) s->in_use = 1;
+    pthread_mutex_unlock(&metric_lock);
+    if (s) pthread_setspecific(metric_key, s);
+    metric_set = s;
+    return s;
+}
+
+/* ------------------------------
+   Tracing
+   Scoped spans on the persistence and bulk paths, kept per thread in a
+   ring (the oldest events are overwritten) and written out as Chrome
+   trace-event JSON for chrome://tracing or Perfetto. Off until
+   trace_start(); a span then costs one branch. A thread counts itself in
+   trace_writers while it writes an event, so trace_start/trace_stop can
+   switch tracing off and wait for that count to reach 0 before they touch
+   the rings.
+   ------------------------------*/
+#define TRACE_RING_CAP 16384
+#define TRACE_MAX_ARGS 6
+
+typedef struct TraceEvent {
+    const char *name;                // string literals only
+    uint64_t start_ns;
+    uint64_t dur_ns;
+    const char *const *arg_names;
+    long long args[TRACE_MAX_ARGS];
+    int nargs;
+} TraceEvent;
+
+typedef struct TraceRing {
+    TraceEvent events[TRACE_RING_CAP];
+    uint64_t head;                   // events ever written
+    int tid;
+    int in_use;                      // owned by a live thread
+    struct TraceRing *next;
+} TraceRing;
+
+int trace_enabled = 0;
+int trace_writers = 0;               // threads inside trace_end_args
+uint64_t trace_ns0;
+TraceRing *trace_rings = NULL;
+int trace_ring_count = 0;
+pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_key_t trace_key;
+pthread_once_t trace_key_once = PTHREAD_ONCE_INIT;
+__thread TraceRing *trace_ring = NULL;
+
+uint64_t trace_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* thread exit: the ring (and its events) is handed to the next new thread */
+void trace_ring_release(void *ring) {
+    pthread_mutex_lock(&trace_lock);
+    ((TraceRing *)ring)->in_use = 0;
+    pthread_mutex_unlock(&trace_lock);
+}
+
+void trace_key_create() {
+    pthread_key_create(&trace_key, trace_ring_release);
+}
+
+TraceRing *trace_ring_get() {
+    if (trace_ring) return trace_ring;
+    pthread_once(&trace_key_once, trace_key_create);
+    pthread_mutex_lock(&trace_lock);
+    TraceRing *r = trace_rings;
+    while (r && r->in_use) r = r->next;
+    if (!r && (r = mem_calloc(MEM_TRACE, 1, sizeof(TraceRing)))) {
+        r->tid = ++trace_ring_count;
+        r->next = trace_rings;
+        trace_rings = r;
+    }
+    if (r) r->in_use = 1;
+    pthread_mutex_unlock(&trace_lock);
+    if (r) pthread_setspecific(trace_key, r);
+    trace_ring = r;
+    return r;
+}
+
+/* 0 when tracing is off; pass the result to trace_end */
+uint64_t trace_begin() {
+    return __atomic_load_n(&trace_enabled, __ATOMIC_RELAXED) ? trace_now_ns() : 0;
+}
+
+void trace_end_args(const char *name, uint64_t start, int nargs, const char *const *names, const long long *vals) {
+    if (!start) return;
+    uint64_t end = trace_now_ns();
+    TraceRing *r = trace_ring_get();
+    if (!r) return;
+    __atomic_add_fetch(&trace_writers, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&trace_enabled, __ATOMIC_SEQ_CST)) { // not stopped since the span began; sees trace_start's reset
+        TraceEvent *e = &r->events[r->head++ % TRACE_RING_CAP];
+        e->name = name;
+        e->start_ns = start;
+        e->dur_ns = end - start;
+        e->arg_names = names;
+        e->nargs = nargs < TRACE_MAX_ARGS ? nargs : TRACE_MAX_ARGS;
+        for (int i = 0; i < e->nargs; i++) e->args[i] = vals[i];
+    }
+    __atomic_sub_fetch(&trace_writers, 1, __ATOMIC_RELEASE);
+}
+
+/* switches tracing off and waits until no thread is still writing an
+   event. A writer counts itself in before it checks trace_enabled, so
+   once the count is 0 every later writer sees tracing off. */
+void trace_quiesce() {
+    __atomic_store_n(&trace_enabled, 0, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&trace_writers, __ATOMIC_SEQ_CST)) sched_yield();
+}
+
+/* items < 0: no args */
+void trace_end(const char *name, uint64_t start, long long items) {
+    static const char *const names[1] = { "items" };
+    trace_end_args(name, start, items >= 0, names, &items);
+}
+
+typedef struct TraceSpan {
+    const char *name;
+    uint64_t start;
+} TraceSpan;
+
+void trace_span_end(TraceSpan *s) {
+    trace_end(s->name, s->start, -1);
+}
+
+/* spans the rest of the enclosing block */
+#define TRACE_SPAN(name) TraceSpan trace_span_ __attribute__((cleanup(trace_span_end))) = { (name), trace_begin() }
+
+/* drops earlier events; main thread (the first caller's ring is tid 1,
+   labelled "main") */
+void trace_start() {
+    trace_ring_get();
+    trace_quiesce();
+    pthread_mutex_lock(&trace_lock);
+    for (TraceRing *r = trace_rings; r; r = r->next) r->head = 0;
+    pthread_mutex_unlock(&trace_lock);
+    trace_ns0 = trace_now_ns();
+    __atomic_store_n(&trace_enabled, 1, __ATOMIC_RELEASE);
+}
+
+/* ------------------------------
+   Node pools
+   Fixed-size nodes are carved out of large chunks and recycled through a
+   free list, so bulk loads do not pay one malloc per node.
+   ------------------------------*/
+typedef struct PoolChunk {
+    struct PoolChunk *next;
+} PoolChunk;
+
+typedef struct NodePool {
+    size_t obj_size;
+    size_t per_chunk;
+    void *free_list;   // recycled nodes, linked through their first word
+    PoolChunk *chunks;
+    char *bump;        // unused tail of the newest chunk
+    size_t bump_left;
+    int tag;           // MEM_* subsystem charged for this pool
+    long long live;    // nodes handed out and not freed
+    long long chunk_count;
+} NodePool;
+
+#define POOL_INIT(type, n, tag) { sizeof(type) < sizeof(void*) ? sizeof(void*) : sizeof(type), (n), NULL, NULL, NULL, 0, (tag), 0, 0 }
+
+size_t pool_chunk_bytes(NodePool *p) {
+    return sizeof(PoolChunk) + p->obj_size * p->per_chunk;
+}
+
+/* pools are only touched from the main thread, so these are plain adds */
+void pool_account(NodePool *p, long long nodes) {
+    p->live += nodes;
+    mem_stats[p->tag].objects += nodes;
+    mem_stats[p->tag].used += nodes * (long long)p->obj_size;
+}
+
+void *pool_alloc(NodePool *p) {
+    if (p->free_list) {
+        void *obj = p->free_list;
+        p->free_list = *(void **)obj;
+        pool_account(p, 1);
+        return obj;
+    }
+    if (!p->bump_left) {
+        PoolChunk *c = malloc(pool_chunk_bytes(p));
+        if (!c) return NULL;
+        mem_reserve(p->tag, (long long)pool_chunk_bytes(p));
+        p->chunk_count++;
+        c->next = p->chunks;
+        p->chunks = c;
+        p->bump = (char *)(c + 1);
+        p->bump_left = p->per_chunk;
+    }
+    void *obj = p->bump;
+    p->bump += p->obj_size;
+    p->bump_left--;
+    pool_account(p, 1);
+    return obj;
+}
+
+void pool_free(NodePool *p, void *obj) {
+    *(void **)obj = p->free_list;
+    p->free_list = obj;
+    pool_account(p, -1);
+}
+
+/* drop every node at once */
+void pool_reset(NodePool *p) {
+    PoolChunk *c = p->chunks;
+    while (c) {
+        PoolChunk *tmp = c;
+        c = c->next;
+        free(tmp);
+    }
+    mem_reserve(p->tag, -p->chunk_count * (long long)pool_chunk_bytes(p));
+    pool_account(p, -p->live);
+    p->chunk_count = 0;
+    p->chunks = NULL;
+    p->free_list = NULL;
+    p->bump = NULL;
+    p->bump_left = 0;
+}
+
+NodePool tx_pool = POOL_INIT(Transaction, 4096, MEM_TRANSACTIONS);
+NodePool acc_pool = POOL_INIT(Account, 256, MEM_ACCOUNTS);
+NodePool goal_pool = POOL_INIT(Goal, 256, MEM_GOALS);
+
+/* ------------------------------
+   Epoch-based reclamation
+   Read paths walk the account and transaction lists without locks. A
+   writer that unlinks a node (or replaces an array readers may hold)
+   retires it instead of freeing it; it is freed once the global epoch has
+   moved on twice, i.e. after every reader that could have seen it has
+   left its read section. One writer (the menu thread), up to
+   EPOCH_MAX_READERS reader threads.
+   ------------------------------*/
+#define EPOCH_MAX_READERS 64
+
+/* pointers readers follow are stored with release and loaded with acquire */
+#define PUBLISH(slot, val) __atomic_store_n(&(slot), (val), __ATOMIC_RELEASE)
+#define DEREF(slot) __atomic_load_n(&(slot), __ATOMIC_ACQUIRE)
+
+typedef struct EpochSlot {
+    uint64_t epoch;   // epoch announced on entry, 0 outside a read section
+    int depth;        // nesting, owner thread only
+    int taken;
+    char pad[48];     // one cache line per reader
+} EpochSlot;
+
+typedef struct Retired {
+    void *p;
+    NodePool *pool;   // NULL: plain mem_alloc block of `size` bytes
+    int tag;
+    size_t size;
+    uint64_t epoch;
+} Retired;
+
+EpochSlot epoch_slots[EPOCH_MAX_READERS];
+uint64_t global_epoch = 1;
+__thread int epoch_slot = -1;
+pthread_key_t epoch_key;
+pthread_once_t epoch_key_once = PTHREAD_ONCE_INIT;
+
+Retired *retired = NULL;    // FIFO, epochs non-decreasing
+size_t retired_head = 0, retired_len = 0, retired_cap = 0;
+long long epoch_reclaimed = 0;
+
+void epoch_slot_release(void *slot) {
+    EpochSlot *s = &epoch_slots[(intptr_t)slot - 1];
+    __atomic_store_n(&s->epoch, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&s->taken, 0, __ATOMIC_RELEASE);
+}
+
+void epoch_key_create() {
+    pthread_key_create(&epoch_key, epoch_slot_release);
+}
+
+/* claims a reader slot for this thread, waiting if all are taken */
+void epoch_claim_slot() {
+    pthread_once(&epoch_key_once, epoch_key_create);
+    for (;;) {
+        for (int i = 0; i < EPOCH_MAX_READERS; i++) {
+            int expected = 0;
+            if (!__atomic_load_n(&epoch_slots[i].taken, __ATOMIC_RELAXED) &&
+                __atomic_compare_exchange_n(&epoch_slots[i].taken, &expected, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+                epoch_slot = i;
+                pthread_setspecific(epoch_key, (void *)(intptr_t)(i + 1));
+                return;
+            }
+        }
+        sched_yield();
+    }
+}
+
+void epoch_enter() {
+    if (epoch_slot < 0) epoch_claim_slot();
+    EpochSlot *s = &epoch_slots[epoch_slot];
+    if (s->depth++) return;
+    uint64_t e;
+    do { // announce, then confirm the epoch did not move underneath us
+        e = __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE);
+        __atomic_store_n(&s->epoch, e, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    } while (__atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE) != e);
+}
+
+void epoch_exit() {
+    EpochSlot *s = &epoch_slots[epoch_slot];
+    if (--s->depth == 0) __atomic_store_n(&s->epoch, 0, __ATOMIC_RELEASE);
+}
+
+/* moves the epoch on if every active reader has caught up with it */
+int epoch_try_advance() {
+    uint64_t e = __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (int i = 0; i < EPOCH_MAX_READERS; i++) {
+        uint64_t r = __atomic_load_n(&epoch_slots[i].epoch, __ATOMIC_ACQUIRE);
+        if (r && r != e) return 0;
+    }
+    __atomic_store_n(&global_epoch, e + 1, __ATOMIC_SEQ_CST);
+    return 1;
+}
+
+/* frees everything retired at least two epochs ago; returns how many */
+long epoch_reclaim() {
+    epoch_try_advance();
+    uint64_t e = __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE);
+    long n = 0;
+    while (retired_head < retired_len && retired[retired_head].epoch + 2 <= e) {
+        Retired *r = &retired[retired_head++];
+        if (r->pool) pool_free(r->pool, r->p);
+        else mem_free(r->tag, r->p, r->size);
+        n++;
+    }
+    if (retired_head == retired_len) retired_head = retired_len = 0;
+    epoch_reclaimed += n;
+    return n;
+}
+
+void epoch_retire_entry(void *p, NodePool *pool, int tag, size_t size) {
+    if (retired_len == retired_cap) {
+        if (retired_head) { // slide the pending tail down before growing
+            memmove(retired, retired + retired_head, (retired_len - retired_head) * sizeof(Retired));
+            retired_len -= retired_head;
+            retired_head = 0;
+        }
+        if (retired_len == retired_cap) {
+            size_t ncap = retired_cap ? retired_cap * 2 : 1024;
+            Retired *nr = mem_realloc(MEM_EPOCH, retired, retired_cap * sizeof(Retired), ncap * sizeof(Retired));
+            if (!nr) { // cannot defer: wait out the readers and free now
+                while (!epoch_try_advance() || !epoch_try_advance()) sched_yield();
+                if (pool) pool_free(pool, p);
+                else mem_free(tag, p, size);
+                return;
+            }
+            retired = nr;
+            retired_cap = ncap;
+        }
+    }
+    Retired *r = &retired[retired_len++];
+    r->p = p;
+    r->pool = pool;
+    r->tag = tag;
+    r->size = size;
+    r->epoch = __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE);
+    if (retired_len - retired_head >= 1024) epoch_reclaim();
+}
+
+void epoch_retire_node(NodePool *pool, void *p) {
+    epoch_retire_entry(p, pool, 0, 0);
+}
+
+void epoch_retire_mem(int tag, void *p, size_t size) {
+    if (p) epoch_retire_entry(p, NULL, tag, size);
+}
+
+/* waits until no reader can still hold anything unlinked so far, then
+   frees all of it; bulk resets call this before dropping whole pools */
+void epoch_synchronize() {
+    for (int step = 0; step < 2; step++)
+        while (!epoch_try_advance()) sched_yield();
+    epoch_reclaim();
+}
+
+/* ------------------------------
+   Versioned balances (MVCC)
+   Every mutation is one commit (COMMIT_SCOPE); the commit clock counts
+   finished commits. A snapshot remembers the clock when it was opened.
+   While any snapshot is open, a balance about to be overwritten is first
+   pushed onto the account's version chain if some snapshot can still see
+   it, so snapshot readers find the value as of their commit. Chains are
+   trimmed by the writer once the snapshots needing them close. With no
+   snapshot open the only cost is one timestamp store per balance change.
+   ------------------------------*/
+#define MAX_SNAPSHOTS 16
+
+typedef struct BalanceVersion {
+    uint64_t ts;                  // commit that wrote this value
+    double balance;
+    struct BalanceVersion *prev;  // older
+} BalanceVersion;
+
+NodePool version_pool = POOL_INIT(BalanceVersion, 1024, MEM_VERSIONS);
+
+uint64_t commit_clock = 0;         // commits finished
+pthread_mutex_t commit_lock = PTHREAD_MUTEX_INITIALIZER;
+int commit_depth = 0;              // writer thread only: nested commits
+time_t commit_wall = 0;            // wall clock read once per commit (ledger_time)
+uint64_t snapshot_ts[MAX_SNAPSHOTS]; // 0 = free slot, else clock + 1
+int snapshot_count = 0;
+uint64_t commit_newest_snap = 0;   // newest open snapshot's clock + 1, per commit
+int mvcc_gc_pending = 0;
+Account **versioned = NULL;        // accounts with a non-empty chain
+int versioned_len = 0, versioned_cap = 0;
+long long versions_created = 0;
+
+/* oldest (want_oldest) or newest open snapshot as clock + 1, 0 if none */
+uint64_t snapshot_bound(int want_oldest) {
+    uint64_t best = 0;
+    for (int i = 0; i < MAX_SNAPSHOTS; i++) {
+        uint64_t t = __atomic_load_n(&snapshot_ts[i], __ATOMIC_ACQUIRE);
+        if (t && (!best || (want_oldest ? t < best : t > best))) best = t;
+    }
+    return best;
+}
+
+/* room in versioned for every account this commit could version: those
+   that exist now (accounts it creates start at its own commit and need
+   none). Writer, at the start of a commit. */
+int mvcc_reserve() {
+    int want = versioned_len + account_rows;
+    if (want <= versioned_cap) return 1;
+    int ncap = versioned_cap ? versioned_cap : 256;
+    while (ncap < want) ncap *= 2;
+    Account **nv = mem_realloc(MEM_VERSIONS, versioned, versioned_cap * sizeof(Account *), ncap * sizeof(Account *));
+    if (!nv) return 0;
+    versioned = nv;
+    versioned_cap = ncap;
+    return 1;
+}
+
+int commit_begin() {
+    if (commit_depth++ == 0) {
+        pthread_mutex_lock(&commit_lock);
+        for (;;) {
+            commit_newest_snap = __atomic_load_n(&snapshot_count, __ATOMIC_ACQUIRE) ? snapshot_bound(0) : 0;
+            if (!commit_newest_snap || mvcc_reserve()) break;
+            // no room to track the versions open snapshots would need: wait them out
+            pthread_mutex_unlock(&commit_lock);
+            while (__atomic_load_n(&snapshot_count, __ATOMIC_ACQUIRE)) sched_yield();
+            pthread_mutex_lock(&commit_lock);
+        }
+    }
+    return 0;
+}
+
+void mvcc_gc();
+void shm_commit_end(uint64_t commit);
+void velocity_release(Account *acc);
+
+void commit_end(int *unused) {
+    (void)unused;
+    if (--commit_depth) return;
+    commit_wall = 0;
+    __atomic_store_n(&commit_clock, commit_clock + 1, __ATOMIC_RELEASE);
+    shm_commit_end(commit_clock);
+    pthread_mutex_unlock(&commit_lock);
+    if (__atomic_load_n(&mvcc_gc_pending, __ATOMIC_ACQUIRE)) mvcc_gc();
+}
+
+/* the enclosing block is one commit, however it is left */
+#define COMMIT_SCOPE() int commit_scope_ __attribute__((cleanup(commit_end))) = commit_begin()
+
+/* sets acc's balance inside a commit, keeping the old value for any open
+   snapshot that still sees it */
+void mvcc_set_balance(Account *acc, double value) {
+    uint64_t now = commit_clock + 1;
+    if (!commit_newest_snap || acc->bal_ts == now || acc->bal_ts >= commit_newest_snap) {
+        // no open snapshot can see the current value: overwrite in place
+        if (commit_newest_snap) {
+            __atomic_store_n(&acc->mv_seq, acc->mv_seq + 1, __ATOMIC_RELEASE);
+            __atomic_thread_fence(__ATOMIC_RELEASE);
+        }
+        BALANCE(acc) = value;
+        __atomic_store_n(&acc->bal_ts, now, __ATOMIC_RELEASE);
+        if (commit_newest_snap) __atomic_store_n(&acc->mv_seq, acc->mv_seq + 1, __ATOMIC_RELEASE);
+        return;
+    }
+    BalanceVersion *v = pool_alloc(&version_pool);
+    if (v) {
+        v->ts = acc->bal_ts;
+        v->balance = BALANCE(acc);
+        v->prev = acc->versions;
+        versions_created++;
+        if (!acc->versions) versioned[versioned_len++] = acc; // commit_begin made room
+    }
+    __atomic_store_n(&acc->mv_seq, acc->mv_seq + 1, __ATOMIC_RELEASE); // odd: readers retry
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    if (v) PUBLISH(acc->versions, v);
+    BALANCE(acc) = value;
+    __atomic_store_n(&acc->bal_ts, now, __ATOMIC_RELEASE);
+    __atomic_store_n(&acc->mv_seq, acc->mv_seq + 1, __ATOMIC_RELEASE);
+}
+
+/* balance as of snapshot clock+1 value `snap` (lock-free, inside an epoch) */
+double mvcc_balance_at(Account *acc, uint64_t snap) {
+    for (;;) {
+        unsigned seq = __atomic_load_n(&acc->mv_seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) { sched_yield(); continue; }
+        uint64_t ts = __atomic_load_n(&acc->bal_ts, __ATOMIC_ACQUIRE);
+        double b = BALANCE_READ(acc);
+        BalanceVersion *v = DEREF(acc->versions);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&acc->mv_seq, __ATOMIC_ACQUIRE) != seq) continue;
+        if (ts < snap) return b;
+        for (; v; v = DEREF(v->prev))
+            if (v->ts < snap) return v->balance;
+        return b; // no older value kept: the account did not change since
+    }
+}
+
+/* writer side: drop versions no open snapshot needs. Each chain keeps
+   the newest version older than the oldest snapshot and everything newer. */
+void mvcc_gc() {
+    __atomic_store_n(&mvcc_gc_pending, 0, __ATOMIC_RELEASE);
+    uint64_t oldest = snapshot_bound(1);
+    int kept = 0;
+    for (int i = 0; i < versioned_len; i++) {
+        Account *acc = versioned[i];
+        BalanceVersion **link = &acc->versions;
+        if (oldest) {
+            while (*link && (*link)->ts >= oldest) link = &(*link)->prev;
+            if (*link) link = &(*link)->prev; // the one the oldest snapshot reads
+        }
+        BalanceVersion *dead = *link;
+        PUBLISH(*link, NULL);
+        while (dead) {
+            BalanceVersion *prev = dead->prev;
+            epoch_retire_node(&version_pool, dead);
+            dead = prev;
+        }
+        if (acc->versions) versioned[kept++] = acc;
+    }
+    versioned_len = kept;
+}
+
+/* ------------------------------
+   Shared-memory mirror
+   shm_publish(name) copies the accounts and transactions into a named
+   POSIX shared-memory region and from then on the writer keeps it current
+   (balance changes, new transactions, removed accounts). Records link by
+   byte offset from the start of the region, never by pointer, so any
+   process can map it anywhere: `finance_buddy --attach` reads live
+   balances without loading the data file. Records are append-only; the
+   header's seq is odd while a commit is changing the region, so readers
+   can retry a walk that overlapped one. Ledger totals are double-buffered
+   in the header at each commit end, so reading them never waits. The
+   region grows by doubling (readers map it again when header.size passes
+   what they mapped); a reload starts it over.
+   ------------------------------*/
+#define SHM_MAGIC "FBSHM01"
+#define SHM_INITIAL (16 << 20)
+
+typedef struct ShmTotals {
+    uint64_t commit;        // writer's commit clock
+    int64_t accounts;
+    int64_t transactions;
+    double total_balance;
+} ShmTotals;
+
+typedef struct ShmHeader {
+    char magic[8];
+    uint64_t size;          // bytes in the region
+    uint64_t used;          // bump allocator
+    uint64_t seq;           // odd while a commit is changing the region
+    uint64_t accounts;      // newest ShmAccount, 0 = none
+    uint64_t totals_gen;    // totals[totals_gen & 1] is the current one
+    ShmTotals totals[2];
+    int32_t writer_pid;
+    int32_t stale;          // ran out of space: frozen as of the totals
+} ShmHeader;
+
+typedef struct ShmAccount {
+    int32_t id;
+    int32_t removed;
+    char name[64];
+    double balance;
+    uint64_t tx_head;       // newest ShmTx
+    uint64_t next;          // older account
+} ShmAccount;
+
+typedef struct ShmTx {
+    int32_t id;
+    int32_t to_account;
+    int32_t category;
+    int32_t pad;
+    double amount;
+    char type[16];
+    char timestamp[64];
+    uint64_t next;          // older transaction
+} ShmTx;
+
+char *shm_base = NULL;      // writer's mapping; moves when the region grows
+int shm_fd = -1;
+char shm_name[64];
+
+#define SHM_HDR ((ShmHeader *)shm_base)
+#define SHM_AT(off, type) ((type *)(shm_base + (off)))
+
+void shm_write_begin() {
+    if (SHM_HDR->seq & 1) return;
+    __atomic_store_n(&SHM_HDR->seq, SHM_HDR->seq + 1, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void shm_unmap() {
+    mem_reserve(MEM_SHM, -(long long)SHM_HDR->size);
+    mem_use(MEM_SHM, -mem_stats[MEM_SHM].objects, -mem_stats[MEM_SHM].used);
+    munmap(shm_base, SHM_HDR->size);
+    close(shm_fd);
+    shm_base = NULL;
+    shm_fd = -1;
+}
+
+/* stop mirroring but leave the region readable as of its last commit */
+void shm_freeze() {
+    SHM_HDR->stale = 1;
+    if (SHM_HDR->seq & 1) __atomic_store_n(&SHM_HDR->seq, SHM_HDR->seq + 1, __ATOMIC_RELEASE);
+    shm_unmap();
+}
+
+int shm_grow(uint64_t need) {
+    uint64_t old = SHM_HDR->size, size = old;
+    while (size < need) size *= 2;
+    if (posix_fallocate(shm_fd, 0, (off_t)size) != 0) return 0; // no SIGBUS on a full /dev/shm later
+    char *nb = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    if (nb == MAP_FAILED) return 0;
+    munmap(shm_base, old); // everything links by offset, so moving is fine
+    shm_base = nb;
+    mem_reserve(MEM_SHM, (long long)(size - old));
+    __atomic_store_n(&SHM_HDR->size, size, __ATOMIC_RELEASE);
+    return 1;
+}
+
+/* offset of n fresh bytes, 0 if the region cannot grow (mirror frozen) */
+uint64_t shm_alloc(size_t n) {
+    n = (n + 7) & ~(size_t)7;
+    uint64_t off = SHM_HDR->used;
+    if (off + n > SHM_HDR->size && !shm_grow(off + n)) {
+        fprintf(stderr, "Shared ledger %s is out of space; it stays as of commit %llu\n", shm_name,
+                (unsigned long long)SHM_HDR->totals[SHM_HDR->totals_gen & 1].commit);
+        shm_freeze();
+        return 0;
+    }
+    SHM_HDR->used = off + n;
+    mem_use(MEM_SHM, 1, (long long)n);
+    return off;
+}
+
+/* the account's record, created (name and balance as now) on first use */
+uint64_t shm_account(Account *acc) {
+    if (acc->shm) return acc->shm;
+    uint64_t off = shm_alloc(sizeof(ShmAccount));
+    if (!off) return 0;
+    ShmAccount *sa = SHM_AT(off, ShmAccount);
+    memset(sa, 0, sizeof(*sa));
+    sa->id = acc->id;
+    memcpy(sa->name, acc->name, sizeof(sa->name));
+    sa->balance = BALANCE(acc);
+    sa->next = SHM_HDR->accounts;
+    __atomic_store_n(&SHM_HDR->accounts, off, __ATOMIC_RELEASE);
+    acc->shm = off;
+    return off;
+}
+
+uint64_t shm_tx(const Transaction *t, uint64_t next) {
+    uint64_t off = shm_alloc(sizeof(ShmTx));
+    if (!off) return 0;
+    ShmTx *st = SHM_AT(off, ShmTx);
+    st->id = t->id;
+    st->to_account = t->to_account;
+    st->category = t->category;
+    st->pad = 0;
+    st->amount = t->amount;
+    memcpy(st->type, t->type, sizeof(st->type));
+    memcpy(st->timestamp, t->timestamp, sizeof(st->timestamp));
+    st->next = next;
+    return off;
+}
+
+void shm_balance(Account *acc) {
+    if (!shm_base) return;
+    shm_write_begin();
+    uint64_t off = shm_account(acc);
+    if (!off) return;
+    double v = BALANCE(acc);
+    __atomic_store(&SHM_AT(off, ShmAccount)->balance, &v, __ATOMIC_RELAXED);
+}
+
+/* t was just linked at the head of acc's list */
+uint64_t shm_tx_added(Account *acc, const Transaction *t) {
+    if (!shm_base) return 0;
+    shm_write_begin();
+    uint64_t off = shm_account(acc);
+    uint64_t to = off ? shm_tx(t, SHM_AT(off, ShmAccount)->tx_head) : 0;
+    if (to) __atomic_store_n(&SHM_AT(off, ShmAccount)->tx_head, to, __ATOMIC_RELEASE);
+    return to;
+}
+
+/* links t's record after the one at tail, or as acc's first when tail is 0,
+   so load_data keeps the file's order; the new record's offset */
+uint64_t shm_tx_append(Account *acc, const Transaction *t, uint64_t tail) {
+    if (!shm_base) return 0;
+    shm_write_begin();
+    uint64_t off = shm_account(acc);
+    uint64_t to = off ? shm_tx(t, 0) : 0;
+    if (!to) return 0;
+    if (tail) __atomic_store_n(&SHM_AT(tail, ShmTx)->next, to, __ATOMIC_RELEASE);
+    else __atomic_store_n(&SHM_AT(off, ShmAccount)->tx_head, to, __ATOMIC_RELEASE);
+    return to;
+}
+
+/* unlinks acc's record (undo of an account creation) */
+void shm_account_removed(Account *acc) {
+    if (!shm_base || !acc->shm) return;
+    shm_write_begin();
+    uint64_t *link = &SHM_HDR->accounts;
+    while (*link && *link != acc->shm) link = &SHM_AT(*link, ShmAccount)->next;
+    if (*link) __atomic_store_n(link, SHM_AT(acc->shm, ShmAccount)->next, __ATOMIC_RELEASE);
+    SHM_AT(acc->shm, ShmAccount)->removed = 1;
+    acc->shm = 0;
+}
+
+/* fresh record with the whole transaction list, replacing any old one
+   (publishing, and accounts built off-list by import_json); the record of
+   its last transaction, 0 if none */
+uint64_t shm_mirror_account(Account *acc) {
+    if (!shm_base) return 0;
+    shm_account_removed(acc);
+    shm_write_begin();
+    uint64_t off = shm_account(acc), head = 0, tail = 0;
+    for (Transaction *t = acc->tx_head; t && shm_base; t = t->next) { // oldest last, like tx_head
+        uint64_t to = shm_tx(t, 0);
+        if (!to) return 0;
+        if (tail) SHM_AT(tail, ShmTx)->next = to;
+        else head = to;
+        tail = to;
+    }
+    if (!off || !shm_base) return 0;
+    __atomic_store_n(&SHM_AT(off, ShmAccount)->tx_head, head, __ATOMIC_RELEASE);
+    return tail;
+}
+
+/* the ledger is about to be rebuilt (load_data): start the region over */
+void shm_reset() {
+    if (!shm_base) return;
+    shm_write_begin();
+    __atomic_store_n(&SHM_HDR->accounts, 0, __ATOMIC_RELEASE);
+    mem_use(MEM_SHM, 0, -(long long)(SHM_HDR->used - sizeof(ShmHeader)));
+    SHM_HDR->used = sizeof(ShmHeader);
+}
+
+/* from commit_end: publish the totals and close the write */
+void shm_commit_end(uint64_t commit) {
+    if (!shm_base || !(SHM_HDR->seq & 1)) return;
+    ShmTotals *t = &SHM_HDR->totals[(SHM_HDR->totals_gen + 1) & 1];
+    t->commit = commit;
+    t->accounts = account_rows;
+    t->transactions = ledger_stats.transactions;
+    t->total_balance = ledger_stats.total_assets;
+    __atomic_store_n(&SHM_HDR->totals_gen, SHM_HDR->totals_gen + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&SHM_HDR->seq, SHM_HDR->seq + 1, __ATOMIC_RELEASE);
+}
+
+/* 1 while the process that published region `name` is still running. A
+   region too short for a header, or with no pid yet, counts as abandoned. */
+int shm_writer_alive(const char *name) {
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) return 0;
+    ShmHeader h;
+    ssize_t got = pread(fd, &h, sizeof(h), 0);
+    close(fd);
+    if (got != (ssize_t)sizeof(h) || h.writer_pid <= 0) return 0;
+    return kill((pid_t)h.writer_pid, 0) == 0 || errno != ESRCH;
+}
+
+/* creates region `name` holding the current ledger; 1 ok. A region left
+   by a writer that has exited is replaced; one whose writer is still
+   running is not touched (0, errno EBUSY). */
+int shm_publish(const char *name) {
+    if (shm_name[0]) return 0; // one region at a time
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0 && errno == EEXIST) {
+        if (shm_writer_alive(name)) {
+            errno = EBUSY;
+            return 0;
+        }
+        shm_unlink(name);
+        fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    }
+    if (fd < 0) return 0;
+    uint64_t need = sizeof(ShmHeader) + (uint64_t)account_rows * sizeof(ShmAccount) +
+                    (uint64_t)ledger_stats.transactions * sizeof(ShmTx);
+    uint64_t size = SHM_INITIAL;
+    while (size < need + need / 4) size *= 2;
+    char *base = posix_fallocate(fd, 0, (off_t)size) == 0
+        ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    if (base == MAP_FAILED) {
+        close(fd);
+        shm_unlink(name);
+        return 0;
+    }
+    COMMIT_SCOPE(); // the build is one commit to readers
+    shm_base = base;
+    shm_fd = fd;
+    snprintf(shm_name, sizeof(shm_name), "%s", name);
+    memset(SHM_HDR, 0, sizeof(ShmHeader));
+    SHM_HDR->size = size;
+    SHM_HDR->used = sizeof(ShmHeader);
+    SHM_HDR->seq = 1;
+    SHM_HDR->writer_pid = (int32_t)getpid();
+    mem_reserve(MEM_SHM, (long long)size);
+    mem_use(MEM_SHM, 1, sizeof(ShmHeader));
+    // oldest account first, so the region's list ends up newest first too
+    int n = 0;
+    for (Account *a = accounts_head; a; a = a->next) n++;
+    Account **order = malloc((n ? n : 1) * sizeof(Account *));
+    if (order) {
+        int i = n;
+        for (Account *a = accounts_head; a; a = a->next) order[--i] = a;
+        for (i = 0; i < n && shm_base; i++) {
+            order[i]->shm = 0;
+            shm_mirror_account(order[i]);
+        }
+        free(order);
+    }
+    memcpy(SHM_HDR, SHM_MAGIC, 8); // readers accept the region from here on
+    return shm_base != NULL && order != NULL;
+}
+
+void shm_unpublish() {
+    if (shm_base) shm_unmap();
+    if (shm_name[0]) shm_unlink(shm_name);
+    shm_name[0] = '\0';
+}
+
+/* ---- readers (any process) ---- */
+
+#define SHM_OLD_MAPS 32 // sizes double, so a handful is plenty
+
+typedef struct ShmView {
+    int fd;
+    const char *base;
+    uint64_t size;          // bytes mapped here
+    int nold;               // earlier, smaller mappings: records read through
+    const char *old_base[SHM_OLD_MAPS]; // them stay valid until detach
+    uint64_t old_size[SHM_OLD_MAPS];
+} ShmView;
+
+/* 1 ok, 0 no such region */
+int shm_attach(const char *name, ShmView *v) {
+    v->fd = shm_open(name, O_RDONLY, 0);
+    if (v->fd < 0) return 0;
+    struct stat st;
+    if (fstat(v->fd, &st) < 0 || (size_t)st.st_size < sizeof(ShmHeader)) {
+        close(v->fd);
+        return 0;
+    }
+    v->size = (uint64_t)st.st_size;
+    v->nold = 0;
+    v->base = mmap(NULL, v->size, PROT_READ, MAP_SHARED, v->fd, 0);
+    if (v->base == MAP_FAILED || memcmp(v->base, SHM_MAGIC, 8) != 0) {
+        if (v->base != MAP_FAILED) munmap((void *)v->base, v->size);
+        close(v->fd);
+        return 0;
+    }
+    return 1;
+}
+
+void shm_detach(ShmView *v) {
+    for (int i = 0; i < v->nold; i++) munmap((void *)v->old_base[i], v->old_size[i]);
+    munmap((void *)v->base, v->size);
+    close(v->fd);
+}
+
+/* n bytes at off, mapping the region again if the writer has grown it;
+   NULL for an offset that is not in the region (a torn read: the query
+   retries) */
+const void *shm_view_at(ShmView *v, uint64_t off, size_t n) {
+    if (!off) return NULL;
+    if (off + n > v->size) {
+        uint64_t size = __atomic_load_n(&((const ShmHeader *)v->base)->size, __ATOMIC_ACQUIRE);
+        if (off + n > size || v->nold == SHM_OLD_MAPS) return NULL;
+        const char *nb = mmap(NULL, size, PROT_READ, MAP_SHARED, v->fd, 0);
+        if (nb == MAP_FAILED) return NULL;
+        v->old_base[v->nold] = v->base;
+        v->old_size[v->nold++] = v->size;
+        v->base = nb;
+        v->size = size;
+    }
+    return v->base + off;
+}
+
+/* waits out a commit in progress, briefly: a busy writer is inside one
+   nearly all the time, and one that died mid-commit never leaves it */
+uint64_t shm_read_begin(ShmView *v) {
+    uint64_t seq;
+    for (int spins = 0; ((seq = __atomic_load_n(&((const ShmHeader *)v->base)->seq, __ATOMIC_ACQUIRE)) & 1) &&
+                        spins < 1000; spins++)
+        sched_yield();
+    return seq;
+}
+
+/* the query saw one commit's state */
+int shm_read_valid(ShmView *v, uint64_t seq) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return !(seq & 1) && __atomic_load_n(&((const ShmHeader *)v->base)->seq, __ATOMIC_RELAXED) == seq;
+}
+
+/* the totals as of the newest finished commit; never waits on the writer */
+void shm_view_header_totals(ShmView *v, ShmTotals *out) {
+    const ShmHeader *h = (const ShmHeader *)v->base;
+    uint64_t gen;
+    do {
+        gen = __atomic_load_n(&h->totals_gen, __ATOMIC_ACQUIRE);
+        *out = h->totals[gen & 1];
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(&h->totals_gen, __ATOMIC_RELAXED) != gen);
+}
+
+/* recomputes the totals by walking every account and transaction; returns
+   the number of attempts (more than 1 when commits overlapped), 0 if it
+   never got a clean read */
+int shm_view_totals(ShmView *v, ShmTotals *out, int max_tries) {
+    for (int attempt = 1; attempt <= max_tries; attempt++) {
+        uint64_t seq = shm_read_begin(v);
+        ShmTotals t = { 0 };
+        uint64_t off = __atomic_load_n(&((const ShmHeader *)v->base)->accounts, __ATOMIC_ACQUIRE);
+        int torn = 0;
+        for (long guard = 0; off && !torn; guard++) {
+            const ShmAccount *a = shm_view_at(v, off, sizeof(ShmAccount));
+            if (!a || guard > (long)(v->size / sizeof(ShmAccount))) { torn = 1; break; }
+            t.accounts++;
+            t.total_balance += a->balance;
+            for (uint64_t toff = a->tx_head; toff && !torn; ) {
+                const ShmTx *tx = shm_view_at(v, toff, sizeof(ShmTx));
+                if (!tx || ++t.transactions > (long)(v->size / sizeof(ShmTx))) { torn = 1; break; }
+                toff = tx->next;
+            }
+            off = a->next;
+        }
+        if (!torn && shm_read_valid(v, seq)) {
+            t.commit = ((const ShmHeader *)v->base)->totals[((const ShmHeader *)v->base)->totals_gen & 1].commit;
+            *out = t;
+            return attempt;
+        }
+    }
+    return 0;
+}
+
+/* ------------------------------
+   Account table
+   Rows are kept dense: a freed row is filled by moving the last row into
+   it, so the balance column never has holes for the kernels to skip, and
+   the arrays shrink once they are less than a quarter used. Account ids
+   are never reused (transactions and snapshots refer to them), so undone
+   creates leave holes in the id space; find_account goes through a
+   two-level map from id to account whose pages of ACCOUNT_MAP_PAGE ids
+   are allocated on first use and released when none of their ids is
+   live. Its size follows the live accounts, not every id ever issued.
+   ------------------------------*/
+#define ACCOUNT_MAP_BITS 10
+#define ACCOUNT_MAP_PAGE (1 << ACCOUNT_MAP_BITS)
+
+typedef struct AccountMapPage {
+    int live;                           // ids in use (writer only)
+    Account *acc[ACCOUNT_MAP_PAGE];
+} AccountMapPage;
+
+typedef struct AccountMap {
+    int pages;
+    AccountMapPage *page[];             // NULL while none of its ids is live
+} AccountMap;
+
+AccountMap *account_map = NULL;
+
+size_t account_map_bytes(int pages) {
+    return sizeof(AccountMap) + pages * sizeof(AccountMapPage *);
+}
+
+/* points id at acc, or drops it for acc NULL; 0 when out of memory or
+   for a negative id */
+int account_map_set(int id, Account *acc) {
+    if (id < 0) return 0;
+    int p = id >> ACCOUNT_MAP_BITS;
+    AccountMap *m = account_map;
+    if (!m || p >= m->pages) {
+        if (!acc) return 1;
+        int npages = m ? m->pages * 2 : 16;
+        while (npages <= p) npages *= 2;
+        AccountMap *nm = mem_calloc(MEM_ACCOUNT_TABLE, 1, account_map_bytes(npages));
+        if (!nm) return 0;
+        nm->pages = npages;
+        if (m) {
+            memcpy(nm->page, m->page, m->pages * sizeof(AccountMapPage *));
+            epoch_retire_mem(MEM_ACCOUNT_TABLE, m, account_map_bytes(m->pages));
+        }
+        PUBLISH(account_map, nm);
+        m = nm;
+    }
+    AccountMapPage *pg = m->page[p];
+    if (!pg) {
+        if (!acc) return 1;
+        pg = mem_calloc(MEM_ACCOUNT_TABLE, 1, sizeof(AccountMapPage));
+        if (!pg) return 0;
+        PUBLISH(m->page[p], pg);
+    }
+    Account **e = &pg->acc[id & (ACCOUNT_MAP_PAGE - 1)];
+    pg->live += (acc != NULL) - (*e != NULL);
+    PUBLISH(*e, acc);
+    if (!pg->live) {
+        PUBLISH(m->page[p], NULL);
+        epoch_retire_mem(MEM_ACCOUNT_TABLE, pg, sizeof(AccountMapPage));
+    }
+    return 1;
+}
+
+/* drops the whole map (free_all_data) */
+void account_map_reset() {
+    AccountMap *m = account_map;
+    if (!m) return;
+    PUBLISH(account_map, NULL);
+    for (int p = 0; p < m->pages; p++)
+        if (m->page[p]) epoch_retire_mem(MEM_ACCOUNT_TABLE, m->page[p], sizeof(AccountMapPage));
+    epoch_retire_mem(MEM_ACCOUNT_TABLE, m, account_map_bytes(m->pages));
+}
+
+/* moves the rows to arrays of ncap; 0 when out of memory */
+int account_table_resize(int ncap) {
+    // copy rather than realloc: readers may still be on the old arrays
+    double *ncol = mem_alloc(MEM_ACCOUNT_TABLE, ncap * sizeof(double));
+    Account **nslot = mem_alloc(MEM_ACCOUNT_TABLE, ncap * sizeof(Account *));
+    if (!ncol || !nslot) {
+        mem_free(MEM_ACCOUNT_TABLE, ncol, ncap * sizeof(double));
+        mem_free(MEM_ACCOUNT_TABLE, nslot, ncap * sizeof(Account *));
+        return 0;
+    }
+    if (account_rows) {
+        memcpy(ncol, balance_col, account_rows * sizeof(double));
+        memcpy(nslot, slot_account, account_rows * sizeof(Account *));
+    }
+    epoch_retire_mem(MEM_ACCOUNT_TABLE, balance_col, account_rows_cap * sizeof(double));
+    epoch_retire_mem(MEM_ACCOUNT_TABLE, slot_account, account_rows_cap * sizeof(Account *));
+    PUBLISH(balance_col, ncol);
+    PUBLISH(slot_account, nslot);
+    account_rows_cap = ncap;
+    return 1;
+}
+
+/* new zeroed account with a table row; NULL when out of memory. It is
+   complete before find_account readers can reach it through the map. */
+Account *account_new(int id) {
+    if (account_rows == account_rows_cap && !account_table_resize(account_rows_cap ? account_rows_cap * 2 : 256))
+        return NULL;
+    Account *acc = pool_alloc(&acc_pool);
+    if (!acc) return NULL;
+    memset(acc, 0, sizeof(*acc));
+    acc->id = id;
+    acc->slot = account_rows;
+    acc->bal_ts = commit_clock + 1; // no snapshot open now can see it: never versioned (mvcc_reserve)
+    __atomic_thread_fence(__ATOMIC_RELEASE); // the row's old owner has moved off it (account_delete)
+    balance_col[acc->slot] = 0;
+    slot_account[acc->slot] = acc;
+    if (!account_map_set(id, acc)) { // publishes acc (release) on success
+        slot_account[acc->slot] = NULL;
+        pool_free(&acc_pool, acc);
+        return NULL;
+    }
+    account_rows++;
+    return acc;
+}
+
+/* every balance change goes through here to keep total_assets exact */
+void adjust_balance(Account *acc, double delta) {
+    mvcc_set_balance(acc, BALANCE(acc) + delta);
+    ledger_stats.total_assets += delta;
+    shm_balance(acc);
+}
+
+/* frees the row now and the node once readers are done with it (the
+   caller unlinks it and retires its transactions) */
+void account_delete(Account *acc) {
+    shm_account_removed(acc);
+    velocity_release(acc);
+    ledger_stats.total_assets -= BALANCE(acc);
+    int last = --account_rows, row = acc->slot;
+    acc->gone_balance = BALANCE(acc);
+    PUBLISH(acc->slot, -1);
+    if (row != last) {
+        Account *moved = slot_account[last];
+        __atomic_thread_fence(__ATOMIC_RELEASE); // acc is off the row before moved's balance lands on it
+        balance_col[row] = balance_col[last];
+        slot_account[row] = moved;
+        PUBLISH(moved->slot, row);
+    }
+    if (account_map->page[acc->id >> ACCOUNT_MAP_BITS]->acc[acc->id & (ACCOUNT_MAP_PAGE - 1)] == acc)
+        account_map_set(acc->id, NULL); // not when a later duplicate id took it over
+    if (account_rows_cap > 256 && account_rows < account_rows_cap / 4) account_table_resize(account_rows_cap / 2);
+    epoch_retire_node(&acc_pool, acc);
+}
+
+/* lock-free balance read. A delete moves the last row into the freed one
+   and a new account reuses the last, so the row is read and then checked
+   to be still acc's; rows only move down, so an unchanged slot means the
+   value was acc's. Deleted accounts read as they were when they went. */
+double balance_read(Account *acc) {
+    for (;;) {
+        int slot = DEREF(acc->slot);
+        if (slot < 0) return acc->gone_balance;
+        double b = DEREF(balance_col)[slot];
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&acc->slot, __ATOMIC_RELAXED) == slot) return b;
+    }
+}
+
+/* Aggregate kernels over the balance column. SSE2 handles two rows per
+   step (four for the sum, to hide add latency); a scalar loop does the
+   tail and the non-SSE2 build. */
+double balance_sum() {
+    const double *b = balance_col;
+    int n = account_rows, i = 0;
+    double total = 0;
+#if defined(__SSE2__)
+    __m128d s0 = _mm_setzero_pd(), s1 = _mm_setzero_pd();
+    for (; i + 4 <= n; i += 4) {
+        s0 = _mm_add_pd(s0, _mm_loadu_pd(b + i));
+        s1 = _mm_add_pd(s1, _mm_loadu_pd(b + i + 2));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(s0, s1));
+    total = lanes[0] + lanes[1];
+#endif
+    for (; i < n; i++) total += b[i];
+    return total;
+}
+
+/* min and max in one pass; both 0 for an empty table */
+void balance_min_max(double *min_out, double *max_out) {
+    const double *b = balance_col;
+    int n = account_rows, i = 0;
+    if (n == 0) { *min_out = *max_out = 0; return; }
+    double lo = b[0], hi = b[0];
+#if defined(__SSE2__)
+    if (n >= 2) {
+        __m128d vlo = _mm_loadu_pd(b), vhi = vlo;
+        for (i = 2; i + 2 <= n; i += 2) {
+            __m128d v = _mm_loadu_pd(b + i);
+            vlo = _mm_min_pd(vlo, v);
+            vhi = _mm_max_pd(vhi, v);
+        }
+        double l[2], h[2];
+        _mm_storeu_pd(l, vlo);
+        _mm_storeu_pd(h, vhi);
+        lo = l[0] < l[1] ? l[0] : l[1];
+        hi = h[0] > h[1] ? h[0] : h[1];
+    }
+#endif
+    for (; i < n; i++) {
+        if (b[i] < lo) lo = b[i];
+        if (b[i] > hi) hi = b[i];
+    }
+    *min_out = lo;
+    *max_out = hi;
+}
+
+int balance_count_above(double threshold) {
+    const double *b = balance_col;
+    int n = account_rows, i = 0, count = 0;
+#if defined(__SSE2__)
+    __m128d t = _mm_set1_pd(threshold);
+    for (; i + 2 <= n; i += 2)
+        count += __builtin_popcount(_mm_movemask_pd(_mm_cmpgt_pd(_mm_loadu_pd(b + i), t)));
+#endif
+    for (; i < n; i++) count += b[i] > threshold;
+    return count;
+}
+
+/* the old way: walk accounts_head; kept to cross-check the kernels */
+double balance_sum_scan() {
+    double total = 0;
+    epoch_enter();
+    for (Account *a = DEREF(accounts_head); a; a = DEREF(a->next)) total += BALANCE_READ(a);
+    epoch_exit();
+    return total;
+}
+
+/* min, max and the count above threshold by the same walk */
+void balance_stats_scan(double threshold, double *min_out, double *max_out, int *above) {
+    double lo = 0, hi = 0;
+    int count = 0, first = 1;
+    epoch_enter();
+    for (Account *a = DEREF(accounts_head); a; a = DEREF(a->next)) {
+        double b = BALANCE_READ(a);
+        if (first || b < lo) lo = b;
+        if (first || b > hi) hi = b;
+        count += b > threshold;
+        first = 0;
+    }
+    epoch_exit();
+    *min_out = lo;
+    *max_out = hi;
+    *above = count;
+}
+
+/* ------------------------------
+   Utility functions
+   ------------------------------*/
+time_t ledger_clock = 0; // when set, overrides the wall clock (scheduled runs, simulations)
+
+/* one reading per commit on the writer, so every transaction a commit
+   stamps (and its replication record) carries the same second */
+time_t ledger_time() {
+    if (ledger_clock) return ledger_clock;
+    if (!commit_depth) return time(NULL);
+    if (!commit_wall) commit_wall = time(NULL);
+    return commit_wall;
+}
+
+char *current_time_str(char *buf, size_t n) {
+    // formatting is far dearer than the copy; most calls land in the same second
+    static time_t cached_t = -1;
+    static char cached[32];
+    time_t t = ledger_time();
+    if (t != cached_t) {
+        struct tm *tm = localtime(&t);
+        strftime(cached, sizeof(cached), "%Y-%m-%d %H:%M:%S", tm);
+        cached_t = t;
+    }
+    snprintf(buf, n, "%s", cached);
+    return buf;
+}
+
+double monotonic_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int cpu_count() {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+/* Splits [0, n) into one contiguous range per thread (multiples of grain)
+   and calls fn(ctx, begin, end) on each; the calling thread takes the first
+   range. nthreads <= 0 means one per CPU. */
+typedef struct ParallelTask {
+    void (*fn)(void *ctx, size_t begin, size_t end);
+    void *ctx;
+    size_t begin, end;
+} ParallelTask;
+
+void *parallel_task_main(void *arg) {
+    ParallelTask *t = arg;
+    t->fn(t->ctx, t->begin, t->end);
+    return NULL;
+}
+
+void run_parallel(int nthreads, size_t n, size_t grain, void (*fn)(void *ctx, size_t begin, size_t end), void *ctx) {
+    if (nthreads <= 0) nthreads = cpu_count();
+    if (grain == 0) grain = 1;
+    size_t chunks = (n + grain - 1) / grain;
+    if ((size_t)nthreads > chunks) nthreads = chunks ? (int)chunks : 1;
+    if (nthreads <= 1) {
+        if (n) fn(ctx, 0, n);
+        return;
+    }
+    ParallelTask *tasks = malloc(nthreads * sizeof(ParallelTask));
+    pthread_t *threads = malloc(nthreads * sizeof(pthread_t));
+    if (!tasks || !threads) {
+        free(tasks);
+        free(threads);
+        fn(ctx, 0, n);
+        return;
+    }
+    size_t per = (chunks + nthreads - 1) / nthreads * grain;
+    for (int i = 0; i < nthreads; i++) {
+        tasks[i].fn = fn;
+        tasks[i].ctx = ctx;
+        tasks[i].begin = i * per < n ? i * per : n;
+        tasks[i].end = (i + 1) * per < n ? (i + 1) * per : n;
+    }
+    int started = 1;
+    for (int i = 1; i < nthreads; i++, started++)
+        if (pthread_create(&threads[i], NULL, parallel_task_main, &tasks[i]) != 0) break;
+    for (int i = started; i < nthreads; i++) parallel_task_main(&tasks[i]); // could not spawn: run inline
+    parallel_task_main(&tasks[0]);
+    for (int i = 1; i < started; i++) pthread_join(threads[i], NULL);
+    free(tasks);
+    free(threads);
+}
+
+Account* find_account(int id) {
+    AccountMap *m = DEREF(account_map);
+    if (!m || id < 0 || (id >> ACCOUNT_MAP_BITS) >= m->pages) return NULL;
+    AccountMapPage *pg = DEREF(m->page[id >> ACCOUNT_MAP_BITS]);
+    return pg ? DEREF(pg->acc[id & (ACCOUNT_MAP_PAGE - 1)]) : NULL;
+}
+
+int undo_recording = 1; // 0 while standing orders run: those steps are not the user's to undo
+
+/* the new top of the undo stack, or a scratch node that goes nowhere
+   while undo_recording is off */
+OpNode *push_undo(const char *op, int acc_id, int acc_id_to, double amount) {
+    static OpNode unrecorded;
+    OpNode *n = undo_recording ? mem_alloc(MEM_UNDO, sizeof(OpNode)) : NULL;
+    if (!n) {
+        memset(&unrecorded, 0, sizeof(unrecorded));
+        return &unrecorded;
+    }
+    strcpy(n->op_type, op);
+    n->acc_id = acc_id;
+    n->acc_id_to = acc_id_to;
+    n->amount = amount;
+    n->category = CAT_NONE;
+    n->velocity_at = 0;
+    n->group = NULL;
+    n->group_len = 0;
+    n->next = undo_stack;
+    undo_stack = n;
+    return n;
+}
+
+OpNode* pop_undo() {
+    if (!undo_stack) return NULL;
+    OpNode *top = undo_stack;
+    undo_stack = undo_stack->next;
+    return top;
+}
+
+void free_undo_node(OpNode *op) {
+    mem_free(MEM_UNDO, op->group, op->group_len * sizeof(GroupEntry));
+    mem_free(MEM_UNDO, op, sizeof(OpNode));
+}
+
+/* ------------------------------
+   Cold transaction history
+   With tiering on (tier_age_days > 0), transactions older than that many
+   days leave memory for an append-only history file. tier_evict moves an
+   account's old transactions into one block there, and load_data sends
+   old TX lines straight to the file. An account's blocks are chained
+   newest first from its cold_head. Whatever needs the whole history
+   (save, export, the stats cross-check, viewing an account) follows the
+   chain with a ColdCursor, one pread per block. The file sits beside the
+   data file (tier_beside) and only holds what the data file also holds,
+   so it is truncated whenever the ledger is rebuilt; an exclusive flock
+   keeps a second process on the same data file from truncating it under
+   the first. Transactions are moved only while no snapshot is open.
+   A lazy load (lazy_load) leaves each account's TX lines in the data file
+   and keeps where they are; the same cursor reads them from there, ahead
+   of any blocks, until account_page_in brings them into memory. New
+   transactions go on the head of the list meanwhile, so writes never
+   page anything in; only viewing the account does.
+   ------------------------------*/
+#define TIER_MAGIC "FBCOLD01" // offset 0 holds this, so 0 can mean "no block"
+
+typedef struct ColdTx {
+    int id;
+    int to_account;
+    int category;
+    char type[16];
+    double amount;
+    char timestamp[32];
+} ColdTx;
+
+typedef struct ColdBlock {
+    int acc_id;
+    int count;          // ColdTx records that follow, newest first
+    uint64_t prev;      // the account's next older block, 0 = none
+} ColdBlock;
+
+int tier_age_days = 0;              // 0 = all history stays in memory
+char tier_path[256] = "finance_data.txt.history";
+int tier_fd = -1;
+uint64_t tier_end = 0;              // where the next block goes
+long long tier_blocks_read = 0;
+
+/* 0 if the file cannot be written or another process holds it */
+int tier_open() {
+    if (tier_fd >= 0) return 1;
+    tier_fd = open(tier_path, O_RDWR | O_CREAT, 0644);
+    if (tier_fd < 0) return 0;
+    // only emptied once it is ours: whatever it held was for an older load
+    if (flock(tier_fd, LOCK_EX | LOCK_NB) != 0 || ftruncate(tier_fd, 0) != 0 ||
+        pwrite(tier_fd, TIER_MAGIC, 8, 0) != 8) {
+        close(tier_fd);
+        tier_fd = -1;
+        return 0;
+    }
+    tier_end = 8;
+    return 1;
+}
+
+/* the history file of the ledger kept in datafile */
+void tier_beside(const char *datafile) {
+    if (tier_fd >= 0) close(tier_fd);
+    tier_fd = -1;
+    snprintf(tier_path, sizeof(tier_path), "%s.history", datafile);
+}
+
+/* the ledger is about to be rebuilt (load_data): drop every block */
+void tier_reset() {
+    if (tier_fd >= 0 && ftruncate(tier_fd, 8) == 0) tier_end = 8;
+}
+
+/* followers (and the bench's forked ones) keep their own history file
+   rather than truncating the primary's, which a fork shares the fd (and
+   the lock) of */
+void tier_private(const char *prefix) {
+    if (tier_fd >= 0) close(tier_fd);
+    tier_fd = -1;
+    snprintf(tier_path, sizeof(tier_path), "%s_%d.dat", prefix, (int)getpid());
+}
+
+/* timestamps before this string are cold */
+void tier_cutoff(char *buf, size_t n) {
+    time_t t = ledger_time() - (time_t)tier_age_days * 86400;
+    strftime(buf, n, "%Y-%m-%d %H:%M:%S", localtime(&t));
+}
+
+void cold_from_tx(ColdTx *c, const Transaction *t) {
+    memset(c, 0, sizeof(*c));
+    c->id = t->id;
+    c->to_account = t->to_account;
+    c->category = t->category;
+    snprintf(c->type, sizeof(c->type), "%s", t->type);
+    c->amount = t->amount;
+    // "YYYY-MM-DD HH:MM:SS"; an imported stamp's note on what the file said
+    // (import_transaction) is dropped whole when it does not fit
+    int keep = strlen(t->timestamp) < sizeof(c->timestamp) ? (int)sizeof(c->timestamp) - 1 : 19;
+    snprintf(c->timestamp, sizeof(c->timestamp), "%.*s", keep, t->timestamp);
+}
+
+void tx_from_cold(Transaction *t, const ColdTx *c) {
+    memset(t, 0, sizeof(*t));
+    t->id = c->id;
+    t->to_account = c->to_account;
+    t->category = c->category;
+    memcpy(t->type, c->type, sizeof(c->type));
+    t->amount = c->amount;
+    memcpy(t->timestamp, c->timestamp, sizeof(c->timestamp));
+}
+
+/* appends a block of n records; its offset, 0 on a write error */
+uint64_t tier_write_block(int acc_id, uint64_t prev, const ColdTx *recs, int n) {
+    if (!tier_open()) return 0;
+    ColdBlock b = { acc_id, n, prev };
+    size_t bytes = (size_t)n * sizeof(ColdTx);
+    uint64_t off = tier_end;
+    if (pwrite(tier_fd, &b, sizeof(b), off) != sizeof(b) ||
+        pwrite(tier_fd, recs, bytes, off + sizeof(b)) != (ssize_t)bytes)
+        return 0;
+    tier_end += sizeof(b) + bytes;
+    return off;
+}
+
+/* moves a's transactions older than cutoff into one block; how many
+   moved, -1 on a write error (they stay in memory) */
+long tier_evict_account(Account *a, const char *cutoff, ColdTx **buf, size_t *cap) {
+    if (__atomic_load_n(&a->lazy_count, __ATOMIC_ACQUIRE)) return 0; // older lines still in the data file
+    size_t n = 0;
+    for (Transaction *t = a->tx_head; t; t = t->next) n += strcmp(t->timestamp, cutoff) < 0;
+    if (!n) return 0;
+    if (n > *cap) {
+        ColdTx *nb = realloc(*buf, n * sizeof(ColdTx));
+        if (!nb) return -1;
+        *buf = nb;
+        *cap = n;
+    }
+    size_t i = 0;
+    for (Transaction *t = a->tx_head; t; t = t->next)
+        if (strcmp(t->timestamp, cutoff) < 0) cold_from_tx(&(*buf)[i++], t);
+    uint64_t off = tier_write_block(a->id, a->cold_head, *buf, (int)n);
+    if (!off) return -1;
+    for (Transaction **link = &a->tx_head; *link; ) {
+        Transaction *t = *link;
+        if (strcmp(t->timestamp, cutoff) < 0) {
+            PUBLISH(*link, t->next); // readers on t still find the rest of the list
+            epoch_retire_node(&tx_pool, t);
+        } else {
+            link = &t->next;
+        }
+    }
+    a->cold_head = off;
+    a->cold_count += n;
+    shm_mirror_account(a); // readers of the region see the in-memory window only
+    return (long)n;
+}
+
+/* moves every account's old transactions to the history file; how many
+   moved, -1 while a snapshot is open or on a write error */
+long tier_evict() {
+    COMMIT_SCOPE(); // no snapshot can open meanwhile
+    if (tier_age_days <= 0) return 0;
+    if (__atomic_load_n(&snapshot_count, __ATOMIC_ACQUIRE)) return -1;
+    TRACE_SPAN("tier.evict");
+    char cutoff[32];
+    tier_cutoff(cutoff, sizeof(cutoff));
+    ColdTx *buf = NULL;
+    size_t cap = 0;
+    long moved = 0;
+    for (Account *a = accounts_head; a; a = a->next) {
+        long n = tier_evict_account(a, cutoff, &buf, &cap);
+        if (n < 0) { moved = -1; break; }
+        moved += n;
+    }
+    free(buf);
+    return moved;
+}
+
+int lazy_load = 0;      // load_data reads balances only (--lazy)
+int lazy_fd = -1;       // the data file lazily loaded accounts read from
+int lazy_tx_floor = 0;  // next_tx_id after the lazy load: every line left on disk is below it
+long long lazy_pages = 0;
+
+/* CRC-32 (IEEE, as zlib), chainable: crc32_update(crc32_update(0, a), b)
+   is the CRC of a then b. Eight bytes a step through eight tables
+   ("slicing by 8"): a page-in checks every byte it reads */
+uint32_t crc32_table[8][256];
+int crc32_ready = 0;
+
+void crc32_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        crc32_table[0][i] = c;
+    }
+    for (int t = 1; t < 8; t++)
+        for (int i = 0; i < 256; i++)
+            crc32_table[t][i] = (crc32_table[t - 1][i] >> 8) ^ crc32_table[0][crc32_table[t - 1][i] & 0xff];
+    __atomic_store_n(&crc32_ready, 1, __ATOMIC_RELEASE);
+}
+
+uint32_t crc32_update(uint32_t crc, const void *data, size_t n) {
+    if (!__atomic_load_n(&crc32_ready, __ATOMIC_ACQUIRE)) crc32_init(); // racing inits write the same values
+    const uint32_t (*T)[256] = crc32_table;
+    const unsigned char *p = data;
+    crc = ~crc;
+    for (; n >= 8; p += 8, n -= 8) {
+        uint32_t lo = crc ^ (p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24);
+        uint32_t hi = p[4] | p[5] << 8 | p[6] << 16 | (uint32_t)p[7] << 24;
+        crc = T[7][lo & 0xff] ^ T[6][(lo >> 8) & 0xff] ^ T[5][(lo >> 16) & 0xff] ^ T[4][lo >> 24] ^
+              T[3][hi & 0xff] ^ T[2][(hi >> 8) & 0xff] ^ T[1][(hi >> 16) & 0xff] ^ T[0][hi >> 24];
+    }
+    while (n--) crc = T[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+/* the fields of a TX line after "TX|" (which it cuts up); 0 if too few */
+int parse_tx_line(char *p, int *acc_id, Transaction *t) {
+    // timestamp contains spaces, so split on '|' by hand
+    char *parts[7];
+    int pi = 0;
+    parts[pi++] = p;
+    while (*p && pi < 7) {
+        if (*p == '|') {
+            *p = '\0';
+            parts[pi++] = p + 1;
+        }
+        p++;
+    }
+    // parts[]: [acc_id, tx_id, type, amount, to_acc, timestamp, (category)]
+    if (pi < 6) return 0;
+    memset(t, 0, sizeof(*t));
+    *acc_id = atoi(parts[0]);
+    t->id = atoi(parts[1]);
+    snprintf(t->type, sizeof(t->type), "%.15s", parts[2]);
+    t->amount = atof(parts[3]);
+    t->to_account = atoi(parts[4]);
+    snprintf(t->timestamp, sizeof(t->timestamp), "%.63s", parts[5]);
+    t->category = pi >= 7 ? atoi(parts[6]) : CAT_NONE;
+    return 1;
+}
+
+/* walks the part of an account's history that is not in memory, newest
+   first: TX lines left in the data file, then blocks in the history file */
+#define LAZY_CHUNK (1 << 16)
+
+typedef struct ColdCursor {
+    long raw_left;      // TX lines still to read from the data file
+    uint64_t raw_off, raw_end;
+    char *raw;
+    size_t raw_len, raw_pos;
+    uint32_t crc;       // of the ACC line and the TX bytes read so far
+    uint64_t next;      // block to read once this one is used up
+    int acc_id;         // whose blocks: one that is not (a reused offset) ends the walk
+    ColdTx *recs;
+    int count, pos, cap;
+} ColdCursor;
+
+/* 1 if a was lazily loaded and not paged in yet: then its in-memory list
+   holds only what was added since the load (see hot_tx_counts) */
+int cold_open(ColdCursor *c, const Account *a) {
+    memset(c, 0, sizeof(*c));
+    c->raw_left = __atomic_load_n(&a->lazy_count, __ATOMIC_ACQUIRE);
+    c->raw_off = a->lazy_off;
+    c->raw_end = a->lazy_off + a->lazy_bytes;
+    c->crc = a->lazy_crc;
+    c->next = a->cold_head;
+    c->acc_id = a->id;
+    return c->raw_left > 0;
+}
+
+/* whether t, on a's in-memory list, belongs in a walk of the whole history
+   whose cold_open returned `lazy`. A page-in running meanwhile links the
+   file's lines onto the list before it clears lazy_count, so the list
+   can hold copies of what the cursor reads; only transactions added
+   since the load (ids from lazy_tx_floor up) are not on disk. */
+int hot_tx_counts(int lazy, const Transaction *t) {
+    return !lazy || t->id >= lazy_tx_floor;
+}
+
+/* the next TX line of a lazily loaded account; 0 on a read error */
+int cold_next_raw(ColdCursor *c, Transaction *t) {
+    for (;;) {
+        char *line = c->raw + c->raw_pos;
+        char *nl = c->raw ? memchr(line, '\n', c->raw_len - c->raw_pos) : NULL;
+        if (nl) {
+            *nl = '\0';
+            c->raw_pos = nl - c->raw + 1;
+            int acc_id;
+            return strncmp(line, "TX|", 3) == 0 && parse_tx_line(line + 3, &acc_id, t);
+        }
+        size_t keep = c->raw_len - c->raw_pos;
+        if (!c->raw && !(c->raw = malloc(LAZY_CHUNK))) return 0;
+        memmove(c->raw, c->raw + c->raw_pos, keep);
+        c->raw_len = keep;
+        c->raw_pos = 0;
+        size_t want = LAZY_CHUNK - keep;
+        if (want > c->raw_end - c->raw_off) want = c->raw_end - c->raw_off;
+        if (!want || lazy_fd < 0) return 0;
+        ssize_t n = pread(lazy_fd, c->raw + keep, want, c->raw_off);
+        if (n <= 0) return 0;
+        c->crc = crc32_update(c->crc, c->raw + keep, n);
+        c->raw_off += n;
+        c->raw_len += n;
+    }
+}
+
+/* the next older transaction into *t; 0 at the end or on a read error */
+int cold_next(ColdCursor *c, Transaction *t) {
+    if (c->raw_left > 0) {
+        if (cold_next_raw(c, t)) {
+            c->raw_left--;
+            return 1;
+        }
+        c->raw_left = 0;
+    }
+    while (c->pos == c->count) {
+        ColdBlock b;
+        if (!c->next || tier_fd < 0 || pread(tier_fd, &b, sizeof(b), c->next) != sizeof(b) || b.count < 0 ||
+            b.acc_id != c->acc_id)
+            return 0;
+        if (b.count > c->cap) {
+            ColdTx *nr = realloc(c->recs, b.count * sizeof(ColdTx));
+            if (!nr) return 0;
+            c->recs = nr;
+            c->cap = b.count;
+        }
+        size_t bytes = (size_t)b.count * sizeof(ColdTx);
+        if (pread(tier_fd, c->recs, bytes, c->next + sizeof(b)) != (ssize_t)bytes) return 0;
+        __atomic_add_fetch(&tier_blocks_read, 1, __ATOMIC_RELAXED);
+        c->count = b.count;
+        c->pos = 0;
+        c->next = b.prev;
+    }
+    tx_from_cold(t, &c->recs[c->pos++]);
+    return 1;
+}
+
+void cold_close(ColdCursor *c) {
+    free(c->recs);
+    free(c->raw);
+    c->recs = NULL;
+    c->raw = NULL;
+}
+
+/* load_data's queue of cold TX lines. They arrive newest first, so each
+   full block is chained after the account's previous one (its prev is
+   patched in place) and the chain keeps the file's order. */
+#define COLD_BLOCK_MAX 4096
+
+typedef struct ColdLoader {
+    Account *acc;
+    uint64_t tail;      // acc's oldest block written so far this run
+    int n;
+    ColdTx recs[COLD_BLOCK_MAX];
+} ColdLoader;
+
+/* writes the queue out; 0 on a write error (the queue is kept) */
+int cold_loader_flush(ColdLoader *l) {
+    if (!l->n) return 1;
+    Account *a = l->acc;
+    uint64_t off = tier_write_block(a->id, l->tail ? 0 : a->cold_head, l->recs, l->n);
+    if (!off) return 0;
+    if (!l->tail) a->cold_head = off;
+    else if (pwrite(tier_fd, &off, sizeof(off), l->tail + offsetof(ColdBlock, prev)) != sizeof(off)) return 0;
+    l->tail = off;
+    a->cold_count += l->n;
+    l->n = 0;
+    return 1;
+}
+
+/* queues t for a; 0 if a full queue could not be written out */
+int cold_loader_add(ColdLoader *l, Account *a, const Transaction *t) {
+    if (a != l->acc || l->n == COLD_BLOCK_MAX) {
+        if (!cold_loader_flush(l)) return 0;
+        if (a != l->acc) l->tail = 0;
+        l->acc = a;
+    }
+    cold_from_tx(&l->recs[l->n++], t);
+    return 1;
+}
+
+/* brings a lazily loaded account's transactions into memory, the first
+   time it is shown or changed; the stats already count them. 0 on a read
+   error (the account stays as it was). */
+int account_page_in(Account *a) {
+    if (!__atomic_load_n(&a->lazy_count, __ATOMIC_ACQUIRE)) return 1;
+    COMMIT_SCOPE();
+    TRACE_SPAN("account_page_in");
+    ColdCursor c;
+    cold_open(&c, a);
+    Transaction *first = NULL, **link = &first, t;
+    long n = 0;
+    while (c.raw_left && cold_next(&c, &t)) {
+        Transaction *nt = pool_alloc(&tx_pool);
+        if (!nt) break;
+        *nt = t;
+        *link = nt;
+        link = &nt->next;
+        n++;
+    }
+    cold_close(&c);
+    int damaged = a->lazy_verify && c.crc != a->lazy_want;
+    if (damaged) printf("Account %d: its transactions in the data file fail their checksum.\n", a->id);
+    if (n != a->lazy_count || damaged) {
+        while (first) {
+            Transaction *nt = first->next;
+            pool_free(&tx_pool, first);
+            first = nt;
+        }
+        return 0;
+    }
+    // the list holds what was added since the load: newer, so the
+    // file's lines go after it
+    Transaction **tail = &a->tx_head;
+    while (*tail) tail = &(*tail)->next;
+    PUBLISH(*tail, first);
+    __atomic_store_n(&a->lazy_count, 0, __ATOMIC_RELEASE); // readers use the list from here on
+    lazy_pages++;
+    shm_mirror_account(a);
+    return 1;
+}
+
+/* ------------------------------
+   Transaction helpers
+   ------------------------------*/
+Transaction* create_transaction(const char *type, double amount, int to_account) {
+    Transaction *t = pool_alloc(&tx_pool);
+    t->id = next_tx_id++;
+    strncpy(t->type, type, sizeof(t->type)-1);
+    t->amount = amount;
+    t->to_account = to_account;
+    t->category = CAT_NONE;
+    current_time_str(t->timestamp, sizeof(t->timestamp));
+    t->next = NULL;
+    return t;
+}
+
+/* +1 inflow, -1 outflow, 0 internal; *undo set for the UNDO_ mirror */
+int tx_flow(const char *type, int *undo) {
+    *undo = strncmp(type, "UNDO_", 5) == 0;
+    if (*undo) type += 5;
+    if (strcmp(type, "DEPOSIT") == 0 || strcmp(type, "INTEREST") == 0 || strcmp(type, "GOAL_RETURN") == 0) return 1;
+    if (strcmp(type, "WITHDRAW") == 0 || strcmp(type, "GOAL_SAVE") == 0) return -1;
+    return 0;
+}
+
+/* account for a transaction entering (sign +1) or leaving (-1) the ledger */
+void stats_roll_day() {
+    char today[64];
+    current_time_str(today, sizeof(today));
+    if (strncmp(today, ledger_stats.day, 10) > 0) { // new day: flows start over (never go back a day)
+        memcpy(ledger_stats.day, today, 10);
+        ledger_stats.day[10] = '\0';
+        ledger_stats.inflow_today = ledger_stats.outflow_today = 0;
+    }
+}
+
+void stats_tx(const Transaction *tx, int sign) {
+    stats_roll_day();
+    ledger_stats.transactions += sign;
+    if (strncmp(tx->timestamp, ledger_stats.day, 10) != 0) return;
+    int undo, flow = tx_flow(tx->type, &undo);
+    double amt = undo ? -tx->amount : tx->amount;
+    if (flow > 0) ledger_stats.inflow_today += sign * amt;
+    else if (flow < 0) ledger_stats.outflow_today += sign * amt;
+}
+
+/* a lazily loaded account's transactions, from the summary saved with
+   it; its flows were summed for `day` and count only if that is today */
+void stats_summary(long txs, const char *day, double inflow, double outflow) {
+    stats_roll_day();
+    ledger_stats.transactions += txs;
+    if (strncmp(day, ledger_stats.day, 10) != 0) return;
+    ledger_stats.inflow_today += inflow;
+    ledger_stats.outflow_today += outflow;
+}
+
+void add_transaction(Account *acc, Transaction *tx) {
+    // insert at head for newest-first order (a lazily loaded account's
+    // older lines stay in the data file: they come after the list)
+    tx->next = acc->tx_head;
+    PUBLISH(acc->tx_head, tx);
+    stats_tx(tx, 1);
+    shm_tx_added(acc, tx);
+}
+
+/* name (as the web app spells it) -> CAT_*, CAT_MISC if unknown */
+int category_from_name(const char *name) {
+    for (int c = 1; c < NUM_CATEGORIES; c++)
+        if (strcmp(name, category_names[c]) == 0) return c;
+    return CAT_MISC;
+}
+
+/* O(1) update of the per-account and global spending tables for a
+   transaction entering the ledger (WITHDRAW adds, UNDO_WITHDRAW subtracts) */
+void category_apply(Account *acc, const Transaction *tx) {
+    if (tx->category <= CAT_NONE || tx->category >= NUM_CATEGORIES) return;
+    double amt = tx->amount;
+    if (strcmp(tx->type, "UNDO_WITHDRAW") == 0) amt = -amt;
+    else if (strcmp(tx->type, "WITHDRAW") != 0) return;
+    acc->cat_spent[tx->category] += amt;
+    cat_spent_total[tx->category] += amt;
+}
+
+/* full rescan of every transaction, the way the web app's pie chart does it;
+   kept to cross-check the running totals */
+void category_scan_tx(double out[NUM_CATEGORIES], const Transaction *t) {
+    if (t->category <= CAT_NONE || t->category >= NUM_CATEGORIES) return;
+    if (strcmp(t->type, "WITHDRAW") == 0) out[t->category] += t->amount;
+    else if (strcmp(t->type, "UNDO_WITHDRAW") == 0) out[t->category] -= t->amount;
+}
+
+void category_totals_scan(double out[NUM_CATEGORIES]) {
+    for (int c = 0; c < NUM_CATEGORIES; c++) out[c] = 0;
+    for (Account *a = accounts_head; a; a = a->next) {
+        ColdCursor c;
+        Transaction t;
+        int lazy = cold_open(&c, a);
+        for (Transaction *h = a->tx_head; h; h = h->next)
+            if (hot_tx_counts(lazy, h)) category_scan_tx(out, h);
+        while (cold_next(&c, &t)) category_scan_tx(out, &t);
+        cold_close(&c);
+    }
+}
+
+/* ------------------------------
+   Operation log (replication)
+   While replication is on, every top-level commit that changes the ledger
+   appends one text record to an in-memory log, in commit order (the
+   append happens under commit_lock):
+     commit|mono_ns|unix_time|OP|args...
+   OP is one letter per public mutation (A create account, V create a
+   savings account, D deposit, W withdraw, T transfer, U undo, G/C/X
+   goals, S/K standing orders, I interest, M scheduler advance, L velocity
+   limit, J ids used by a failed import, R bulk reload). Nested commits (the
+   deposits a standing order fires, the accounts load_data creates) are
+   not logged: replaying the outer operation reproduces them. A keyed
+   mutation (see Idempotency keys) logs its own record behind the key,
+     commit|mono_ns|unix_time|Y|hash:check|OP|args...
+   or N|hash:check|result when it changed nothing, so followers remember the key
+   with the mutation. Records are dropped once every connected follower
+   has been sent them.
+   ------------------------------*/
+#define OPLOG_TRIM (1 << 20) // compact once this many bytes are held
+
+/* an idempotency key (see Idempotency keys) */
+typedef struct IdemKey {
+    uint64_t hash;    // never 0 for a real key (0 = no key / empty slot)
+    uint64_t check;   // second hash, compared on a hit; 0 = not known
+} IdemKey;
+
+int oplog_enabled = 0;
+char *oplog_buf = NULL;
+size_t oplog_len = 0, oplog_cap = 0;
+uint64_t oplog_base = 0;         // log offset of oplog_buf[0]
+uint64_t oplog_last_commit = 0;  // commit of the newest record
+int oplog_gaps = 0;              // records dropped for lack of memory
+IdemKey oplog_key;               // key of the keyed mutation in this commit (hash 0 = none)
+int oplog_key_logged = 0;        // its record has been written
+pthread_mutex_t oplog_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t oplog_grew = PTHREAD_COND_INITIALIZER;
+
+uint64_t oplog_min_pos();        // slowest follower, in the Replication section
+
+int64_t monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* caller holds oplog_lock */
+void oplog_trim() {
+    uint64_t keep = oplog_min_pos();
+    if (keep < oplog_base) keep = oplog_base;
+    size_t drop = (size_t)(keep - oplog_base);
+    if (drop > oplog_len) drop = oplog_len;
+    memmove(oplog_buf, oplog_buf + drop, oplog_len - drop);
+    oplog_len -= drop;
+    oplog_base += drop;
+}
+
+/* one record for the current commit; ignored unless replication is on
+   and this is the outermost commit (or the mutation a keyed commit wraps) */
+void oplog_append(const char *fmt, ...) {
+    if (!oplog_enabled || commit_depth != (oplog_key.hash ? 2 : 1)) return;
+    char rec[512];
+    uint64_t commit = commit_clock + 1;
+    int n = snprintf(rec, sizeof(rec), "%llu|%lld|%lld|", (unsigned long long)commit,
+                     (long long)monotonic_ns(), (long long)ledger_time());
+    if (oplog_key.hash) {
+        n += snprintf(rec + n, sizeof(rec) - n, "Y|%016llx:%016llx|", (unsigned long long)oplog_key.hash,
+                      (unsigned long long)oplog_key.check);
+        oplog_key_logged = 1;
+    }
+    va_list ap;
+    va_start(ap, fmt);
+    n += vsnprintf(rec + n, sizeof(rec) - n - 1, fmt, ap);
+    va_end(ap);
+    if (n > (int)sizeof(rec) - 2) n = sizeof(rec) - 2;
+    rec[n++] = '\n';
+    pthread_mutex_lock(&oplog_lock);
+    if (oplog_len > OPLOG_TRIM) oplog_trim();
+    if (oplog_len + n > oplog_cap) {
+        size_t ncap = oplog_cap ? oplog_cap * 2 : 65536;
+        while (ncap < oplog_len + n) ncap *= 2;
+        char *nb = mem_realloc(MEM_OPLOG, oplog_buf, oplog_cap, ncap);
+        if (!nb) { // record lost: every follower starts over from a snapshot
+            oplog_gaps++;
+            pthread_cond_broadcast(&oplog_grew);
+            pthread_mutex_unlock(&oplog_lock);
+            return;
+        }
+        oplog_buf = nb;
+        oplog_cap = ncap;
+    }
+    memcpy(oplog_buf + oplog_len, rec, n);
+    oplog_len += n;
+    oplog_last_commit = commit;
+    pthread_cond_broadcast(&oplog_grew);
+    pthread_mutex_unlock(&oplog_lock);
+}
+
+/* ------------------------------
+   Savings goals
+   Goals live in an id-indexed table; the ones with a deadline that are not
+   yet reached sit in a binary min-heap on (target_date, id), so "next due"
+   is the root and "overdue" only visits heap nodes already past due.
+   ------------------------------*/
+int today_yyyymmdd() {
+    time_t t = ledger_time();
+    struct tm *tm = localtime(&t);
+    return (tm->tm_year + 1900) * 10000 + (tm->tm_mon + 1) * 100 + tm->tm_mday;
+}
+
+/* "YYYY-MM-DD" -> yyyymmdd, 0 if empty/invalid */
+int parse_goal_date(const char *s) {
+    int y, m, d;
+    if (sscanf(s, "%d-%d-%d", &y, &m, &d) != 3 || m < 1 || m > 12 || d < 1 || d > 31) return 0;
+    return y * 10000 + m * 100 + d;
+}
+
+Goal *find_goal(int id) {
+    if (id <= 0 || id >= goal_table_cap) return NULL;
+    return goal_table[id];
+}
+
+int goal_before(const Goal *a, const Goal *b) {
+    if (a->target_date != b->target_date) return a->target_date < b->target_date;
+    return a->id < b->id;
+}
+
+void goal_heap_set(int pos, Goal *g) {
+    goal_heap[pos] = g;
+    g->heap_pos = pos;
+}
+
+void goal_heap_up(int pos) {
+    Goal *g = goal_heap[pos];
+    while (pos > 0) {
+        int parent = (pos - 1) / 2;
+        if (!goal_before(g, goal_heap[parent])) break;
+        goal_heap_set(pos, goal_heap[parent]);
+        pos = parent;
+    }
+    goal_heap_set(pos, g);
+}
+
+void goal_heap_down(int pos) {
+    Goal *g = goal_heap[pos];
+    for (;;) {
+        int child = 2 * pos + 1;
+        if (child >= goal_heap_len) break;
+        if (child + 1 < goal_heap_len && goal_before(goal_heap[child + 1], goal_heap[child])) child++;
+        if (!goal_before(goal_heap[child], g)) break;
+        goal_heap_set(pos, goal_heap[child]);
+        pos = child;
+    }
+    goal_heap_set(pos, g);
+}
+
+void goal_heap_push(Goal *g) {
+    if (goal_heap_len == goal_heap_cap) {
+        int ncap = goal_heap_cap ? goal_heap_cap * 2 : 64;
+        Goal **nh = mem_realloc(MEM_GOALS, goal_heap, goal_heap_cap * sizeof(Goal *), ncap * sizeof(Goal *));
+        if (!nh) { g->heap_pos = -1; return; }
+        goal_heap = nh;
+        goal_heap_cap = ncap;
+    }
+    goal_heap_set(goal_heap_len++, g);
+    goal_heap_up(g->heap_pos);
+}
+
+void goal_heap_remove(Goal *g) {
+    int pos = g->heap_pos;
+    if (pos < 0) return;
+    g->heap_pos = -1;
+    Goal *last = goal_heap[--goal_heap_len];
+    if (last == g) return;
+    goal_heap_set(pos, last);
+    goal_heap_up(pos);
+    goal_heap_down(last->heap_pos);
+}
+
+/* keep heap membership and the completed count in step with g->saved;
+   was_done is whether the goal counted as completed before the change */
+void goal_progress_changed(Goal *g, int was_done) {
+    int done = g->saved >= g->target;
+    goals_completed += done - was_done;
+    if (done && g->heap_pos >= 0) goal_heap_remove(g);
+    else if (!done && g->heap_pos < 0 && g->target_date) goal_heap_push(g);
+}
+
+/* adds g to the table/totals/heap; g->id must already be set */
+int goal_register(Goal *g) {
+    if (g->id >= goal_table_cap) {
+        int ncap = goal_table_cap ? goal_table_cap : 64;
+        while (ncap <= g->id) ncap *= 2;
+        Goal **nt = mem_realloc(MEM_GOALS, goal_table, goal_table_cap * sizeof(Goal *), ncap * sizeof(Goal *));
+        if (!nt) return 0;
+        memset(nt + goal_table_cap, 0, (ncap - goal_table_cap) * sizeof(Goal *));
+        goal_table = nt;
+        goal_table_cap = ncap;
+    }
+    goal_table[g->id] = g;
+    if (g->id >= next_goal_id) next_goal_id = g->id + 1;
+    goal_count++;
+    goals_saved_total += g->saved;
+    goals_target_total += g->target;
+    g->heap_pos = -1;
+    goal_progress_changed(g, 0);
+    return 1;
+}
+
+void goal_unregister(Goal *g) {
+    goal_heap_remove(g);
+    goal_table[g->id] = NULL;
+    goal_count--;
+    goals_saved_total -= g->saved;
+    goals_target_total -= g->target;
+    if (g->saved >= g->target) goals_completed--;
+    pool_free(&goal_pool, g);
+}
+
+Goal *goal_new(int id, const char *name, double target, double saved, int target_date) {
+    Goal *g = pool_alloc(&goal_pool);
+    if (!g) return NULL;
+    memset(g, 0, sizeof(*g));
+    g->id = id;
+    strncpy(g->name, name, sizeof(g->name)-1);
+    g->target = target;
+    g->saved = saved;
+    g->target_date = target_date;
+    if (!goal_register(g)) {
+        pool_free(&goal_pool, g);
+        return NULL;
+    }
+    return g;
+}
+
+Goal *create_goal(const char *name, double target, int target_date) {
+    COMMIT_SCOPE();
+    Goal *g = goal_new(next_goal_id, name, target, 0, target_date);
+    if (g) {
+        push_undo("CREATE_GOAL", 0, g->id, target);
+        oplog_append("G|%.17g|%d|%s", target, target_date, g->name);
+    }
+    return g;
+}
+
+/* moves money from an account into a goal; the account gets a GOAL_SAVE
+   transaction whose to_account is the goal id.
+   1 ok, 0 account/goal not found, -1 insufficient funds */
+int contribute_goal(int goal_id, int acc_id, double amount) {
+    COMMIT_SCOPE();
+    Goal *g = find_goal(goal_id);
+    Account *acc = find_account(acc_id);
+    if (!g || !acc) return 0;
+    if (BALANCE(acc) < amount) return -1;
+    adjust_balance(acc, -amount);
+    Transaction *tx = create_transaction("GOAL_SAVE", amount, goal_id);
+    add_transaction(acc, tx);
+    int was_done = g->saved >= g->target;
+    g->saved += amount;
+    goals_saved_total += amount;
+    goal_progress_changed(g, was_done);
+    push_undo("GOAL_SAVE", acc_id, goal_id, amount);
+    oplog_append("C|%d|%d|%.17g", goal_id, acc_id, amount);
+    return 1;
+}
+
+/* removes a goal; what it has saved goes to acc_id as a GOAL_RETURN
+   transaction (to_account = the goal id). 1 ok, 0 goal not found, -1 the
+   goal holds money and acc_id is not an account */
+int delete_goal(int goal_id, int acc_id) {
+    COMMIT_SCOPE();
+    Goal *g = find_goal(goal_id);
+    if (!g) return 0;
+    if (g->saved > 0) {
+        Account *acc = find_account(acc_id);
+        if (!acc) return -1;
+        adjust_balance(acc, g->saved);
+        add_transaction(acc, create_transaction("GOAL_RETURN", g->saved, goal_id));
+    }
+    goal_unregister(g);
+    oplog_append("X|%d|%d", goal_id, acc_id);
+    return 1;
+}
+
+/* drops every goal (load_data starts from a clean slate) */
+void free_all_goals() {
+    pool_reset(&goal_pool);
+    mem_free(MEM_GOALS, goal_table, goal_table_cap * sizeof(Goal *));
+    mem_free(MEM_GOALS, goal_heap, goal_heap_cap * sizeof(Goal *));
+    goal_table = NULL;
+    goal_heap = NULL;
+    goal_table_cap = goal_heap_cap = goal_heap_len = 0;
+    goal_count = goals_completed = 0;
+    goals_saved_total = goals_target_total = 0;
+    next_goal_id = 1;
+}
+
+Goal *next_due_goal() {
+    return goal_heap_len ? goal_heap[0] : NULL;
+}
+
+/* visits every open goal whose deadline is before today; the heap order
+   lets it skip any subtree whose root is not overdue. Returns the count. */
+int for_each_overdue_goal(int today, void (*fn)(Goal *)) {
+    int stack[64], sp = 0, count = 0; // DFS depth is bounded by the heap height
+    if (goal_heap_len) stack[sp++] = 0;
+    while (sp) {
+        int pos = stack[--sp];
+        Goal *g = goal_heap[pos];
+        if (g->target_date >= today) continue;
+        if (fn) fn(g);
+        count++;
+        int child = 2 * pos + 1;
+        if (child < goal_heap_len) stack[sp++] = child;
+        if (child + 1 < goal_heap_len) stack[sp++] = child + 1;
+    }
+    return count;
+}
+
+/* ------------------------------
+   Velocity limits
+   Optional caps on how many withdrawals and outgoing transfers an account
+   makes, and how much they move, per minute, hour and day. An account
+   gets a fixed-size counter block the first time it spends while limits
+   are on: per window, the count and amount of the current and previous
+   fixed bucket. The sliding window is estimated as the current bucket
+   plus the share of the previous one that still overlaps it, so checking
+   and counting are O(1) and never walk the transactions. The check runs
+   before the balance check (withdraw/transfer_funds return -3). Standing
+   orders are counted but never refused, and a follower does not check at
+   all: the primary already decided, and sends its limits (L records) so
+   the follower's counters run the same. Undo takes a step back out of the
+   counters. Limits are saved as LIMIT lines and each account's counters
+   as VEL lines after them, so a reload or a restart carries on from the
+   same allowance.
+   ------------------------------*/
+enum { VEL_MINUTE, VEL_HOUR, VEL_DAY, VEL_WINDOWS };
+const char *velocity_window_names[VEL_WINDOWS] = { "minute", "hour", "day" };
+const int velocity_window_secs[VEL_WINDOWS] = { 60, 3600, 86400 };
+
+typedef struct VelocityLimit {
+    int max_count;      // 0 = no limit
+    double max_amount;  // 0 = no limit
+} VelocityLimit;
+
+typedef struct VelocityWindow {
+    uint32_t bucket;    // ledger time / window length
+    uint32_t count, prev_count;
+    double amount, prev_amount;
+} VelocityWindow;
+
+typedef struct Velocity {
+    VelocityWindow w[VEL_WINDOWS];
+} Velocity;
+
+VelocityLimit velocity_limits[VEL_WINDOWS];
+int velocity_on = 0;       // any limit set
+int velocity_checks = 1;   // 0 while standing orders run, and on a follower
+long long velocity_refused = 0;
+NodePool velocity_pool = POOL_INIT(Velocity, 1024, MEM_VELOCITY);
+
+/* moves w to the bucket holding t and returns the weight of the previous
+   bucket. An older t (a standing order catching up) counts as current. */
+double velocity_roll(VelocityWindow *w, uint32_t t, int len) {
+    uint32_t b = t / len;
+    if (b > w->bucket) {
+        int adjacent = b == w->bucket + 1;
+        w->prev_count = adjacent ? w->count : 0;
+        w->prev_amount = adjacent ? w->amount : 0;
+        w->count = 0;
+        w->amount = 0;
+        w->bucket = b;
+    }
+    return 1.0 - (double)(t % len) / len;
+}
+
+/* 0 if sending `amount` from acc now would break a limit */
+int velocity_allows(Account *acc, double amount) {
+    if (!velocity_on || !velocity_checks) return 1;
+    uint32_t t = (uint32_t)ledger_time();
+    for (int i = 0; i < VEL_WINDOWS; i++) {
+        const VelocityLimit *l = &velocity_limits[i];
+        if (!l->max_count && !l->max_amount) continue;
+        double count = 0, spent = 0;
+        if (acc->velocity) {
+            VelocityWindow *w = &acc->velocity->w[i];
+            double prev = velocity_roll(w, t, velocity_window_secs[i]);
+            count = w->count + prev * w->prev_count;
+            spent = w->amount + prev * w->prev_amount;
+        }
+        if ((l->max_count && count >= l->max_count) || (l->max_amount && spent + amount > l->max_amount + 1e-9)) {
+            velocity_refused++;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* acc's counter block, allocated empty on first use; NULL if out of memory */
+Velocity *velocity_block(Account *acc) {
+    if (!acc->velocity && (acc->velocity = pool_alloc(&velocity_pool)))
+        memset(acc->velocity, 0, sizeof(Velocity));
+    return acc->velocity;
+}
+
+/* counts a withdrawal or outgoing transfer that went through; the time
+   it was counted at, for velocity_unnote (0 if not counted) */
+uint32_t velocity_note(Account *acc, double amount) {
+    if (!velocity_on || !velocity_block(acc)) return 0;
+    uint32_t t = (uint32_t)ledger_time();
+    for (int i = 0; i < VEL_WINDOWS; i++) {
+        VelocityWindow *w = &acc->velocity->w[i];
+        velocity_roll(w, t, velocity_window_secs[i]);
+        w->count++;
+        w->amount += amount;
+    }
+    return t;
+}
+
+/* takes back what velocity_note counted at t (an undo), from whichever
+   bucket holds it now; nothing once it has aged out of both */
+void velocity_unnote(Account *acc, double amount, uint32_t t) {
+    if (!t || !acc->velocity) return;
+    for (int i = 0; i < VEL_WINDOWS; i++) {
+        VelocityWindow *w = &acc->velocity->w[i];
+        uint32_t b = t / velocity_window_secs[i];
+        if (b >= w->bucket && w->count) { // counted as current (an older t is too)
+            w->count--;
+            w->amount = w->amount > amount ? w->amount - amount : 0;
+        } else if (b + 1 == w->bucket && w->prev_count) {
+            w->prev_count--;
+            w->prev_amount = w->prev_amount > amount ? w->prev_amount - amount : 0;
+        }
+    }
+}
+
+void velocity_release(Account *acc) {
+    if (acc->velocity) pool_free(&velocity_pool, acc->velocity);
+    acc->velocity = NULL;
+}
+
+/* 0 = no limit for either; returns 0 for an unknown window or a negative cap */
+int velocity_set_limit(int window, int max_count, double max_amount) {
+    COMMIT_SCOPE(); // snapshots copy the limits
+    if (window < 0 || window >= VEL_WINDOWS || max_count < 0 || max_amount < 0) return 0;
+    velocity_limits[window].max_count = max_count;
+    velocity_limits[window].max_amount = max_amount;
+    velocity_on = 0;
+    for (int i = 0; i < VEL_WINDOWS; i++)
+        if (velocity_limits[i].max_count || velocity_limits[i].max_amount) velocity_on = 1;
+    oplog_append("L|%d|%d|%.17g", window, max_count, max_amount);
+    return 1;
+}
+
+/* LIMIT lines, then a VEL line per account window still holding counts
+   (writer side, or under commit_lock) */
+void save_limits(FILE *f) {
+    for (int i = 0; i < VEL_WINDOWS; i++)
+        if (velocity_limits[i].max_count || velocity_limits[i].max_amount)
+            fprintf(f, "LIMIT|%d|%d|%.2f\n", velocity_window_secs[i], velocity_limits[i].max_count,
+                    velocity_limits[i].max_amount);
+    if (!velocity_pool.live) return; // no account has spent under a limit
+    uint32_t t = (uint32_t)ledger_time();
+    for (Account *a = accounts_head; a; a = a->next) {
+        for (int i = 0; a->velocity && i < VEL_WINDOWS; i++) {
+            const VelocityWindow *w = &a->velocity->w[i];
+            if ((w->count || w->prev_count) && w->bucket + 1 >= t / velocity_window_secs[i]) // not aged out
+                fprintf(f, "VEL|%d|%d|%u|%u|%.2f|%u|%.2f\n", a->id, velocity_window_secs[i], w->bucket,
+                        w->count, w->amount, w->prev_count, w->prev_amount);
+        }
+    }
+}
+
+/* a VEL line's window back into its account's counters */
+void velocity_restore(int acc_id, int secs, const VelocityWindow *saved) {
+    Account *acc = find_account(acc_id);
+    for (int i = 0; acc && i < VEL_WINDOWS; i++)
+        if (velocity_window_secs[i] == secs && velocity_block(acc)) acc->velocity->w[i] = *saved;
+}
+
+void velocity_reset() {
+    pool_reset(&velocity_pool);
+    memset(velocity_limits, 0, sizeof(velocity_limits));
+    velocity_on = 0;
+}
+
+/* ------------------------------
+   Core operations
+   ------------------------------*/
+/* a savings account earns the daily interest accrue_interest credits */
+Account* open_account(const char *name, double opening_balance, int savings) {
+    METRIC_SCOPE(M_CREATE_ACCOUNT);
+    COMMIT_SCOPE();
+    Account *acc = account_new(next_account_id);
+    if (!acc) return NULL;
+    next_account_id++;
+    strncpy(acc->name, name, sizeof(acc->name)-1);
+    acc->savings = savings;
+    adjust_balance(acc, opening_balance);
+    acc->next = accounts_head;
+    PUBLISH(accounts_head, acc);
+
+    // record opening as a deposit transaction for trace
+    Transaction *tx = create_transaction("DEPOSIT", opening_balance, 0);
+    add_transaction(acc, tx);
+
+    push_undo("CREATE", acc->id, 0, opening_balance);
+    oplog_append(savings ? "V|%.17g|%s" : "A|%.17g|%s", opening_balance, acc->name);
+    return acc;
+}
+
+Account* create_account(const char *name, double opening_balance) {
+    return open_account(name, opening_balance, 0);
+}
+
+int deposit(int acc_id, double amount) {
+    METRIC_SCOPE(M_DEPOSIT);
+    COMMIT_SCOPE();
+    Account *acc = find_account(acc_id);
+    if (!acc) return 0;
+    adjust_balance(acc, amount);
+    Transaction *tx = create_transaction("DEPOSIT", amount, 0);
+    add_transaction(acc, tx);
+    push_undo("DEPOSIT", acc_id, 0, amount);
+    oplog_append("D|%d|%.17g", acc_id, amount);
+    return 1;
+}
+
+int withdraw(int acc_id, double amount, int category) {
+    METRIC_SCOPE(M_WITHDRAW);
+    COMMIT_SCOPE();
+    Account *acc = find_account(acc_id);
+    if (!acc) return 0;
+    if (!velocity_allows(acc, amount)) return -3; // over a velocity limit
+    if (BALANCE(acc) < amount) return -1; // insufficient funds
+    if (category <= CAT_NONE || category >= NUM_CATEGORIES) category = CAT_MISC;
+    adjust_balance(acc, -amount);
+    Transaction *tx = create_transaction("WITHDRAW", amount, 0);
+    tx->category = category;
+    add_transaction(acc, tx);
+    category_apply(acc, tx);
+    uint32_t counted = velocity_note(acc, amount);
+    OpNode *op = push_undo("WITHDRAW", acc_id, 0, amount);
+    op->category = category;
+    op->velocity_at = counted;
+    oplog_append("W|%d|%.17g|%d", acc_id, amount, category);
+    return 1;
+}
+
+int transfer_funds(int from_id, int to_id, double amount) {
+    METRIC_SCOPE(M_TRANSFER);
+    COMMIT_SCOPE();
+    if (from_id == to_id) return -2;
+    Account *from = find_account(from_id);
+    Account *to = find_account(to_id);
+    if (!from || !to) return 0;
+    if (!velocity_allows(from, amount)) return -3;
+    if (BALANCE(from) < amount) return -1;
+    adjust_balance(from, -amount);
+    adjust_balance(to, amount);
+    Transaction *tx_from = create_transaction("TRANSFER", amount, to_id);
+    Transaction *tx_to = create_transaction("TRANSFER", amount, from_id);
+    add_transaction(from, tx_from);
+    add_transaction(to, tx_to);
+    push_undo("TRANSFER", from_id, to_id, amount)->velocity_at = velocity_note(from, amount);
+    oplog_append("T|%d|%d|%.17g", from_id, to_id, amount);
+    return 1;
+}
+
+/* Undo last operation */
+void undo_last() {
+    METRIC_SCOPE(M_UNDO);
+    COMMIT_SCOPE();
+    OpNode *op = pop_undo();
+    if (!op) {
+        printf("Nothing to undo.\n");
+        return;
+    }
+    if (strcmp(op->op_type, "DEPOSIT") == 0) {
+        Account *acc = find_account(op->acc_id);
+        if (acc) {
+            if (BALANCE(acc) >= op->amount) {
+                adjust_balance(acc, -op->amount);
+                Transaction *tx = create_transaction("UNDO_DEPOSIT", op->amount, 0);
+                add_transaction(acc, tx);
+                printf("Undid deposit of %.2f from account %d\n", op->amount, op->acc_id);
+            } else {
+                printf("Cannot undo deposit: insufficient balance in account %d\n", op->acc_id);
+            }
+        }
+    } else if (strcmp(op->op_type, "WITHDRAW") == 0) {
+        Account *acc = find_account(op->acc_id);
+        if (acc) {
+            adjust_balance(acc, op->amount);
+            Transaction *tx = create_transaction("UNDO_WITHDRAW", op->amount, 0);
+            tx->category = op->category;
+            add_transaction(acc, tx);
+            category_apply(acc, tx);
+            velocity_unnote(acc, op->amount, op->velocity_at);
+            printf("Undid withdraw of %.2f to account %d\n", op->amount, op->acc_id);
+        }
+    } else if (strcmp(op->op_type, "TRANSFER") == 0) {
+        Account *from = find_account(op->acc_id);
+        Account *to = find_account(op->acc_id_to);
+        if (from && to && BALANCE(to) >= op->amount) {
+            adjust_balance(from, op->amount);
+            adjust_balance(to, -op->amount);
+            Transaction *txFrom = create_transaction("UNDO_TRANSFER", op->amount, op->acc_id_to);
+            Transaction *txTo = create_transaction("UNDO_TRANSFER", op->amount, op->acc_id);
+            add_transaction(from, txFrom);
+            add_transaction(to, txTo);
+            velocity_unnote(from, op->amount, op->velocity_at);
+            printf("Undid transfer of %.2f from %d to %d\n", op->amount, op->acc_id, op->acc_id_to);
+        } else {
+            printf("Cannot undo transfer automatically (balances mismatch or accounts missing).\n");
+        }
+    } else if (strcmp(op->op_type, "CREATE") == 0 && __atomic_load_n(&snapshot_count, __ATOMIC_ACQUIRE)) {
+        // an open snapshot may still list this account; keep the step for later
+        op->next = undo_stack;
+        undo_stack = op;
+        printf("Cannot undo account creation while a snapshot (background save/report) is open; try again.\n");
+        return;
+    } else if (strcmp(op->op_type, "CREATE") == 0) {
+        // delete account created (simple removal from linked list) if present and zero or only opening balance
+        Account *prev = NULL, *cur = accounts_head;
+        while (cur) {
+            if (cur->id == op->acc_id) break;
+            prev = cur;
+            cur = cur->next;
+        }
+        if (cur) {
+            // Only remove if balance equals opening amount and there are no other txs? We'll remove anyway but warn.
+            if (prev) PUBLISH(prev->next, cur->next);
+            else PUBLISH(accounts_head, cur->next);
+            for (int c = 0; c < NUM_CATEGORIES; c++) cat_spent_total[c] -= cur->cat_spent[c];
+            // free txs
+            Transaction *t = cur->tx_head;
+            while (t) {
+                Transaction *tmp = t;
+                t = t->next;
+                stats_tx(tmp, -1);
+                epoch_retire_node(&tx_pool, tmp);
+            }
+            ledger_stats.transactions -= cur->cold_count + cur->lazy_count; // those on disk are just never read again
+            account_delete(cur);
+            printf("Undid creation of account %d\n", op->acc_id);
+        } else {
+            printf("Account to undo creation not found.\n");
+        }
+    } else if (strcmp(op->op_type, "CREATE_GOAL") == 0) {
+        Goal *g = find_goal(op->acc_id_to);
+        if (g && g->saved > 0) {
+            // money from steps no longer on the stack: deleting the goal (option 17) says where it goes
+            op->next = undo_stack;
+            undo_stack = op;
+            printf("Cannot undo creation of goal %d while it holds %.2f; delete it instead.\n", g->id, g->saved);
+            return;
+        }
+        if (delete_goal(op->acc_id_to, 0) == 1) printf("Undid creation of goal %d\n", op->acc_id_to);
+        else printf("Goal to undo creation not found.\n");
+    } else if (strcmp(op->op_type, "GOAL_SAVE") == 0) {
+        Account *acc = find_account(op->acc_id);
+        Goal *g = find_goal(op->acc_id_to);
+        if (acc && g) {
+            adjust_balance(acc, op->amount);
+            Transaction *tx = create_transaction("UNDO_GOAL_SAVE", op->amount, op->acc_id_to);
+            add_transaction(acc, tx);
+            int was_done = g->saved >= g->target;
+            g->saved -= op->amount;
+            goals_saved_total -= op->amount;
+            goal_progress_changed(g, was_done);
+            printf("Undid contribution of %.2f to goal %d\n", op->amount, op->acc_id_to);
+        } else {
+            printf("Cannot undo goal contribution (account or goal missing).\n");
+        }
+    } else if (strcmp(op->op_type, "ACCRUE") == 0) {
+        char ts[64];
+        current_time_str(ts, sizeof(ts));
+        int reversed = 0;
+        for (int i = 0; i < op->group_len; i++) {
+            GroupEntry *e = &op->group[i];
+            Account *acc = e->slot < account_rows && slot_account[e->slot]->id == e->acc_id
+                ? slot_account[e->slot] : find_account(e->acc_id);
+            if (!acc || BALANCE(acc) < e->amount) continue;
+            adjust_balance(acc, -e->amount);
+            Transaction *t = create_transaction("UNDO_INTEREST", e->amount, 0);
+            add_transaction(acc, t);
+            reversed++;
+        }
+        printf("Undid interest accrual on %d of %d accounts\n", reversed, op->group_len);
+    } else {
+        printf("Unknown undo operation: %s\n", op->op_type);
+    }
+    // the follower checks its own top step matches before replaying
+    oplog_append("U|%d|%d|%.17g|%s", op->acc_id, op->acc_id_to, op->amount, op->op_type);
+    free_undo_node(op);
+}
+
+/* ------------------------------
+   Idempotency keys
+   A caller that may retry a mutation passes a key with it (deposit_keyed
+   and friends); a key seen within idem_window seconds gets the first
+   call's result back and the mutation is not applied again. A key is
+   kept as two independent 64-bit hashes: the table and filter index by
+   the first, and a hit must match the second as well, so two different
+   keys are only confused if both hashes collide. Keys live in IDEM_GENS
+   generations, each an open-addressed
+   table with a blocked Bloom filter in front (one 512-bit block per key,
+   about 16 bits per key), so a new key, the usual case, is normally
+   turned away without probing any table. Inserts go to the newest
+   generation; when it spans idem_window / (IDEM_GENS - 1) seconds or
+   holds its share of idem_capacity, the oldest generation is cleared and
+   becomes the newest. A key therefore stays at least the whole window
+   unless more than idem_capacity keys arrive within it (those dropped
+   early are counted); the stored time makes expiry exact. The lookup, the
+   mutation and the key's insert are one commit, so a save, a snapshot or
+   a follower never sees the mutation without its key. Keys are saved
+   with the ledger as KEY lines and replicated with the mutation.
+   ------------------------------*/
+#define IDEM_GENS 4
+#define IDEM_BLOOM_PROBES 6
+
+typedef struct IdemEntry {
+    uint64_t key;     // IdemKey.hash
+    uint64_t check;   // IdemKey.check
+    int32_t result;   // what the first call returned
+    uint32_t at;      // ledger time it was recorded
+} IdemEntry;
+
+typedef struct IdemGen {
+    IdemEntry *slots;
+    size_t cap;       // power of two, 0 until first used; at most half full
+    size_t count;
+    uint64_t *bloom;  // cap * 8 bits in blocks of 8 words
+    time_t opened;
+} IdemGen;
+
+IdemGen idem_gens[IDEM_GENS];
+int idem_newest = 0;
+long idem_window = 86400;        // seconds a key is remembered
+long idem_capacity = 1L << 22;   // keys held at most, over all generations
+long long idem_hits = 0, idem_filtered = 0, idem_probed = 0, idem_dropped_early = 0;
+long long idem_collisions = 0;   // first hashes that matched with the check differing
+
+uint64_t hash_bytes(const char *s, size_t len); // FNV-1a, in the Import section
+
+/* hash 0 for no key */
+IdemKey idem_hash(const char *key) {
+    IdemKey k = { 0, 0 };
+    if (!key || !*key) return k;
+    size_t len = strlen(key);
+    uint64_t h = hash_bytes(key, len);
+    h ^= h >> 33; // FNV leaves the high bits weak; the filter indexes with them
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    // the check: rotate-xor-multiply over 8-byte words, seeded apart from
+    // FNV, then a different finalizer
+    uint64_t c = 0x243f6a8885a308d3ULL ^ len;
+    for (size_t i = 0; i < len; i += 8) {
+        uint64_t w = 0;
+        memcpy(&w, key + i, len - i < 8 ? len - i : 8);
+        c = ((c << 5 | c >> 59) ^ w) * 0x9e3779b97f4a7c15ULL;
+    }
+    c ^= c >> 31;
+    c *= 0xbf58476d1ce4e5b9ULL;
+    c ^= c >> 29;
+    k.hash = h ? h : 1;
+    k.check = c ? c : 1;
+    return k;
+}
+
+uint64_t *idem_bloom_block(const IdemGen *g, uint64_t key) {
+    return g->bloom + ((key >> 40) & ((g->cap >> 6) - 1)) * 8;
+}
+
+void idem_bloom_add(IdemGen *g, uint64_t key) {
+    uint64_t *b = idem_bloom_block(g, key), bits = key * 0x9E3779B97F4A7C15ULL;
+    for (int i = 0; i < IDEM_BLOOM_PROBES; i++, bits >>= 9) b[bits & 7] |= 1ULL << ((bits >> 3) & 63);
+}
+
+int idem_bloom_test(const IdemGen *g, uint64_t key) {
+    const uint64_t *b = idem_bloom_block(g, key);
+    uint64_t bits = key * 0x9E3779B97F4A7C15ULL;
+    for (int i = 0; i < IDEM_BLOOM_PROBES; i++, bits >>= 9)
+        if (!(b[bits & 7] & (1ULL << ((bits >> 3) & 63)))) return 0;
+    return 1;
+}
+
+/* doubles g's table and rebuilds its filter from the keys; 0 on allocation failure */
+int idem_grow(IdemGen *g) {
+    size_t ncap = g->cap ? g->cap * 2 : 1024;
+    IdemEntry *ns = mem_calloc(MEM_IDEM, ncap, sizeof(IdemEntry));
+    uint64_t *nb = mem_calloc(MEM_IDEM, ncap / 8, sizeof(uint64_t));
+    if (!ns || !nb) {
+        mem_free(MEM_IDEM, ns, ncap * sizeof(IdemEntry));
+        mem_free(MEM_IDEM, nb, ncap / 8 * sizeof(uint64_t));
+        return 0;
+    }
+    IdemGen ng = { ns, ncap, g->count, nb, g->opened };
+    for (size_t i = 0; i < g->cap; i++) {
+        if (!g->slots[i].key) continue;
+        size_t j = g->slots[i].key & (ncap - 1);
+        while (ns[j].key) j = (j + 1) & (ncap - 1);
+        ns[j] = g->slots[i];
+        idem_bloom_add(&ng, ns[j].key);
+    }
+    mem_free(MEM_IDEM, g->slots, g->cap * sizeof(IdemEntry));
+    mem_free(MEM_IDEM, g->bloom, g->cap / 8 * sizeof(uint64_t));
+    *g = ng;
+    return 1;
+}
+
+/* 1 with the first result when key was recorded within the window. An
+   entry whose check is not known (a KEY line from before checks were
+   saved) matches on the hash alone. */
+int idem_find(IdemKey k, int *result) {
+    uint64_t key = k.hash;
+    if (!key) return 0;
+    time_t now = ledger_time();
+    int probed = 0;
+    for (int i = 0; i < IDEM_GENS; i++) {
+        const IdemGen *g = &idem_gens[(idem_newest + IDEM_GENS - i) % IDEM_GENS];
+        if (!g->count || !idem_bloom_test(g, key)) continue;
+        probed = 1;
+        for (size_t j = key & (g->cap - 1); g->slots[j].key; j = (j + 1) & (g->cap - 1)) {
+            if (g->slots[j].key != key) continue;
+            if (g->slots[j].check && g->slots[j].check != k.check) { idem_collisions++; continue; } // another key
+            if (now - (time_t)g->slots[j].at >= idem_window) { idem_probed++; return 0; } // older copies are older still
+            *result = g->slots[j].result;
+            idem_hits++;
+            return 1;
+        }
+    }
+    if (probed) idem_probed++; // a filter false positive
+    else idem_filtered++;
+    return 0;
+}
+
+/* remembers key -> result (recorded at `at`) in the newest generation,
+   moving on to a fresh one first if it is full or old enough */
+void idem_insert(IdemKey k, int result, time_t at) {
+    uint64_t key = k.hash;
+    time_t now = ledger_time();
+    IdemGen *g = &idem_gens[idem_newest];
+    size_t gen_cap = idem_capacity / IDEM_GENS;
+    if (g->count && (g->count >= gen_cap || now - g->opened >= idem_window / (IDEM_GENS - 1))) {
+        idem_newest = (idem_newest + 1) % IDEM_GENS;
+        g = &idem_gens[idem_newest];
+        for (size_t i = 0; g->count && i < g->cap; i++)
+            if (g->slots[i].key && now - (time_t)g->slots[i].at < idem_window) idem_dropped_early++;
+        if (g->cap) {
+            memset(g->slots, 0, g->cap * sizeof(IdemEntry));
+            memset(g->bloom, 0, g->cap / 8 * sizeof(uint64_t));
+        }
+        g->count = 0;
+    }
+    if (!g->count) g->opened = now;
+    if ((g->count + 1) * 2 > g->cap && !idem_grow(g)) return; // not remembered: a retry would apply again
+    size_t j = key & (g->cap - 1);
+    while (g->slots[j].key) j = (j + 1) & (g->cap - 1);
+    g->slots[j] = (IdemEntry){ key, k.check, result, (uint32_t)at };
+    g->count++;
+    idem_bloom_add(g, key);
+}
+
+/* in the keyed mutation's commit: 1 with the first result if key was
+   seen, else marks key as this commit's for the oplog record */
+int idem_begin(IdemKey key, int *result) {
+    if (idem_find(key, result)) return 1;
+    oplog_key = key;
+    oplog_key_logged = 0;
+    return 0;
+}
+
+/* remembers the mutation's result under key (logging the key on its own
+   if the mutation wrote no record) and passes it through */
+int idem_finish(IdemKey key, int result) {
+    oplog_key.hash = 0;
+    if (!oplog_key_logged) oplog_append("N|%016llx:%016llx|%d", (unsigned long long)key.hash, (unsigned long long)key.check, result);
+    oplog_key_logged = 0;
+    idem_insert(key, result, ledger_time());
+    return result;
+}
+
+long idem_count() {
+    long n = 0;
+    for (int i = 0; i < IDEM_GENS; i++) n += idem_gens[i].count;
+    return n;
+}
+
+/* live keys (not yet expired) into out[], at most max; caller holds commit_lock */
+size_t idem_copy(IdemEntry *out, size_t max) {
+    time_t now = ledger_time();
+    size_t n = 0;
+    for (int i = 0; i < IDEM_GENS; i++) {
+        const IdemGen *g = &idem_gens[i];
+        for (size_t j = 0; g->count && j < g->cap && n < max; j++)
+            if (g->slots[j].key && now - (time_t)g->slots[j].at < idem_window) out[n++] = g->slots[j];
+    }
+    return n;
+}
+
+void idem_reset() {
+    for (int i = 0; i < IDEM_GENS; i++) {
+        IdemGen *g = &idem_gens[i];
+        mem_free(MEM_IDEM, g->slots, g->cap * sizeof(IdemEntry));
+        mem_free(MEM_IDEM, g->bloom, g->cap / 8 * sizeof(uint64_t));
+        memset(g, 0, sizeof(*g));
+    }
+    idem_newest = 0;
+}
+
+/* Keyed forms of the money-moving operations (menu 37). A NULL or empty
+   key is the plain call; a repeated key returns what the first call
+   returned. */
+int deposit_keyed(const char *key, int acc_id, double amount) {
+    IdemKey k = idem_hash(key);
+    if (!k.hash) return deposit(acc_id, amount);
+    COMMIT_SCOPE();
+    int r;
+    if (idem_begin(k, &r)) return r;
+    return idem_finish(k, deposit(acc_id, amount));
+}
+
+int withdraw_keyed(const char *key, int acc_id, double amount, int category) {
+    IdemKey k = idem_hash(key);
+    if (!k.hash) return withdraw(acc_id, amount, category);
+    COMMIT_SCOPE();
+    int r;
+    if (idem_begin(k, &r)) return r;
+    return idem_finish(k, withdraw(acc_id, amount, category));
+}
+
+int transfer_funds_keyed(const char *key, int from_id, int to_id, double amount) {
+    IdemKey k = idem_hash(key);
+    if (!k.hash) return transfer_funds(from_id, to_id, amount);
+    COMMIT_SCOPE();
+    int r;
+    if (idem_begin(k, &r)) return r;
+    return idem_finish(k, transfer_funds(from_id, to_id, amount));
+}
+
+/* ------------------------------
+   Interest accrual (batch)
+   One pass over the balance column computes and credits interest to the
+   savings accounts in parallel; the INTEREST transactions are then
+   appended with a single shared timestamp, and the whole run is one undo
+   step.
+   ------------------------------*/
+typedef struct AccrualJob {
+    double daily_rate;
+    double *interest; // per row, 0 for rows that earn nothing (not savings, or no balance)
+    int apply;        // write the column here; off while a snapshot is open
+} AccrualJob;
+
+void accrual_range(void *ctx, size_t begin, size_t end) {
+    uint64_t span = trace_begin();
+    AccrualJob *job = ctx;
+    for (size_t i = begin; i < end; i++) {
+        double b = balance_col[i];
+        double in = b > 0 && slot_account[i]->savings ? round(b * job->daily_rate * 100) / 100 : 0; // whole paise
+        job->interest[i] = in;
+        if (job->apply) balance_col[i] = b + in;
+    }
+    trace_end("accrue.kernel", span, (long long)(end - begin));
+}
+
+/* credits one day of interest at annual_rate_pct to every savings account
+   with a positive balance; returns the number of accounts credited, -1 on
+   error (out of memory: nothing changes) */
+int accrue_interest(double annual_rate_pct) {
+    TRACE_SPAN("accrue_interest");
+    COMMIT_SCOPE();
+    int rows = account_rows;
+    if (rows == 0 || annual_rate_pct <= 0) return 0;
+    // with a snapshot open, balances change one by one below so the old
+    // values land on the version chains
+    AccrualJob job = { annual_rate_pct / 36500, malloc(rows * sizeof(double)), !commit_newest_snap };
+    if (!job.interest) return -1;
+    run_parallel(0, rows, 4096, accrual_range, &job);
+
+    int credited = 0, k = 0;
+    for (int i = 0; i < rows; i++) credited += job.interest[i] > 0;
+    if (!credited) { // nothing moved, so nothing to undo
+        free(job.interest);
+        return 0;
+    }
+    // every node up front, chained through next, so running out of memory
+    // leaves no account half credited
+    GroupEntry *group = mem_alloc(MEM_UNDO, credited * sizeof(GroupEntry));
+    Transaction *spare = NULL;
+    for (int i = 0; group && i < credited; i++) {
+        Transaction *t = pool_alloc(&tx_pool);
+        if (!t) break;
+        t->next = spare;
+        spare = t;
+        k++;
+    }
+    if (k < credited) { // roll the column back rather than leave it without transactions
+        while (spare) {
+            Transaction *t = spare;
+            spare = t->next;
+            pool_free(&tx_pool, t);
+        }
+        mem_free(MEM_UNDO, group, credited * sizeof(GroupEntry));
+        for (int i = 0; job.apply && i < rows; i++) balance_col[i] -= job.interest[i];
+        free(job.interest);
+        return -1;
+    }
+    k = 0;
+    char ts[64];
+    current_time_str(ts, sizeof(ts));
+    uint64_t span = trace_begin();
+    for (int i = 0; i < rows; i++) {
+        if (job.interest[i] <= 0) continue;
+        Account *acc = slot_account[i];
+        Transaction *t = spare;
+        spare = t->next;
+        t->id = next_tx_id++;
+        strcpy(t->type, "INTEREST");
+        t->amount = job.interest[i];
+        t->to_account = 0;
+        t->category = CAT_NONE;
+        memcpy(t->timestamp, ts, sizeof(ts));
+        add_transaction(acc, t);
+        if (job.apply) { // the parallel pass wrote the column directly
+            ledger_stats.total_assets += t->amount;
+            acc->bal_ts = commit_clock + 1;
+            shm_balance(acc);
+        } else {
+            adjust_balance(acc, t->amount);
+        }
+        group[k].acc_id = acc->id;
+        group[k].slot = i;
+        group[k].amount = job.interest[i];
+        k++;
+    }
+    trace_end("accrue.transactions", span, credited);
+    free(job.interest);
+    OpNode *op = push_undo("ACCRUE", 0, 0, annual_rate_pct);
+    if (op == undo_stack) {
+        op->group = group;
+        op->group_len = credited;
+    } else { // no undo entry to hang it on
+        mem_free(MEM_UNDO, group, credited * sizeof(GroupEntry));
+    }
+    oplog_append("I|%.17g", annual_rate_pct);
+    return credited;
+}
+
+/* ------------------------------
+   Standing orders (scheduler)
+   Recurring deposits/withdrawals/transfers sit in a hierarchical timer
+   wheel: 4 levels x 64 slots of one-minute ticks (level L slot spans 64^L
+   minutes), with an occupancy bitmap per level. Advancing the clock fires a
+   slot's whole list at once through the normal core operations; missed
+   runs after downtime are caught up in one pass per order.
+   ------------------------------*/
+#define WHEEL_LEVELS 4
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+
+enum { SCHED_DEPOSIT = 1, SCHED_WITHDRAW, SCHED_TRANSFER };
+const char *sched_op_names[] = { "", "DEPOSIT", "WITHDRAW", "TRANSFER" };
+
+typedef struct Schedule {
+    int id;
+    int op;             // SCHED_*
+    int acc_id;
+    int acc_id_to;      // transfer destination
+    double amount;
+    int category;       // for withdrawals
+    int period;         // minutes between runs
+    int remaining;      // runs left, -1 = until cancelled
+    int cancelled;      // freed lazily when its slot comes up
+    int64_t next_due;   // minute (unix time / 60)
+    struct Schedule *next;
+} Schedule;
+
+typedef struct TimerWheel {
+    int64_t now;                        // last minute processed
+    uint64_t occupied[WHEEL_LEVELS];
+    Schedule *slots[WHEEL_LEVELS][WHEEL_SLOTS];
+    Schedule *overflow;                 // due beyond the top level's reach
+} TimerWheel;
+
+TimerWheel sched_wheel;
+NodePool sched_pool = POOL_INIT(Schedule, 1024, MEM_SCHEDULES);
+Schedule **sched_table = NULL; // indexed by schedule id, NULL once cancelled
+int sched_table_cap = 0;
+int next_sched_id = 1;
+long sched_runs = 0, sched_failures = 0;
+
+int64_t clock_minutes() {
+    return (int64_t)ledger_time() / 60;
+}
+
+void wheel_insert(TimerWheel *w, Schedule *s) {
+    int64_t delta = s->next_due - w->now;
+    if (delta < 0) delta = 0; // only cascades land here; the current slot is fired right after
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        if (delta < (int64_t)1 << (WHEEL_BITS * (level + 1))) {
+            int64_t due = w->now + delta;
+            int slot = (int)((due >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1));
+            s->next = w->slots[level][slot];
+            w->slots[level][slot] = s;
+            w->occupied[level] |= 1ULL << slot;
+            return;
+        }
+    }
+    s->next = w->overflow;
+    w->overflow = s;
+}
+
+Schedule *wheel_take(TimerWheel *w, int level, int slot) {
+    Schedule *list = w->slots[level][slot];
+    w->slots[level][slot] = NULL;
+    w->occupied[level] &= ~(1ULL << slot);
+    return list;
+}
+
+/* entering a new level-0 rotation: move the matching upper-level slots down
+   (highest level first so they trickle through) */
+void wheel_cascade(TimerWheel *w) {
+    int top = 0;
+    while (top + 1 < WHEEL_LEVELS && (w->now & (((int64_t)1 << (WHEEL_BITS * (top + 1))) - 1)) == 0) top++;
+    if (top == WHEEL_LEVELS - 1 && (w->now & (((int64_t)1 << (WHEEL_BITS * WHEEL_LEVELS)) - 1)) == 0) {
+        Schedule *s = w->overflow;
+        w->overflow = NULL;
+        while (s) { Schedule *n = s->next; wheel_insert(w, s); s = n; }
+    }
+    for (int level = top; level >= 1; level--) {
+        int slot = (int)((w->now >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1));
+        Schedule *s = wheel_take(w, level, slot);
+        while (s) { Schedule *n = s->next; wheel_insert(w, s); s = n; }
+    }
+}
+
+void sched_release(Schedule *s) {
+    if (!s->cancelled && s->id < sched_table_cap) sched_table[s->id] = NULL;
+    pool_free(&sched_pool, s);
+}
+
+/* runs every occurrence of s due up to the wheel's current minute, then
+   puts it back in the wheel or releases it */
+void sched_fire(TimerWheel *w, Schedule *s) {
+    if (s->cancelled) { sched_release(s); return; }
+    time_t saved_clock = ledger_clock;
+    int saved_checks = velocity_checks, saved_undo = undo_recording;
+    velocity_checks = 0; // already authorised: counted, never refused
+    undo_recording = 0;  // "undo" stays the user's own last action
+    while (s->next_due <= w->now && s->remaining != 0) {
+        ledger_clock = (time_t)(s->next_due * 60); // stamp with the due time
+        int r;
+        if (s->op == SCHED_DEPOSIT) r = deposit(s->acc_id, s->amount);
+        else if (s->op == SCHED_WITHDRAW) r = withdraw(s->acc_id, s->amount, s->category);
+        else r = transfer_funds(s->acc_id, s->acc_id_to, s->amount);
+        sched_runs++;
+        if (r != 1) sched_failures++;
+        if (s->remaining > 0) s->remaining--;
+        s->next_due += s->period;
+    }
+    ledger_clock = saved_clock;
+    velocity_checks = saved_checks;
+    undo_recording = saved_undo;
+    if (s->remaining == 0) sched_release(s);
+    else wheel_insert(w, s);
+}
+
+void wheel_fire_slot(TimerWheel *w, int slot) {
+    Schedule *s = wheel_take(w, 0, slot);
+    while (s) {
+        Schedule *n = s->next;
+        sched_fire(w, s);
+        s = n;
+    }
+}
+
+/* advance the wheel to minute `to`, firing everything due on the way.
+   Empty stretches are skipped a whole rotation (64 minutes) at a time. */
+void scheduler_advance(int64_t to) {
+    COMMIT_SCOPE(); // the runs it fires replicate as this one step
+    if (to > sched_wheel.now) oplog_append("M|%lld", (long long)to);
+    uint64_t span = trace_begin();
+    long before = sched_runs;
+    TimerWheel *w = &sched_wheel;
+    while (w->now < to) {
+        int idx = (int)(w->now & (WHEEL_SLOTS - 1));
+        uint64_t later = idx == WHEEL_SLOTS - 1 ? 0 : w->occupied[0] & (~0ULL << (idx + 1));
+        if (later) {
+            int64_t t = (w->now & ~(int64_t)(WHEEL_SLOTS - 1)) + __builtin_ctzll(later);
+            if (t > to) { w->now = to; break; }
+            w->now = t;
+            wheel_fire_slot(w, (int)(t & (WHEEL_SLOTS - 1)));
+            continue;
+        }
+        int64_t boundary = (w->now | (WHEEL_SLOTS - 1)) + 1;
+        if (boundary > to) { w->now = to; break; }
+        w->now = boundary;
+        wheel_cascade(w);
+        if (w->occupied[0] & 1) wheel_fire_slot(w, 0);
+    }
+    if (sched_runs != before) trace_end("scheduler.advance", span, sched_runs - before);
+}
+
+/* fire whatever is due by the ledger clock; returns runs performed */
+long scheduler_run_due() {
+    long before = sched_runs;
+    scheduler_advance(clock_minutes());
+    return sched_runs - before;
+}
+
+/* registers an order with a caller-chosen id (load_data) or the next id.
+   Returns the id, 0 if invalid. An order already due runs right away and
+   may be finished before this returns. */
+int sched_add(int id, int op, int acc_id, int acc_id_to, double amount, int category,
+                    int64_t first_due, int period, int remaining) {
+    COMMIT_SCOPE();
+    if (op < SCHED_DEPOSIT || op > SCHED_TRANSFER || period <= 0 || remaining == 0 || id <= 0) return 0;
+    if (id >= sched_table_cap) {
+        int ncap = sched_table_cap ? sched_table_cap : 64;
+        while (ncap <= id) ncap *= 2;
+        Schedule **nt = mem_realloc(MEM_SCHEDULES, sched_table, sched_table_cap * sizeof(Schedule *),
+                                    ncap * sizeof(Schedule *));
+        if (!nt) return 0;
+        memset(nt + sched_table_cap, 0, (ncap - sched_table_cap) * sizeof(Schedule *));
+        sched_table = nt;
+        sched_table_cap = ncap;
+    }
+    Schedule *s = pool_alloc(&sched_pool);
+    if (!s) return 0;
+    s->id = id;
+    s->op = op;
+    s->acc_id = acc_id;
+    s->acc_id_to = acc_id_to;
+    s->amount = amount;
+    s->category = category;
+    s->period = period;
+    s->remaining = remaining;
+    s->cancelled = 0;
+    s->next_due = first_due;
+    sched_table[id] = s;
+    if (id >= next_sched_id) next_sched_id = id + 1;
+    oplog_append("S|%d|%d|%d|%d|%.17g|%d|%lld|%d|%d", id, op, acc_id, acc_id_to, amount, category,
+                 (long long)first_due, period, remaining);
+    if (first_due <= sched_wheel.now) sched_fire(&sched_wheel, s); // already due: catch up now
+    else wheel_insert(&sched_wheel, s);
+    return id;
+}
+
+int schedule_order(int op, int acc_id, int acc_id_to, double amount, int category,
+                         int64_t first_due, int period, int remaining) {
+    return sched_add(next_sched_id, op, acc_id, acc_id_to, amount, category, first_due, period, remaining);
+}
+
+int cancel_schedule(int id) {
+    COMMIT_SCOPE();
+    if (id <= 0 || id >= sched_table_cap || !sched_table[id]) return 0;
+    sched_table[id]->cancelled = 1;
+    sched_table[id] = NULL;
+    oplog_append("K|%d", id);
+    return 1;
+}
+
+/* empty wheel positioned at `now` (load_data starts from a clean slate) */
+void scheduler_reset(int64_t now) {
+    pool_reset(&sched_pool);
+    memset(&sched_wheel, 0, sizeof(sched_wheel));
+    sched_wheel.now = now;
+    mem_free(MEM_SCHEDULES, sched_table, sched_table_cap * sizeof(Schedule *));
+    sched_table = NULL;
+    sched_table_cap = 0;
+    next_sched_id = 1;
+}
+
+void list_schedules() {
+    int any = 0;
+    printf("Standing orders:\n");
+    for (int id = 1; id < sched_table_cap; id++) {
+        Schedule *s = sched_table[id];
+        if (!s) continue;
+        any = 1;
+        time_t due = (time_t)(s->next_due * 60);
+        char buf[32];
+        strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M", localtime(&due));
+        printf("  #%d %s %.2f acc %d", s->id, sched_op_names[s->op], s->amount, s->acc_id);
+        if (s->op == SCHED_TRANSFER) printf(" -> %d", s->acc_id_to);
+        printf("  every %d min, next %s", s->period, buf);
+        if (s->remaining > 0) printf(", %d left", s->remaining);
+        printf("\n");
+    }
+    if (!any) printf("  (none)\n");
+    printf("Runs so far: %ld (%ld failed)\n", sched_runs, sched_failures);
+}
+
+/* ------------------------------
+   Persistence (save/load)
+   Simple flat format:
+   History tiering (first line, only when on):
+   TIER|days
+   Id counter and the day the summaries' flows are for:
+   LEDGER|next_tx_id|yyyy-mm-dd
+   Accounts:
+   ACC|id|name|balance|tx_count|tx_bytes|inflow|outflow|spent_1|..|spent_6[|1]
+   TX|acc_id|tx_id|type|amount|to_acc|timestamp|category
+   (an ACC line's summary covers the TX lines right after it: how many,
+   their length in bytes, that day's flows and spending per category, so a
+   lazy load can skip them. A trailing 1 marks a savings account. The
+   summary, the flag and category are optional when reading, for older
+   files. An account's TX lines are newest first, those on disk
+   included)
+   Goals:
+   GOAL|id|name|target|saved|target_date (yyyymmdd, 0 = none)
+   Standing orders:
+   SCH|id|op|acc_id|acc_id_to|amount|category|next_due_minute|period_minutes|remaining
+   Idempotency keys:
+   KEY|hash (hex)|check (hex)|result|unix_time
+   Velocity limits, and each account's counters per window:
+   LIMIT|window_seconds|max_count|max_amount
+   VEL|acc_id|window_seconds|bucket|count|amount|prev_count|prev_amount
+   Footer index (last; see save_footer):
+   IDX|id|offset|length|crc32
+   FOOTER|index_offset|accounts|first_id|crc32
+   ------------------------------*/
+/* GOAL and SCH lines (writer side, or under commit_lock) */
+void save_goals_schedules(FILE *f) {
+    for (int id = 1; id < goal_table_cap; id++) {
+        Goal *g = goal_table[id];
+        if (g) fprintf(f, "GOAL|%d|%s|%.2f|%.2f|%d\n", g->id, g->name, g->target, g->saved, g->target_date);
+    }
+    for (int id = 1; id < sched_table_cap; id++) {
+        Schedule *sc = sched_table[id];
+        if (sc) fprintf(f, "SCH|%d|%d|%d|%d|%.2f|%d|%lld|%d|%d\n", sc->id, sc->op, sc->acc_id, sc->acc_id_to,
+                        sc->amount, sc->category, (long long)sc->next_due, sc->period, sc->remaining);
+    }
+}
+
+/* A point-in-time read handle. Accounts and transactions are told apart
+   by id (both only ever grow), balances come from the version chains, and
+   goals/standing orders are copied as text when the snapshot opens. The
+   opening thread stays in an epoch read section until it closes. */
+typedef struct Snapshot {
+    int slot;
+    uint64_t snap;          // commit_clock + 1 at open: sees commits < snap
+    int next_account_id;    // accounts/transactions with ids at or past these came later
+    int next_tx_id;
+    int next_goal_id;       // id counters and scheduler position, for followers
+    int next_sched_id;
+    int64_t sched_now;
+    char *extra;            // GOAL/SCH lines as of the snapshot
+    size_t extra_len;
+    IdemEntry *keys;        // live idempotency keys, copied at open
+    size_t nkeys;
+    int tier_days;          // tier_age_days at open (history on disk can't move while open)
+    char day[11];           // ledger_stats.day at open: ACC summaries sum that day's flows
+} Snapshot;
+
+/* NULL when MAX_SNAPSHOTS are already open */
+Snapshot *snapshot_open() {
+    Snapshot *s = calloc(1, sizeof(Snapshot));
+    if (!s) return NULL;
+    pthread_mutex_lock(&commit_lock); // between commits
+    s->slot = -1;
+    for (int i = 0; i < MAX_SNAPSHOTS && s->slot < 0; i++)
+        if (!snapshot_ts[i]) s->slot = i;
+    if (s->slot < 0) {
+        pthread_mutex_unlock(&commit_lock);
+        free(s);
+        return NULL;
+    }
+    s->snap = commit_clock + 1;
+    __atomic_store_n(&snapshot_ts[s->slot], s->snap, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&snapshot_count, 1, __ATOMIC_ACQ_REL);
+    s->next_account_id = next_account_id;
+    s->next_tx_id = next_tx_id;
+    s->next_goal_id = next_goal_id;
+    s->next_sched_id = next_sched_id;
+    s->sched_now = sched_wheel.now;
+    s->tier_days = tier_age_days;
+    memcpy(s->day, ledger_stats.day, sizeof(s->day));
+    FILE *m = open_memstream(&s->extra, &s->extra_len);
+    if (m) {
+        save_goals_schedules(m);
+        save_limits(m);
+        fclose(m);
+    }
+    long nkeys = idem_count(); // a plain copy: ~2 ms per 100k keys held
+    if (nkeys && (s->keys = malloc(nkeys * sizeof(IdemEntry)))) s->nkeys = idem_copy(s->keys, nkeys);
+    epoch_enter(); // cannot block, so safe under the lock
+    pthread_mutex_unlock(&commit_lock);
+    return s;
+}
+
+/* lock-free; the writer trims version chains at its next commit */
+void snapshot_close(Snapshot *s) {
+    if (!s) return;
+    epoch_exit();
+    __atomic_store_n(&snapshot_ts[s->slot], 0, __ATOMIC_RELEASE);
+    __atomic_sub_fetch(&snapshot_count, 1, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&mvcc_gc_pending, 1, __ATOMIC_RELEASE);
+    free(s->extra);
+    free(s->keys);
+    free(s);
+}
+
+int snapshot_has_account(const Snapshot *s, const Account *a) {
+    return a->id < s->next_account_id;
+}
+
+int snapshot_has_tx(const Snapshot *s, const Transaction *t) {
+    return t->id < s->next_tx_id;
+}
+
+/* one account's TX lines, formatted ahead of its ACC line so that line
+   can carry their summary */
+typedef struct TxBlock {
+    char *data;
+    size_t len, cap;
+    int error;
+    long count;
+    double inflow, outflow;         // on the snapshot's stats day
+    double spent[NUM_CATEGORIES];
+} TxBlock;
+
+void tx_block_add(TxBlock *b, int acc_id, const Transaction *t, const char *day) {
+    size_t need = 256; // a typical line; a huge amount under %.2f can take far more
+    for (;;) {
+        if (b->len + need > b->cap) {
+            size_t ncap = b->cap ? b->cap * 2 : 1 << 16;
+            if (ncap < b->len + need) ncap = b->len + need;
+            char *nd = realloc(b->data, ncap);
+            if (!nd) { b->error = 1; return; }
+            b->data = nd;
+            b->cap = ncap;
+        }
+        // replace '|' in timestamp or type if any (not expected)
+        int n = snprintf(b->data + b->len, b->cap - b->len, "TX|%d|%d|%s|%.2f|%d|%s|%d\n",
+                         acc_id, t->id, t->type, t->amount, t->to_account, t->timestamp, t->category);
+        if (n < 0) { b->error = 1; return; }
+        if ((size_t)n < b->cap - b->len) { b->len += n; break; }
+        need = (size_t)n + 1; // did not fit: grow and format again
+    }
+    b->count++;
+    category_scan_tx(b->spent, t);
+    if (day[0] && strncmp(t->timestamp, day, 10) == 0) {
+        int undo, flow = tx_flow(t->type, &undo);
+        double amt = undo ? -t->amount : t->amount;
+        if (flow > 0) b->inflow += amt;
+        else if (flow < 0) b->outflow += amt;
+    }
+}
+
+/* Footer index. A save ends with one fixed-width line per account, in id
+   order:
+     IDX|id|block offset|block length|crc32
+   (10 digits, 16 hex, 16 hex, 8 hex). An account's block is its ACC line
+   and its TX lines, and the CRC covers those bytes. Then, as the very
+   last line:
+     FOOTER|index offset|accounts|first id|crc32 of the IDX lines
+   A reader takes the footer from the file's tail and reads the IDX line
+   at slot (id - first id), or binary searches below it when ids have
+   gaps. Then it reads the block, so any account costs three preads. */
+#define IDX_LINE_LEN 58
+
+typedef struct IndexEntry {
+    int id;
+    uint64_t off, len;
+    uint32_t crc;
+} IndexEntry;
+
+/* save_snapshot's output position and the entries written so far */
+typedef struct SaveIndex {
+    uint64_t pos;
+    IndexEntry *e;
+    size_t n, cap;
+    int error;          // an entry was lost: no footer
+} SaveIndex;
+
+void save_write(FILE *f, SaveIndex *ix, const char *p, size_t n) {
+    ix->pos += fwrite(p, 1, n, f);
+}
+
+void save_printf(FILE *f, SaveIndex *ix, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vfprintf(f, fmt, ap);
+    va_end(ap);
+    if (n > 0) ix->pos += n;
+}
+
+/* an account's ACC line (with the summary of b) into out, without the
+   newline; its length, as snprintf: cap or more means it did not fit */
+size_t acc_line_format(char *out, size_t cap, int id, const char *name, int savings, double balance,
+                       const TxBlock *b) {
+    size_t n = snprintf(out, cap, "ACC|%d|%s|%.2f|%ld|%zu|%.2f|%.2f", id, name, balance,
+                        b->count, b->len, b->inflow, b->outflow);
+    for (int cat = 1; cat < NUM_CATEGORIES; cat++)
+        n += snprintf(n < cap ? out + n : NULL, n < cap ? cap - n : 0, "|%.2f", b->spent[cat]);
+    if (savings) n += snprintf(n < cap ? out + n : NULL, n < cap ? cap - n : 0, "|1");
+    return n;
+}
+
+/* an account's ACC line (with the summary of b) and b's TX lines; 0 when
+   out of memory, with nothing written */
+int save_account_block(FILE *f, SaveIndex *ix, int id, const char *name, int savings, double balance,
+                       const TxBlock *b) {
+    char line[1024], *acc = line;
+    size_t n = acc_line_format(line, sizeof(line) - 1, id, name, savings, balance, b);
+    if (n >= sizeof(line) - 1) { // huge figures run to hundreds of digits under %.2f
+        if (!(acc = malloc(n + 2))) return 0;
+        acc_line_format(acc, n + 1, id, name, savings, balance, b);
+    }
+    acc[n++] = '\n';
+    IndexEntry e = { id, ix->pos, n + b->len, crc32_update(crc32_update(0, acc, n), b->data, b->len) };
+    save_write(f, ix, acc, n);
+    save_write(f, ix, b->data, b->len);
+    if (acc != line) free(acc);
+    if (ix->n == ix->cap) {
+        size_t ncap = ix->cap ? ix->cap * 2 : 1024;
+        IndexEntry *ne = realloc(ix->e, ncap * sizeof(IndexEntry));
+        if (!ne) { ix->error = 1; return 1; }
+        ix->e = ne;
+        ix->cap = ncap;
+    }
+    ix->e[ix->n++] = e;
+    return 1;
+}
+
+int index_entry_cmp(const void *a, const void *b) {
+    int x = ((const IndexEntry *)a)->id, y = ((const IndexEntry *)b)->id;
+    return (x > y) - (x < y);
+}
+
+/* the IDX lines and the FOOTER line; frees the entries */
+void save_footer(FILE *f, SaveIndex *ix) {
+    if (!ix->error) {
+        qsort(ix->e, ix->n, sizeof(IndexEntry), index_entry_cmp);
+        uint64_t start = ix->pos;
+        uint32_t crc = 0;
+        char line[IDX_LINE_LEN + 1];
+        for (size_t i = 0; i < ix->n; i++) {
+            const IndexEntry *e = &ix->e[i];
+            snprintf(line, sizeof(line), "IDX|%010d|%016llx|%016llx|%08x\n", e->id,
+                     (unsigned long long)e->off, (unsigned long long)e->len, e->crc);
+            crc = crc32_update(crc, line, IDX_LINE_LEN);
+            save_write(f, ix, line, IDX_LINE_LEN);
+        }
+        save_printf(f, ix, "FOOTER|%llu|%zu|%d|%08x\n", (unsigned long long)start, ix->n,
+                    ix->n ? ix->e[0].id : 0, crc);
+    }
+    free(ix->e);
+    ix->e = NULL;
+}
+
+/* a data file's footer, found from its tail */
+typedef struct LedgerIndex {
+    int fd;
+    uint64_t idx_off;
+    long count;
+    int first_id;
+    uint32_t crc;
+} LedgerIndex;
+
+/* the CRC of the IDX lines as they are on disk (one sequential read);
+   0 if they cannot be read */
+int ledger_index_crc(const LedgerIndex *ix, uint32_t *out) {
+    char buf[IDX_LINE_LEN * 1024];
+    uint64_t left = (uint64_t)ix->count * IDX_LINE_LEN, at = ix->idx_off;
+    uint32_t crc = 0;
+    while (left) {
+        size_t want = left < sizeof(buf) ? (size_t)left : sizeof(buf);
+        if (pread(ix->fd, buf, want, (off_t)at) != (ssize_t)want) return 0;
+        crc = crc32_update(crc, buf, want);
+        left -= want;
+        at += want;
+    }
+    *out = crc;
+    return 1;
+}
+
+/* 1 with the index open; 0 if the file on fd has no footer (an older
+   version wrote it, or it was cut short); -1 if the index fails its CRC.
+   Nothing in an index that fails is trusted. */
+int ledger_index_open(int fd, LedgerIndex *ix) {
+    struct stat st;
+    char tail[128];
+    if (fstat(fd, &st) != 0) return 0;
+    off_t from = st.st_size > (off_t)sizeof(tail) - 1 ? st.st_size - (off_t)(sizeof(tail) - 1) : 0;
+    ssize_t n = pread(fd, tail, st.st_size - from, from);
+    if (n <= 0) return 0;
+    tail[n] = '\0';
+    char *footer = NULL;
+    for (char *p = tail; (p = strstr(p, "FOOTER|")); p++) footer = p;
+    unsigned long long off;
+    unsigned crc;
+    if (!footer || sscanf(footer + 7, "%llu|%ld|%d|%x", &off, &ix->count, &ix->first_id, &crc) != 4) return 0;
+    if (ix->count < 0 || off + (uint64_t)ix->count * IDX_LINE_LEN != (uint64_t)(from + (footer - tail))) return 0;
+    ix->fd = fd;
+    ix->idx_off = off;
+    ix->crc = crc;
+    uint32_t got;
+    return ledger_index_crc(ix, &got) && got == ix->crc ? 1 : -1;
+}
+
+/* IDX line i */
+int ledger_index_entry(const LedgerIndex *ix, long i, IndexEntry *e) {
+    char line[IDX_LINE_LEN + 1];
+    if (pread(ix->fd, line, IDX_LINE_LEN, ix->idx_off + (uint64_t)i * IDX_LINE_LEN) != IDX_LINE_LEN) return 0;
+    line[IDX_LINE_LEN] = '\0';
+    unsigned long long off, len;
+    unsigned crc;
+    if (sscanf(line, "IDX|%d|%llx|%llx|%x", &e->id, &off, &len, &crc) != 4) return 0;
+    e->off = off;
+    e->len = len;
+    e->crc = crc;
+    return 1;
+}
+
+/* id's entry; 0 if it has none */
+int ledger_index_find(const LedgerIndex *ix, int id, IndexEntry *e) {
+    long slot = (long)id - ix->first_id; // ids at or above first_id, no repeats: never past this
+    if (slot < 0) return 0;
+    if (slot < ix->count && ledger_index_entry(ix, slot, e) && e->id == id) return 1;
+    long lo = 0, hi = slot < ix->count ? slot - 1 : ix->count - 1;
+    while (lo <= hi) {
+        long mid = lo + (hi - lo) / 2;
+        if (!ledger_index_entry(ix, mid, e)) return 0;
+        if (e->id == id) return 1;
+        if (e->id < id) lo = mid + 1;
+        else hi = mid - 1;
+    }
+    return 0;
+}
+
+/* id's block (its ACC and TX lines) into a malloc'd buffer of *len bytes:
+   1, 0 if there is no such account or it cannot be read, -1 if it fails
+   its checksum (the buffer is still returned) or its entry points outside
+   the blocks (*out is NULL) */
+int ledger_block_read(const LedgerIndex *ix, int id, char **out, size_t *len) {
+    IndexEntry e;
+    if (!ledger_index_find(ix, id, &e)) return 0;
+    if (e.len > SSIZE_MAX || e.off > ix->idx_off || e.len > ix->idx_off - e.off) { // blocks end where the index starts
+        *out = NULL;
+        *len = 0;
+        return -1;
+    }
+    char *buf = malloc(e.len + 1);
+    if (!buf) return 0;
+    if (pread(ix->fd, buf, e.len, e.off) != (ssize_t)e.len) {
+        free(buf);
+        return 0;
+    }
+    buf[e.len] = '\0';
+    *out = buf;
+    *len = e.len;
+    return crc32_update(0, buf, e.len) == e.crc ? 1 : -1;
+}
+
+/* whole-file check of an open index (its own CRC is checked on open):
+   the number of blocks that fail, -1 if an index line cannot be read */
+long ledger_index_verify(const LedgerIndex *ix) {
+    long bad = 0;
+    IndexEntry e;
+    for (long i = 0; i < ix->count; i++) {
+        char *buf = NULL;
+        size_t len;
+        if (!ledger_index_entry(ix, i, &e)) return -1;
+        if (ledger_block_read(ix, e.id, &buf, &len) != 1) bad++;
+        free(buf);
+    }
+    return bad;
+}
+
+/* writes the ledger as of s in the save format; returns 0 on write error */
+int save_snapshot(FILE *f, Snapshot *s) {
+    uint64_t span = trace_begin();
+    long rows = 0;
+    SaveIndex ix = { 0 };
+    if (s->tier_days) save_printf(f, &ix, "TIER|%d\n", s->tier_days);
+    save_printf(f, &ix, "LEDGER|%d|%s\n", s->next_tx_id, s->day);
+    TxBlock b = { 0 };
+    for (Account *a = DEREF(accounts_head); a; a = DEREF(a->next)) {
+        if (!snapshot_has_account(s, a)) continue;
+        b.len = 0;
+        b.count = 0;
+        b.inflow = b.outflow = 0;
+        memset(b.spent, 0, sizeof(b.spent));
+        ColdCursor c; // opened first: see hot_tx_counts
+        Transaction t;
+        int lazy = cold_open(&c, a);
+        for (Transaction *h = DEREF(a->tx_head); h; h = DEREF(h->next))
+            if (snapshot_has_tx(s, h) && hot_tx_counts(lazy, h)) tx_block_add(&b, a->id, h, s->day);
+        while (cold_next(&c, &t)) tx_block_add(&b, a->id, &t, s->day); // older, so it follows on
+        cold_close(&c);
+        if (!save_account_block(f, &ix, a->id, a->name, a->savings, mvcc_balance_at(a, s->snap), &b)) {
+            b.error = 1;
+            break;
+        }
+        rows++;
+    }
+    free(b.data);
+    trace_end("save_data.accounts", span, rows);
+    if (b.error) {
+        free(ix.e);
+        return 0;
+    }
+    if (s->extra_len) save_write(f, &ix, s->extra, s->extra_len);
+    for (size_t i = 0; i < s->nkeys; i++)
+        save_printf(f, &ix, "KEY|%016llx|%016llx|%d|%u\n", (unsigned long long)s->keys[i].key,
+                    (unsigned long long)s->keys[i].check, s->keys[i].result, s->keys[i].at);
+    span = trace_begin();
+    save_footer(f, &ix);
+    trace_end("save_data.footer", span, rows);
+    return !ferror(f);
+}
+
+/* safe from any thread: commits carry on while the file is written */
+void save_data(const char *filename) {
+    METRIC_SCOPE(M_SAVE);
+    TRACE_SPAN("save_data");
+    // written beside the old file and renamed over it, so a lazily loaded
+    // ledger goes on reading the file it came from
+    char tmp[300];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", filename);
+    FILE *f = fopen(tmp, "w");
+    if (!f) {
+        perror("Error opening file to save");
+        return;
+    }
+    Snapshot *s = snapshot_open();
+    while (!s) { // every slot busy: wait for one
+        sched_yield();
+        s = snapshot_open();
+    }
+    int ok = save_snapshot(f, s);
+    snapshot_close(s);
+    uint64_t span = trace_begin();
+    if (fclose(f) != 0) ok = 0;
+    trace_end("save_data.fclose", span, -1);
+    if (ok && rename(tmp, filename) != 0) ok = 0;
+    if (ok) printf("Data saved to %s\n", filename);
+    else {
+        perror("Error writing save file");
+        unlink(tmp);
+    }
+}
+
+/* save_data on a worker thread; one at a time */
+pthread_t bg_save_thread;
+int bg_save_running = 0;
+char bg_save_path[256];
+
+void *bg_save_main(void *arg) {
+    (void)arg;
+    save_data(bg_save_path);
+    return NULL;
+}
+
+void save_data_background(const char *filename) {
+    if (bg_save_running) pthread_join(bg_save_thread, NULL);
+    snprintf(bg_save_path, sizeof(bg_save_path), "%s", filename);
+    bg_save_running = pthread_create(&bg_save_thread, NULL, bg_save_main, NULL) == 0;
+    if (!bg_save_running) save_data(filename);
+}
+
+void save_data_wait() {
+    if (bg_save_running) pthread_join(bg_save_thread, NULL);
+    bg_save_running = 0;
+}
+
+/* totals as of one snapshot */
+typedef struct SnapshotReport {
+    int accounts;
+    long transactions;
+    double total_balance;
+} SnapshotReport;
+
+void snapshot_report(Snapshot *s, SnapshotReport *r) {
+    memset(r, 0, sizeof(*r));
+    for (Account *a = DEREF(accounts_head); a; a = DEREF(a->next)) {
+        if (!snapshot_has_account(s, a)) continue;
+        r->accounts++;
+        r->total_balance += mvcc_balance_at(a, s->snap);
+        long lazy = __atomic_load_n(&a->lazy_count, __ATOMIC_ACQUIRE); // as in cold_open
+        r->transactions += lazy;
+        for (Transaction *t = DEREF(a->tx_head); t; t = DEREF(t->next))
+            r->transactions += snapshot_has_tx(s, t) && hot_tx_counts(lazy > 0, t);
+        r->transactions += a->cold_count;
+    }
+}
+
+void free_all_data() {
+    // every account and transaction lives in the pools; unlink them all,
+    // let readers drain, then drop the pools wholesale
+    PUBLISH(accounts_head, NULL);
+    account_map_reset();
+    shm_reset();
+    epoch_synchronize();
+    pool_reset(&tx_pool);
+    pool_reset(&acc_pool);
+    pool_reset(&version_pool);
+    versioned_len = 0;
+    account_rows = 0;
+    memset(&ledger_stats, 0, sizeof(ledger_stats));
+    memset(cat_spent_total, 0, sizeof(cat_spent_total));
+    free_all_goals();
+    scheduler_reset(clock_minutes());
+    idem_reset();
+    velocity_reset();
+    tier_reset();
+    tier_age_days = 0;
+    if (lazy_fd >= 0) close(lazy_fd);
+    lazy_fd = -1;
+}
+
+/* load_data traces one span per block of lines; its args split the
+   block's time into the load_data.* phases timed by the metric laps.
+   Those time one line in LOAD_LAP_EVERY, so the split is scaled up. */
+#define LOAD_TRACE_BLOCK 4096
+#define LOAD_LAP_EVERY 64
+
+void load_trace_block(uint64_t start, long lines, uint64_t *phase_ticks) {
+    static const char *const names[6] = { "lines", "read_us", "parse_us", "lookup_us", "alloc_us", "apply_us" };
+    long long vals[6] = { lines };
+    double us_per_tick = metric_ns_per_tick() / 1000;
+    for (int i = 0; i < 5; i++) {
+        uint64_t total = metric_thread_total(M_LOAD_READ + i);
+        vals[i + 1] = (long long)((total - phase_ticks[i]) * us_per_tick * LOAD_LAP_EVERY);
+        phase_ticks[i] = total;
+    }
+#ifdef FB_NO_METRICS
+    trace_end_args("load_data.block", start, 1, names, vals);
+#else
+    trace_end_args("load_data.block", start, 6, names, vals);
+#endif
+}
+
+/* takes t, counted by load_data but not kept after all, back out of the
+   stats and the spending totals */
+void load_uncount(Account *a, Transaction *t) {
+    stats_tx(t, -1);
+    if (strcmp(t->type, "WITHDRAW") == 0) strcpy(t->type, "UNDO_WITHDRAW");
+    else if (strcmp(t->type, "UNDO_WITHDRAW") == 0) strcpy(t->type, "WITHDRAW");
+    else return;
+    category_apply(a, t);
+}
+
+/* a write to the history file failed, so tiering stops. The queued
+   account's cold transactions (already counted in the stats) go back on
+   its list after the ones there: its blocks from this load, newest first,
+   then the queue, so the list keeps the file's order. *tail and *shm_tail
+   get the list's last node and its mirror record, for the TX lines still
+   to come. 0 if they cannot all be read back or allocated: the blocks stay
+   on disk and the queue, older than them, is dropped and uncounted. */
+int cold_loader_unqueue(ColdLoader *l, Transaction **tail, uint64_t *shm_tail) {
+    Account *a = l->acc;
+    if (!a) return 1;
+    Transaction *first = NULL, **link = &first, t;
+    long n = 0;
+    ColdCursor c;
+    cold_open(&c, a);
+    while (n < a->cold_count && cold_next(&c, &t)) {
+        Transaction *nt = pool_alloc(&tx_pool);
+        if (!nt) break;
+        *nt = t;
+        *link = nt;
+        link = &nt->next;
+        n++;
+    }
+    cold_close(&c);
+    for (int i = 0; n >= a->cold_count && i < l->n; i++) {
+        Transaction *nt = pool_alloc(&tx_pool);
+        if (!nt) break;
+        tx_from_cold(nt, &l->recs[i]);
+        *link = nt;
+        link = &nt->next;
+        n++;
+    }
+    if (n < a->cold_count + l->n) {
+        while (first) {
+            Transaction *nt = first;
+            first = nt->next;
+            pool_free(&tx_pool, nt);
+        }
+        for (int i = 0; i < l->n; i++) {
+            tx_from_cold(&t, &l->recs[i]);
+            load_uncount(a, &t);
+        }
+        l->n = 0;
+        return 0;
+    }
+    Transaction **end = &a->tx_head;
+    while (*end) end = &(*end)->next;
+    if (first) PUBLISH(*end, first);
+    a->cold_head = 0;
+    a->cold_count = 0;
+    l->n = 0;
+    *tail = NULL;
+    for (Transaction *x = a->tx_head; x; x = x->next) *tail = x;
+    *shm_tail = shm_mirror_account(a);
+    return 1;
+}
+
+/* the savings flag at the end of an ACC line; p is just past its outflow */
+int acc_line_savings(const char *p) {
+    if (*p != '|') return 0;
+    for (int c = 1; c < NUM_CATEGORIES; c++) // over the spending per category
+        if (!(p = strchr(p + 1, '|'))) return 0;
+    return p[1] == '1';
+}
+
+void load_data(const char *filename) {
+    METRIC_SCOPE(M_LOAD);
+    COMMIT_SCOPE();
+    TRACE_SPAN("load_data");
+    FILE *f = fopen(filename, "r");
+    if (!f) {
+        // file may not exist => not an error
+        return;
+    }
+    uint64_t span = trace_begin();
+    free_all_data();
+    trace_end("load_data.free_all", span, -1);
+    oplog_append("R"); // followers reload from a snapshot
+    char *line = NULL;          // whole lines: an ACC line with huge figures runs past 1 KB
+    size_t line_cap = 0;
+    int max_acc_id = 0;
+    int max_tx_id = 0;
+    long block_lines = 0;
+    Account *last_acc = NULL;   // TX lines are newest first: append while the account repeats
+    Transaction *last_tx = NULL;
+    uint64_t last_shm = 0;
+    ColdLoader *cold = NULL;    // set once a TIER line turns tiering on
+    char cutoff[32] = "";
+    if (lazy_load) lazy_fd = open(filename, O_RDONLY);
+    int lazy = lazy_fd >= 0;
+    char saved_day[16] = "";    // the day the ACC summaries' flows were summed for
+    uint64_t phase_ticks[5];
+    for (int i = 0; i < 5; i++) phase_ticks[i] = metric_thread_total(M_LOAD_READ + i);
+    span = trace_begin();
+    METRIC_LAP_START(lap); // per-line phases: read, parse, lookup, alloc, apply (sampled)
+    while (getline(&line, &line_cap, f) >= 0) {
+        METRIC_LAP(M_LOAD_READ, lap);
+        // strip newline
+        char *nl = strchr(line, '\n'); if (nl) *nl = '\0';
+        if (strncmp(line, "TIER|", 5) == 0) {
+            // written first, so every TX line after it can go to disk
+            int days = atoi(line + 5);
+            if (days > 0 && !cold && (cold = malloc(sizeof(ColdLoader)))) {
+                memset(cold, 0, offsetof(ColdLoader, recs));
+                tier_age_days = days;
+                tier_cutoff(cutoff, sizeof(cutoff));
+            }
+        } else if (strncmp(line, "LEDGER|", 7) == 0) {
+            int next_tx;
+            if (sscanf(line + 7, "%d|%10s", &next_tx, saved_day) >= 1 && next_tx - 1 > max_tx_id)
+                max_tx_id = next_tx - 1; // a lazy load sees no TX lines to take it from
+        } else if (strncmp(line, "ACC|", 4) == 0) {
+            int id, used = 0;
+            char name[128];
+            double balance, inflow = 0, outflow = 0;
+            long txs = 0;
+            unsigned long long bytes = 0;
+            int fields = sscanf(line+4, "%d|%127[^|]|%lf|%ld|%llu|%lf|%lf%n", &id, name, &balance,
+                                &txs, &bytes, &inflow, &outflow, &used);
+            METRIC_LAP(M_LOAD_PARSE, lap);
+            Account *acc = account_new(id);
+            if (!acc) break;
+            METRIC_LAP(M_LOAD_ALLOC, lap);
+            strncpy(acc->name, name, sizeof(acc->name)-1);
+            acc->savings = fields == 7 && acc_line_savings(line + 4 + used);
+            adjust_balance(acc, balance);
+            acc->next = accounts_head;
+            PUBLISH(accounts_head, acc);
+            if (id > max_acc_id) max_acc_id = id;
+            if (lazy && fields == 7 && txs > 0) {
+                // the summary stands in for the TX lines below, which stay on disk
+                const char *p = line + 4 + used;
+                for (int c = 1; c < NUM_CATEGORIES && *p == '|'; c++) {
+                    char *end;
+                    double spent = strtod(p + 1, &end);
+                    acc->cat_spent[c] += spent;
+                    cat_spent_total[c] += spent;
+                    p = end;
+                }
+                stats_summary(txs, saved_day, inflow, outflow);
+                acc->lazy_off = (uint64_t)ftello(f);
+                acc->lazy_bytes = bytes;
+                acc->lazy_count = txs;
+                acc->lazy_crc = crc32_update(crc32_update(0, line, strlen(line)), "\n", 1);
+                fseeko(f, (off_t)bytes, SEEK_CUR);
+            }
+        } else if (lazy && strncmp(line, "IDX|", 4) == 0) {
+            // the block's checksum, for the page-in to check what it reads
+            int id;
+            unsigned long long off, len;
+            unsigned crc;
+            Account *acc;
+            if (sscanf(line + 4, "%d|%llx|%llx|%x", &id, &off, &len, &crc) == 4 && (acc = find_account(id)) &&
+                acc->lazy_count > 0 && off + len == acc->lazy_off + acc->lazy_bytes) {
+                acc->lazy_want = crc;
+                acc->lazy_verify = 1;
+            }
+        } else if (strncmp(line, "TX|", 3) == 0) {
+            // TX|acc_id|tx_id|type|amount|to_acc|timestamp|category
+            int acc_id;
+            Transaction parsed;
+            if (parse_tx_line(line + 3, &acc_id, &parsed)) {
+                METRIC_LAP(M_LOAD_PARSE, lap);
+                Account *acc = find_account(acc_id);
+                METRIC_LAP(M_LOAD_LOOKUP, lap);
+                if (acc && cold && strcmp(parsed.timestamp, cutoff) < 0) {
+                    if (cold_loader_add(cold, acc, &parsed)) {
+                        category_apply(acc, &parsed);
+                        stats_tx(&parsed, 1);
+                        if (parsed.id > max_tx_id) max_tx_id = parsed.id;
+                        acc = NULL;
+                    } else {
+                        printf("Warning: could not write %s; keeping all transactions in memory\n", tier_path);
+                        Account *queued = cold->acc;
+                        Transaction *tail;
+                        uint64_t shm_tail;
+                        int back = cold_loader_unqueue(cold, &tail, &shm_tail);
+                        free(cold);
+                        cold = NULL;
+                        tier_age_days = 0;
+                        if (!back) {
+                            printf("Out of memory; stopped loading at account %d\n", queued->id);
+                            break;
+                        }
+                        if (queued == last_acc) { // parsed and the rest go on after what came back
+                            last_tx = tail;
+                            last_shm = shm_tail;
+                        }
+                    }
+                }
+                if (acc) {
+                    Transaction *t = pool_alloc(&tx_pool);
+                    METRIC_LAP(M_LOAD_ALLOC, lap);
+                    *t = parsed;
+                    if (acc == last_acc && last_tx) {
+                        PUBLISH(last_tx->next, t);
+                        last_shm = shm_tx_append(acc, t, last_shm);
+                    } else { // account seen out of line: newest so far
+                        t->next = acc->tx_head;
+                        PUBLISH(acc->tx_head, t);
+                        last_shm = shm_tx_added(acc, t);
+                    }
+                    last_acc = acc;
+                    last_tx = t;
+                    category_apply(acc, t);
+                    stats_tx(t, 1);
+                    if (t->id > max_tx_id) max_tx_id = t->id;
+                }
+            }
+        } else if (strncmp(line, "GOAL|", 5) == 0) {
+            int id, date;
+            char name[128];
+            double target, saved;
+            if (sscanf(line+5, "%d|%127[^|]|%lf|%lf|%d", &id, name, &target, &saved, &date) == 5 && id > 0)
+                goal_new(id, name, target, saved, date);
+        } else if (strncmp(line, "SCH|", 4) == 0) {
+            // written last, so the accounts exist; overdue orders catch up here
+            int id, op, from, to, cat, period, remaining;
+            double amt;
+            long long due;
+            if (sscanf(line+4, "%d|%d|%d|%d|%lf|%d|%lld|%d|%d", &id, &op, &from, &to, &amt, &cat,
+                       &due, &period, &remaining) == 9 && id > 0)
+                sched_add(id, op, from, to, amt, cat, due, period, remaining);
+        } else if (strncmp(line, "LIMIT|", 6) == 0) {
+            int secs, count;
+            double amount;
+            if (sscanf(line+6, "%d|%d|%lf", &secs, &count, &amount) == 3)
+                for (int i = 0; i < VEL_WINDOWS; i++)
+                    if (velocity_window_secs[i] == secs) velocity_set_limit(i, count, amount);
+        } else if (strncmp(line, "VEL|", 4) == 0) {
+            int id, secs;
+            VelocityWindow w;
+            if (sscanf(line+4, "%d|%d|%u|%u|%lf|%u|%lf", &id, &secs, &w.bucket, &w.count, &w.amount,
+                       &w.prev_count, &w.prev_amount) == 7)
+                velocity_restore(id, secs, &w);
+        } else if (strncmp(line, "KEY|", 4) == 0) {
+            unsigned long long key, check = 0;
+            int result;
+            unsigned at;
+            int ok = sscanf(line+4, "%llx|%llx|%d|%u", &key, &check, &result, &at) == 4;
+            if (!ok) { // written before checks were saved: KEY|hash|result|unix_time
+                check = 0;
+                ok = sscanf(line+4, "%llx|%d|%u", &key, &result, &at) == 3;
+            }
+            if (ok && key && ledger_time() - (time_t)at < idem_window)
+                idem_insert((IdemKey){ key, check }, result, at);
+        }
+        METRIC_LAP(M_LOAD_APPLY, lap);
+        METRIC_LAP_EVERY(lap, LOAD_LAP_EVERY);
+        if (span && ++block_lines == LOAD_TRACE_BLOCK) {
+            load_trace_block(span, block_lines, phase_ticks);
+            block_lines = 0;
+            span = trace_begin();
+        }
+    }
+    if (span && block_lines) load_trace_block(span, block_lines, phase_ticks);
+    fclose(f);
+    free(line);
+    if (cold && !cold_loader_flush(cold)) {
+        printf("Warning: could not write %s; keeping %d old transactions in memory\n", tier_path, cold->n);
+        if (!cold_loader_unqueue(cold, &last_tx, &last_shm)) // nothing follows: the tails are not needed
+            printf("Out of memory; account %d's oldest transactions were not loaded\n", cold->acc->id);
+    }
+    free(cold);
+    next_account_id = max_acc_id + 1;
+    next_tx_id = max_tx_id + 1;
+    lazy_tx_floor = next_tx_id;
+}
+
+/* ------------------------------
+   Export (JSON / CSV)
+   Streams straight to a file descriptor through one fixed buffer, so the
+   whole ledger is never built in memory. The JSON layout matches the web
+   app's finance_buddy_data.json: { accounts:[...], history:[], goals:[...] }
+   ------------------------------*/
+#define OUTBUF_SIZE (1 << 16)
+
+typedef struct OutBuf {
+    int fd;
+    int error;
+    size_t len;
+    char data[OUTBUF_SIZE];
+} OutBuf;
+
+/* write all n bytes, retrying on short writes / EINTR */
+int write_all(int fd, const char *p, size_t n) {
+    while (n) {
+        ssize_t w = write(fd, p, n);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return errno;
+        }
+        p += w;
+        n -= (size_t)w;
+    }
+    return 0;
+}
+
+void ob_flush(OutBuf *ob) {
+    if (ob->len && !ob->error) ob->error = write_all(ob->fd, ob->data, ob->len);
+    ob->len = 0;
+}
+
+void ob_write(OutBuf *ob, const char *s, size_t n) {
+    if (ob->len + n > OUTBUF_SIZE) {
+        ob_flush(ob);
+        if (n > OUTBUF_SIZE) { // too big to buffer, write through
+            if (!ob->error) ob->error = write_all(ob->fd, s, n);
+            return;
+        }
+    }
+    memcpy(ob->data + ob->len, s, n);
+    ob->len += n;
+}
+
+void ob_puts(OutBuf *ob, const char *s) {
+    ob_write(ob, s, strlen(s));
+}
+
+void ob_putc(OutBuf *ob, char c) {
+    if (ob->len == OUTBUF_SIZE) ob_flush(ob);
+    ob->data[ob->len++] = c;
+}
+
+/* integer -> decimal text without printf */
+void ob_int(OutBuf *ob, long long v) {
+    char tmp[24];
+    int i = sizeof(tmp);
+    unsigned long long u = v < 0 ? 0ULL - (unsigned long long)v : (unsigned long long)v;
+    do {
+        tmp[--i] = (char)('0' + u % 10);
+        u /= 10;
+    } while (u);
+    if (v < 0) tmp[--i] = '-';
+    ob_write(ob, tmp + i, sizeof(tmp) - i);
+}
+
+#define MONEY_MAX 320 // "%.2f" of the largest double, with sign and NUL
+
+/* money amount with exactly two decimals, same rounding as "%.2f" for
+   cents; dst needs MONEY_MAX bytes. Returns the length. */
+int fmt_money(char *dst, double amount) {
+    if (amount != amount || amount > 9e15 || amount < -9e15) // NaN / beyond exact cents: the slow way
+        return snprintf(dst, MONEY_MAX, "%.2f", amount);
+    long long cents = (long long)(amount * 100.0 + (amount < 0 ? -0.5 : 0.5));
+    char tmp[24];
+    int i = sizeof(tmp);
+    int neg = cents < 0;
+    unsigned long long u = neg ? 0ULL - (unsigned long long)cents : (unsigned long long)cents;
+    tmp[--i] = (char)('0' + u % 10); u /= 10;
+    tmp[--i] = (char)('0' + u % 10); u /= 10;
+    tmp[--i] = '.';
+    do {
+        tmp[--i] = (char)('0' + u % 10);
+        u /= 10;
+    } while (u);
+    if (neg) tmp[--i] = '-';
+    memcpy(dst, tmp + i, sizeof(tmp) - i);
+    return (int)sizeof(tmp) - i;
+}
+
+void ob_money(OutBuf *ob, double amount) {
+    char tmp[MONEY_MAX];
+    ob_write(ob, tmp, fmt_money(tmp, amount));
+}
+
+/* JSON has no NaN or infinity */
+void ob_json_money(OutBuf *ob, double amount) {
+    if (isfinite(amount)) ob_money(ob, amount);
+    else ob_puts(ob, "null");
+}
+
+void ob_json_str(OutBuf *ob, const char *s) {
+    static const char hex[] = "0123456789abcdef";
+    ob_putc(ob, '"');
+    const char *run = s;
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c >= 0x20 && c != '"' && c != '\\') continue;
+        ob_write(ob, run, s - run);
+        run = s + 1;
+        ob_putc(ob, '\\');
+        switch (c) {
+        case '"': ob_putc(ob, '"'); break;
+        case '\\': ob_putc(ob, '\\'); break;
+        case '\n': ob_putc(ob, 'n'); break;
+        case '\r': ob_putc(ob, 'r'); break;
+        case '\t': ob_putc(ob, 't'); break;
+        default:
+            ob_puts(ob, "u00");
+            ob_putc(ob, hex[c >> 4]);
+            ob_putc(ob, hex[c & 15]);
+        }
+    }
+    ob_write(ob, run, s - run);
+    ob_putc(ob, '"');
+}
+
+/* web app ids are strings, so account/tx ids are exported as "123" */
+void ob_json_id(OutBuf *ob, int id) {
+    ob_putc(ob, '"');
+    ob_int(ob, id);
+    ob_putc(ob, '"');
+}
+
+/* "DEPOSIT" -> "deposit", the spelling the web app uses */
+void ob_json_type(OutBuf *ob, const char *type) {
+    char low[16];
+    size_t i = 0;
+    for (; type[i] && i < sizeof(low); i++)
+        low[i] = (type[i] >= 'A' && type[i] <= 'Z') ? (char)(type[i] + 32) : type[i];
+    ob_putc(ob, '"');
+    ob_write(ob, low, i);
+    ob_putc(ob, '"');
+}
+
+void ob_csv_str(OutBuf *ob, const char *s) {
+    if (!strpbrk(s, ",\"\r\n")) {
+        ob_puts(ob, s);
+        return;
+    }
+    ob_putc(ob, '"');
+    for (; *s; s++) {
+        if (*s == '"') ob_putc(ob, '"');
+        ob_putc(ob, *s);
+    }
+    ob_putc(ob, '"');
+}
+
+/* one transaction object of an account's "transactions" array */
+void ob_json_tx(OutBuf *ob, const Transaction *t, int first) {
+    ob_puts(ob, first ? "\n      {\"id\":" : ",\n      {\"id\":");
+    ob_json_id(ob, t->id);
+    ob_puts(ob, ",\"type\":");
+    ob_json_type(ob, t->type);
+    ob_puts(ob, ",\"amount\":");
+    ob_json_money(ob, t->amount);
+    ob_puts(ob, ",\"category\":");
+    if (t->category > CAT_NONE && t->category < NUM_CATEGORIES) ob_json_str(ob, category_names[t->category]);
+    else ob_puts(ob, "null");
+    ob_puts(ob, ",\"to_id\":");
+    if (t->to_account) ob_json_id(ob, t->to_account);
+    else ob_puts(ob, "null");
+    ob_puts(ob, ",\"ts\":");
+    ob_json_str(ob, t->timestamp);
+    ob_putc(ob, '}');
+}
+
+/* one CSV row */
+void ob_csv_tx(OutBuf *ob, const Account *a, const Transaction *t) {
+    ob_int(ob, a->id);
+    ob_putc(ob, ',');
+    ob_csv_str(ob, a->name);
+    ob_putc(ob, ',');
+    ob_int(ob, t->id);
+    ob_putc(ob, ',');
+    ob_puts(ob, t->type);
+    ob_putc(ob, ',');
+    ob_money(ob, t->amount);
+    ob_putc(ob, ',');
+    ob_int(ob, t->to_account);
+    ob_putc(ob, ',');
+    if (t->category > CAT_NONE && t->category < NUM_CATEGORIES) ob_puts(ob, category_names[t->category]);
+    ob_putc(ob, ',');
+    ob_csv_str(ob, t->timestamp);
+    ob_putc(ob, '\n');
+}
+
+/* returns 1 on success, 0 on write error (errno set) */
+int export_json(int fd) {
+    TRACE_SPAN("export_json");
+    OutBuf *ob = malloc(sizeof(OutBuf));
+    if (!ob) return 0;
+    ob->fd = fd;
+    ob->error = 0;
+    ob->len = 0;
+    ob_puts(ob, "{\n  \"accounts\": [");
+    epoch_enter();
+    Account *head = DEREF(accounts_head);
+    Account *a = head;
+    while (a) {
+        ob_puts(ob, a == head ? "\n    {\"id\":" : ",\n    {\"id\":");
+        ob_json_id(ob, a->id);
+        ob_puts(ob, ",\"name\":");
+        ob_json_str(ob, a->name);
+        ob_puts(ob, ",\"balance\":");
+        ob_json_money(ob, BALANCE_READ(a));
+        if (a->savings) ob_puts(ob, ",\"savings\":true");
+        ob_puts(ob, ",\"transactions\":[");
+        int first = 1;
+        ColdCursor c;
+        Transaction t;
+        int lazy = cold_open(&c, a);
+        for (Transaction *h = DEREF(a->tx_head); h; h = DEREF(h->next))
+            if (hot_tx_counts(lazy, h)) {
+                ob_json_tx(ob, h, first);
+                first = 0;
+            }
+        for (; cold_next(&c, &t); first = 0) ob_json_tx(ob, &t, first);
+        cold_close(&c);
+        ob_puts(ob, "]}");
+        a = DEREF(a->next);
+    }
+    epoch_exit();
+    ob_puts(ob, "\n  ],\n  \"history\": [],\n  \"goals\": [");
+    int gfirst = 1;
+    for (int id = 1; id < goal_table_cap; id++) {
+        Goal *g = goal_table[id];
+        if (!g) continue;
+        ob_puts(ob, gfirst ? "\n    {\"id\":" : ",\n    {\"id\":");
+        gfirst = 0;
+        ob_json_id(ob, g->id);
+        ob_puts(ob, ",\"name\":");
+        ob_json_str(ob, g->name);
+        ob_puts(ob, ",\"target\":");
+        ob_json_money(ob, g->target);
+        ob_puts(ob, ",\"saved\":");
+        ob_json_money(ob, g->saved);
+        ob_puts(ob, ",\"targetDate\":");
+        if (g->target_date) {
+            char date[16];
+            snprintf(date, sizeof(date), "%04d-%02d-%02d", g->target_date / 10000, g->target_date / 100 % 100, g->target_date % 100);
+            ob_json_str(ob, date);
+        } else {
+            ob_puts(ob, "null");
+        }
+        ob_putc(ob, '}');
+    }
+    ob_puts(ob, gfirst ? "]\n}\n" : "\n  ]\n}\n");
+    ob_flush(ob);
+    int err = ob->error;
+    free(ob);
+    if (err) { errno = err; return 0; }
+    return 1;
+}
+
+/* one row per transaction, header first */
+int export_csv(int fd) {
+    TRACE_SPAN("export_csv");
+    OutBuf *ob = malloc(sizeof(OutBuf));
+    if (!ob) return 0;
+    ob->fd = fd;
+    ob->error = 0;
+    ob->len = 0;
+    ob_puts(ob, "account_id,account_name,tx_id,type,amount,to_account,category,timestamp\n");
+    epoch_enter();
+    Account *a = DEREF(accounts_head);
+    while (a) {
+        ColdCursor c;
+        Transaction t;
+        int lazy = cold_open(&c, a);
+        for (Transaction *h = DEREF(a->tx_head); h; h = DEREF(h->next))
+            if (hot_tx_counts(lazy, h)) ob_csv_tx(ob, a, h);
+        while (cold_next(&c, &t)) ob_csv_tx(ob, a, &t);
+        cold_close(&c);
+        a = DEREF(a->next);
+    }
+    epoch_exit();
+    ob_flush(ob);
+    int err = ob->error;
+    free(ob);
+    if (err) { errno = err; return 0; }
+    return 1;
+}
+
+/* opens/truncates filename and streams the chosen format into it */
+void export_to_file(const char *filename, int csv) {
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("Error opening export file");
+        return;
+    }
+    int ok = csv ? export_csv(fd) : export_json(fd);
+    if (!ok) perror("Error writing export");
+    if (close(fd) != 0 && ok) {
+        perror("Error closing export file");
+        ok = 0;
+    }
+    if (ok) printf("Exported %s to %s\n", csv ? "CSV" : "JSON", filename);
+}
+
+/* Writes the metrics table to fd through ob using only write(2), so it is
+   also safe to call from the SIGUSR1 handler. Each caller brings its own
+   buffer and merge histogram: the signal can arrive in the middle of
+   option 27's dump. */
+void metrics_dump(OutBuf *ob, Histogram *h, int fd) {
+    ob->fd = fd;
+    ob->error = 0;
+    ob->len = 0;
+#ifdef FB_NO_METRICS
+    (void)h;
+    ob_puts(ob, "Metrics compiled out (FB_NO_METRICS).\n");
+#else
+    static const char *pad = "                              ";
+    double ns_per_tick = metric_ns_per_tick();
+    ob_puts(ob, "operation                       count      mean_us     p50_us     p90_us     p99_us     max_us\n");
+    for (int op = 0; op < NUM_METRICS; op++) {
+        metric_merge(op, h);
+        uint64_t count = h->count;
+        if (!count) continue;
+        static const double qs[3] = { 0.50, 0.90, 0.99 };
+        double q_us[3];
+        uint64_t seen = 0;
+        int qi = 0;
+        for (int b = 0; b < HIST_BUCKETS && qi < 3; b++) {
+            seen += h->buckets[b];
+            while (qi < 3 && seen >= (uint64_t)(qs[qi] * count + 0.5) && seen) {
+                q_us[qi++] = hist_bucket_floor(b) * ns_per_tick / 1000;
+            }
+        }
+        while (qi < 3) q_us[qi++] = h->max * ns_per_tick / 1000;
+        size_t name_len = strlen(metric_names[op]);
+        ob_puts(ob, metric_names[op]);
+        ob_write(ob, pad, name_len < 24 ? 24 - name_len : 1);
+        char num[MONEY_MAX];
+        int len = 0;
+        for (uint64_t c = count; c; c /= 10) len++;
+        ob_write(ob, pad, len < 13 ? 13 - len : 1);
+        ob_int(ob, (long long)count);
+        double cols[5] = { h->total * ns_per_tick / 1000 / count, q_us[0], q_us[1], q_us[2], h->max * ns_per_tick / 1000 };
+        for (int i = 0; i < 5; i++) {
+            len = fmt_money(num, cols[i]);
+            ob_write(ob, pad, len < 11 ? 11 - len : 1);
+            ob_write(ob, num, len);
+        }
+        ob_putc(ob, '\n');
+    }
+#endif
+    ob_flush(ob);
+}
+
+/* menu option 27 */
+void metrics_dump_fd(int fd) {
+    OutBuf ob;
+    Histogram h;
+    metrics_dump(&ob, &h, fd);
+}
+
+void metrics_signal_handler(int sig) {
+    static OutBuf ob; // the handler's own (SIGUSR1 is blocked while it runs)
+    static Histogram h;
+    (void)sig;
+    int saved = errno;
+    metrics_dump(&ob, &h, STDERR_FILENO);
+    errno = saved;
+}
+
+/* microseconds with three decimals, as the trace format expects */
+void ob_trace_us(OutBuf *ob, uint64_t ns) {
+    ob_int(ob, (long long)(ns / 1000));
+    char frac[4] = { '.', (char)('0' + ns / 100 % 10), (char)('0' + ns / 10 % 10), (char)('0' + ns % 10) };
+    ob_write(ob, frac, 4);
+}
+
+/* stops tracing and writes every ring as Chrome trace-event JSON;
+   returns the number of events written, -1 on error */
+long trace_stop(const char *filename) {
+    trace_quiesce();
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("Error opening trace file");
+        return -1;
+    }
+    OutBuf *ob = malloc(sizeof(OutBuf));
+    if (!ob) {
+        close(fd);
+        return -1;
+    }
+    ob->fd = fd;
+    ob->error = 0;
+    ob->len = 0;
+    long written = 0;
+    uint64_t dropped = 0;
+    ob_puts(ob, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [");
+    pthread_mutex_lock(&trace_lock);
+    for (TraceRing *r = trace_rings; r; r = r->next) {
+        ob_puts(ob, written ? ",\n" : "\n");
+        ob_puts(ob, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": ");
+        ob_int(ob, r->tid);
+        ob_puts(ob, ", \"args\": {\"name\": \"");
+        ob_puts(ob, r->tid == 1 ? "main" : "worker ");
+        if (r->tid != 1) ob_int(ob, r->tid);
+        ob_puts(ob, "\"}}");
+        written++;
+        uint64_t first = r->head > TRACE_RING_CAP ? r->head - TRACE_RING_CAP : 0;
+        dropped += first;
+        for (uint64_t i = first; i < r->head; i++) {
+            TraceEvent *e = &r->events[i % TRACE_RING_CAP];
+            if (e->start_ns < trace_ns0) continue;
+            ob_puts(ob, ",\n{\"name\": ");
+            ob_json_str(ob, e->name);
+            ob_puts(ob, ", \"ph\": \"X\", \"pid\": 1, \"tid\": ");
+            ob_int(ob, r->tid);
+            ob_puts(ob, ", \"ts\": ");
+            ob_trace_us(ob, e->start_ns - trace_ns0);
+            ob_puts(ob, ", \"dur\": ");
+            ob_trace_us(ob, e->dur_ns);
+            if (e->nargs) {
+                ob_puts(ob, ", \"args\": {");
+                for (int k = 0; k < e->nargs; k++) {
+                    if (k) ob_puts(ob, ", ");
+                    ob_json_str(ob, e->arg_names[k]);
+                    ob_puts(ob, ": ");
+                    ob_int(ob, e->args[k]);
+                }
+                ob_putc(ob, '}');
+            }
+            ob_putc(ob, '}');
+            written++;
+        }
+    }
+    pthread_mutex_unlock(&trace_lock);
+    ob_puts(ob, "\n]}\n");
+    ob_flush(ob);
+    int ok = !ob->error;
+    free(ob);
+    if (close(fd) != 0) ok = 0;
+    if (!ok) {
+        perror("Error writing trace");
+        return -1;
+    }
+    if (dropped) printf("Trace rings wrapped; %llu oldest events dropped.\n", (unsigned long long)dropped);
+    return written;
+}
+
+/* ------------------------------
+   Import (finance_buddy_data.json from the web app)
+   Two stages: a SIMD pass indexes every structural character and quote,
+   then a small parser walks that index. Web app string uids are mapped
+   to fresh integer account ids; nodes come from the pools.
+   ------------------------------*/
+/* bit i set where block[i] is one of {}[]:, / a quote / a backslash */
+void json_classify64(const char *block, uint64_t *structural, uint64_t *quote, uint64_t *bslash) {
+    uint64_t s = 0, q = 0, b = 0;
+#if defined(__SSE2__)
+    for (int k = 0; k < 4; k++) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(block + 16 * k));
+        __m128i lo = _mm_or_si128(v, _mm_set1_epi8(0x20)); // '[' ']' fold onto '{' '}'
+        __m128i st = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(lo, _mm_set1_epi8('{')), _mm_cmpeq_epi8(lo, _mm_set1_epi8('}'))),
+            _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(':')), _mm_cmpeq_epi8(v, _mm_set1_epi8(','))));
+        s |= (uint64_t)(uint16_t)_mm_movemask_epi8(st) << (16 * k);
+        q |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('"'))) << (16 * k);
+        b |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))) << (16 * k);
+    }
+#else
+    for (int i = 0; i < 64; i++) {
+        char c = block[i];
+        if (c == '{' || c == '}' || c == '[' || c == ']' || c == ':' || c == ',') s |= 1ULL << i;
+        else if (c == '"') q |= 1ULL << i;
+        else if (c == '\\') b |= 1ULL << i;
+    }
+#endif
+    *structural = s;
+    *quote = q;
+    *bslash = b;
+}
+
+/* stage 1: offsets of structural characters outside strings plus every
+   unescaped quote. *out grows as needed. Returns the count, or
+   (size_t)-1 when out of memory. */
+size_t json_index(const char *buf, size_t len, uint32_t **out, size_t *cap) {
+    size_t n = 0;
+    uint64_t in_string = 0;   // all ones when the previous block ended inside a string
+    int pending_escape = 0;   // previous block ended with an unescaped backslash
+    for (size_t base = 0; base < len; base += 64) {
+        char pad[64];
+        const char *block = buf + base;
+        if (len - base < 64) {
+            memset(pad, ' ', sizeof(pad));
+            memcpy(pad, block, len - base);
+            block = pad;
+        }
+        uint64_t s, q, b;
+        json_classify64(block, &s, &q, &b);
+        if (b || pending_escape) {
+            uint64_t escaped = 0;
+            for (int i = 0; i < 64; i++) {
+                if (pending_escape) { escaped |= 1ULL << i; pending_escape = 0; }
+                else if (b >> i & 1) pending_escape = 1;
+            }
+            q &= ~escaped;
+        }
+        // prefix xor: bit i set when an odd number of quotes precede/at i
+        uint64_t inside = q;
+        inside ^= inside << 1;
+        inside ^= inside << 2;
+        inside ^= inside << 4;
+        inside ^= inside << 8;
+        inside ^= inside << 16;
+        inside ^= inside << 32;
+        inside ^= in_string;
+        in_string = (inside >> 63) ? ~0ULL : 0;
+        uint64_t m = (s & ~inside) | q;
+        if (n + 64 > *cap) {
+            size_t ncap = *cap * 2 + 1024;
+            uint32_t *np = mem_realloc(MEM_IMPORT, *out, (*cap + 1) * sizeof(uint32_t), (ncap + 1) * sizeof(uint32_t));
+            if (!np) return (size_t)-1;
+            *out = np;
+            *cap = ncap;
+        }
+        while (m) {
+            (*out)[n++] = (uint32_t)(base + __builtin_ctzll(m));
+            m &= m - 1;
+        }
+    }
+    return n;
+}
+
+typedef struct JsonCursor {
+    const char *buf;
+    const uint32_t *pos;
+    size_t n;
+    size_t i;
+    int error;
+} JsonCursor;
+
+char jc_peek(JsonCursor *c) {
+    return c->i < c->n ? c->buf[c->pos[c->i]] : '\0';
+}
+
+int jc_expect(JsonCursor *c, char ch) {
+    if (jc_peek(c) != ch) { c->error = 1; return 0; }
+    c->i++;
+    return 1;
+}
+
+/* string token: raw (still escaped) bytes between the quotes */
+int jc_string(JsonCursor *c, const char **s, size_t *len) {
+    if (jc_peek(c) != '"' || c->i + 1 >= c->n) { c->error = 1; return 0; }
+    *s = c->buf + c->pos[c->i] + 1;
+    *len = c->pos[c->i + 1] - c->pos[c->i] - 1;
+    c->i += 2;
+    return 1;
+}
+
+/* number/true/false/null: the bytes between the previous structural and
+   the next one. Consumes nothing. */
+const char *jc_scalar(JsonCursor *c) {
+    if (c->i == 0 || c->i >= c->n) { c->error = 1; return ""; }
+    const char *p = c->buf + c->pos[c->i - 1] + 1;
+    while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r') p++;
+    return p;
+}
+
+void jc_skip(JsonCursor *c) {
+    char ch = jc_peek(c);
+    if (ch == '"') {
+        c->i += 2;
+    } else if (ch == '{' || ch == '[') {
+        int depth = 0;
+        do {
+            ch = jc_peek(c);
+            if (ch == '"') { c->i += 2; continue; }
+            if (ch == '{' || ch == '[') depth++;
+            else if (ch == '}' || ch == ']') depth--;
+            else if (!ch) { c->error = 1; return; }
+            c->i++;
+        } while (depth > 0);
+    }
+}
+
+/* object/array iteration: call after the opening bracket was consumed.
+   Returns 1 while there is another member, 0 at the closing bracket. */
+int jc_next(JsonCursor *c, char close, int *first) {
+    if (c->error) return 0;
+    char ch = jc_peek(c);
+    if (ch == close) { c->i++; return 0; }
+    if (!*first) {
+        if (ch != ',') { c->error = 1; return 0; }
+        c->i++;
+    }
+    *first = 0;
+    return 1;
+}
+
+int jc_key_is(const char *k, size_t klen, const char *want) {
+    return strlen(want) == klen && memcmp(k, want, klen) == 0;
+}
+
+int json_is_null(const char *p) {
+    return strncmp(p, "null", 4) == 0;
+}
+
+/* copy a JSON string body into dst, resolving escapes, always terminated */
+void json_unescape(char *dst, size_t cap, const char *s, size_t len) {
+    size_t o = 0;
+    for (size_t i = 0; i < len && o + 1 < cap; i++) {
+        char ch = s[i];
+        if (ch != '\\' || i + 1 >= len) { dst[o++] = ch; continue; }
+        ch = s[++i];
+        switch (ch) {
+        case 'n': dst[o++] = '\n'; break;
+        case 't': dst[o++] = '\t'; break;
+        case 'r': dst[o++] = '\r'; break;
+        case 'b': dst[o++] = '\b'; break;
+        case 'f': dst[o++] = '\f'; break;
+        case 'u': {
+            unsigned cp = 0;
+            if (i + 4 >= len) { i = len; break; }
+            for (int k = 1; k <= 4; k++) {
+                char h = s[i + k];
+                cp = cp * 16 + (unsigned)(h <= '9' ? h - '0' : (h | 0x20) - 'a' + 10);
+            }
+            i += 4;
+            if (cp >= 0xD800 && cp < 0xDC00 && i + 6 < len && s[i + 1] == '\\' && s[i + 2] == 'u') {
+                unsigned lo = 0;
+                for (int k = 3; k <= 6; k++) {
+                    char h = s[i + k];
+                    lo = lo * 16 + (unsigned)(h <= '9' ? h - '0' : (h | 0x20) - 'a' + 10);
+                }
+                cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                i += 6;
+            }
+            char u[4]; int un;
+            if (cp < 0x80) { u[0] = (char)cp; un = 1; }
+            else if (cp < 0x800) { u[0] = (char)(0xC0 | cp >> 6); u[1] = (char)(0x80 | (cp & 63)); un = 2; }
+            else if (cp < 0x10000) { u[0] = (char)(0xE0 | cp >> 12); u[1] = (char)(0x80 | (cp >> 6 & 63)); u[2] = (char)(0x80 | (cp & 63)); un = 3; }
+            else { u[0] = (char)(0xF0 | cp >> 18); u[1] = (char)(0x80 | (cp >> 12 & 63)); u[2] = (char)(0x80 | (cp >> 6 & 63)); u[3] = (char)(0x80 | (cp & 63)); un = 4; }
+            if (o + un + 1 > cap) { i = len; break; }
+            memcpy(dst + o, u, un);
+            o += un;
+            break;
+        }
+        default: dst[o++] = ch; // \" \\ \/
+        }
+    }
+    dst[o] = '\0';
+}
+
+/* web uid -> integer account id. Keys point into the input buffer.
+   Entries stay where they were added, so an entry's index (which pending
+   transfers hold until the fixup pass) survives the hash table growing. */
+typedef struct UidEntry {
+    const char *key;
+    size_t len;
+    int acc_id; // 0 until the account itself is seen
+} UidEntry;
+
+typedef struct UidMap {
+    UidEntry *entries;  // in the order first seen
+    size_t count, entries_cap;
+    uint32_t *slots;    // open addressing: entry index + 1, 0 = empty
+    size_t cap;         // power of two
+} UidMap;
+
+uint64_t hash_bytes(const char *s, size_t len) {
+    uint64_t h = 1469598103934665603ULL; // FNV-1a
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/* index of the entry for key, inserting it if new; -1 on allocation failure.
+   The index never changes once handed out. */
+long uid_map_slot(UidMap *m, const char *key, size_t len) {
+    if ((m->count + 1) * 2 > m->cap) {
+        size_t ncap = m->cap ? m->cap * 2 : 1024;
+        uint32_t *ns = mem_calloc(MEM_IMPORT, ncap, sizeof(uint32_t));
+        if (!ns) return -1;
+        for (size_t e = 0; e < m->count; e++) {
+            size_t j = hash_bytes(m->entries[e].key, m->entries[e].len) & (ncap - 1);
+            while (ns[j]) j = (j + 1) & (ncap - 1);
+            ns[j] = (uint32_t)(e + 1);
+        }
+        mem_free(MEM_IMPORT, m->slots, m->cap * sizeof(uint32_t));
+        m->slots = ns;
+        m->cap = ncap;
+    }
+    size_t j = hash_bytes(key, len) & (m->cap - 1);
+    while (m->slots[j]) {
+        UidEntry *e = &m->entries[m->slots[j] - 1];
+        if (e->len == len && memcmp(e->key, key, len) == 0) return (long)(m->slots[j] - 1);
+        j = (j + 1) & (m->cap - 1);
+    }
+    if (m->count == m->entries_cap) {
+        size_t ncap = m->entries_cap ? m->entries_cap * 2 : 512;
+        UidEntry *ne = mem_realloc(MEM_IMPORT, m->entries, m->entries_cap * sizeof(UidEntry), ncap * sizeof(UidEntry));
+        if (!ne) return -1;
+        m->entries = ne;
+        m->entries_cap = ncap;
+    }
+    m->entries[m->count] = (UidEntry){ key, len, 0 };
+    m->slots[j] = (uint32_t)(++m->count);
+    return (long)(m->count - 1);
+}
+
+/* the web app writes ids as strings, but accept bare numbers too */
+int jc_id(JsonCursor *c, const char **s, size_t *len) {
+    if (jc_peek(c) == '"') return jc_string(c, s, len);
+    const char *p = jc_scalar(c);
+    if (json_is_null(p)) return 0;
+    *s = p;
+    *len = 0;
+    while (p[*len] && strchr(" \t\r\n,}]", p[*len]) == NULL) (*len)++;
+    return *len > 0;
+}
+
+/* up to max digits at *p as a number, -1 if none */
+int ts_digits(const char **p, int max) {
+    int v = 0, n = 0;
+    while (n < max && **p >= '0' && **p <= '9') v = v * 10 + (*(*p)++ - '0'), n++;
+    return n ? v : -1;
+}
+
+/* v as w digits, zero padded */
+char *ts_put(char *p, int v, int w) {
+    for (int i = w - 1; i >= 0; i--, v /= 10) p[i] = (char)('0' + v % 10);
+    return p + w;
+}
+
+/* the web app stamps with toLocaleString(): "16/10/2026, 8:56:10 pm" and
+   its locale variants. Writes "YYYY-MM-DD HH:MM:SS" to out (32 bytes);
+   0 if s is not a date. Day first unless a field rules it out (the app is
+   an en-IN build); year-first and ledger-format stamps pass through. */
+int import_parse_ts(const char *s, char *out) {
+    int y, mo, d, h = 0, mi = 0, sec = 0;
+    while (*s == ' ') s++;
+    int a = ts_digits(&s, 4);
+    char sep = *s;
+    if (a < 0 || !strchr("/.-", sep) || !sep) return 0;
+    s++;
+    int b = ts_digits(&s, 2);
+    if (b < 0 || *s++ != sep) return 0;
+    int c = ts_digits(&s, 4);
+    if (c < 0) return 0;
+    if (a >= 1000) { y = a; mo = b; d = c; } // 2026-10-16, 2026/10/16
+    else if (a > 12 || b <= 12) { d = a; mo = b; y = c; }
+    else { mo = a; d = b; y = c; }
+    while (*s == ',' || *s == ' ' || *s == 'T') s++;
+    if (*s) {
+        if ((h = ts_digits(&s, 2)) < 0 || *s++ != ':' || (mi = ts_digits(&s, 2)) < 0) return 0;
+        if (*s == ':' && (s++, (sec = ts_digits(&s, 2)) < 0)) return 0;
+        while (*s && !isalpha((unsigned char)*s)) s++; // spaces, U+202F before "PM"
+        int pm = tolower((unsigned char)*s) == 'p';
+        if (pm || tolower((unsigned char)*s) == 'a') {
+            if (h < 1 || h > 12) return 0;
+            h = h % 12 + (pm ? 12 : 0);
+            s++;
+            if (*s == '.') s++;
+            if (tolower((unsigned char)*s) != 'm') return 0;
+            s++;
+            if (*s == '.') s++;
+        }
+        while (*s == ' ') s++;
+        if (*s) return 0;
+    }
+    if (y < 1000 || mo < 1 || mo > 12 || d < 1 || d > 31 || h > 23 || mi > 59 || sec > 60) return 0;
+    char *p = out; // "%04d-%02d-%02d %02d:%02d:%02d" without the printf cost
+    p = ts_put(p, y, 4); *p++ = '-';
+    p = ts_put(p, mo, 2); *p++ = '-';
+    p = ts_put(p, d, 2); *p++ = ' ';
+    p = ts_put(p, h, 2); *p++ = ':';
+    p = ts_put(p, mi, 2); *p++ = ':';
+    p = ts_put(p, sec, 2); *p = '\0';
+    return 1;
+}
+
+/* one transaction object; to_id is left as -(uid entry + 1) for the fixup pass */
+Transaction *import_transaction(JsonCursor *c, UidMap *m) {
+    Transaction *t = pool_alloc(&tx_pool);
+    if (!t) { c->error = 1; return NULL; }
+    memset(t, 0, sizeof(*t));
+    strcpy(t->type, "DEPOSIT");
+    if (!jc_expect(c, '{')) return t;
+    int first = 1;
+    while (jc_next(c, '}', &first)) {
+        const char *k; size_t klen;
+        if (!jc_string(c, &k, &klen) || !jc_expect(c, ':')) break;
+        if (jc_key_is(k, klen, "type") && jc_peek(c) == '"') {
+            const char *v; size_t vlen;
+            jc_string(c, &v, &vlen);
+            json_unescape(t->type, sizeof(t->type), v, vlen);
+            for (char *p = t->type; *p; p++)
+                if (*p >= 'a' && *p <= 'z') *p = (char)(*p - 32);
+        } else if (jc_key_is(k, klen, "amount") && jc_peek(c) != '"') {
+            t->amount = strtod(jc_scalar(c), NULL);
+        } else if (jc_key_is(k, klen, "to_id")) {
+            const char *v; size_t vlen;
+            if (jc_id(c, &v, &vlen)) {
+                long slot = uid_map_slot(m, v, vlen);
+                if (slot < 0) { c->error = 1; break; }
+                t->to_account = (int)(-slot - 1);
+            }
+        } else if (jc_key_is(k, klen, "ts") && jc_peek(c) == '"') {
+            const char *v; size_t vlen;
+            jc_string(c, &v, &vlen);
+            json_unescape(t->timestamp, sizeof(t->timestamp), v, vlen);
+        } else if (jc_key_is(k, klen, "category") && jc_peek(c) == '"') {
+            const char *v; size_t vlen;
+            char name[32];
+            jc_string(c, &v, &vlen);
+            json_unescape(name, sizeof(name), v, vlen);
+            t->category = category_from_name(name);
+        } else {
+            jc_skip(c);
+        }
+    }
+    // the ledger compares stamps as strings: normalise, or stamp now and
+    // keep what the file said after it
+    char stamp[32];
+    if (import_parse_ts(t->timestamp, stamp)) {
+        memcpy(t->timestamp, stamp, sizeof(stamp));
+    } else if (strncmp(t->timestamp + 19, " (", 2) == 0 && memchr(t->timestamp, 0, 19) == NULL &&
+               (memcpy(stamp, t->timestamp, 19), stamp[19] = '\0', import_parse_ts(stamp, stamp))) {
+        // one of ours, already annotated: as it is
+    } else {
+        char orig[sizeof(t->timestamp)];
+        memcpy(orig, t->timestamp, sizeof(orig));
+        for (char *p = orig; *p; p++)
+            if (*p == '|' || (unsigned char)*p < 0x20) *p = ' '; // keep the TX line intact
+        current_time_str(stamp, sizeof(stamp));
+        // cut to the room left after "YYYY-MM-DD HH:MM:SS (" and ")"
+        int room = (int)(sizeof(t->timestamp) - sizeof("YYYY-MM-DD HH:MM:SS ()"));
+        if (orig[0]) snprintf(t->timestamp, sizeof(t->timestamp), "%.19s (%.*s)", stamp, room, orig);
+        else memcpy(t->timestamp, stamp, sizeof(stamp));
+    }
+    // the web app files uncategorised expenses under Misc
+    if (strcmp(t->type, "WITHDRAW") == 0 && t->category == CAT_NONE) t->category = CAT_MISC;
+    else if (strcmp(t->type, "WITHDRAW") != 0) t->category = CAT_NONE;
+    t->id = next_tx_id++;
+    return t;
+}
+
+/* one goal object; returns 1 if a goal was added */
+int import_goal(JsonCursor *c) {
+    char name[64] = "Goal";
+    double target = 0, saved = 0;
+    int date = 0;
+    if (!jc_expect(c, '{')) return 0;
+    int first = 1;
+    while (jc_next(c, '}', &first)) {
+        const char *k; size_t klen;
+        if (!jc_string(c, &k, &klen) || !jc_expect(c, ':')) break;
+        const char *v; size_t vlen;
+        if (jc_key_is(k, klen, "name") && jc_peek(c) == '"') {
+            jc_string(c, &v, &vlen);
+            json_unescape(name, sizeof(name), v, vlen);
+        } else if (jc_key_is(k, klen, "target") && jc_peek(c) != '"') {
+            target = strtod(jc_scalar(c), NULL);
+        } else if (jc_key_is(k, klen, "saved") && jc_peek(c) != '"') {
+            saved = strtod(jc_scalar(c), NULL);
+        } else if (jc_key_is(k, klen, "targetDate") && jc_peek(c) == '"') {
+            char buf[32];
+            jc_string(c, &v, &vlen);
+            json_unescape(buf, sizeof(buf), v, vlen);
+            date = parse_goal_date(buf);
+        } else {
+            jc_skip(c);
+        }
+    }
+    if (c->error) return 0;
+    return goal_new(next_goal_id, name, target, saved, date) != NULL;
+}
+
+Account *import_account(JsonCursor *c, UidMap *m) {
+    Account *acc = account_new(next_account_id);
+    if (!acc) { c->error = 1; return NULL; }
+    next_account_id++;
+    Transaction *tail = NULL;
+    if (!jc_expect(c, '{')) return acc;
+    int first = 1;
+    while (jc_next(c, '}', &first)) {
+        const char *k; size_t klen;
+        if (!jc_string(c, &k, &klen) || !jc_expect(c, ':')) break;
+        if (jc_key_is(k, klen, "id")) {
+            const char *v; size_t vlen;
+            if (jc_id(c, &v, &vlen)) {
+                long slot = uid_map_slot(m, v, vlen);
+                if (slot < 0) { c->error = 1; break; }
+                m->entries[slot].acc_id = acc->id;
+            }
+        } else if (jc_key_is(k, klen, "name") && jc_peek(c) == '"') {
+            const char *v; size_t vlen;
+            jc_string(c, &v, &vlen);
+            json_unescape(acc->name, sizeof(acc->name), v, vlen);
+        } else if (jc_key_is(k, klen, "balance") && jc_peek(c) != '"') {
+            adjust_balance(acc, strtod(jc_scalar(c), NULL) - BALANCE(acc));
+        } else if (jc_key_is(k, klen, "savings") && jc_peek(c) != '"') {
+            acc->savings = strncmp(jc_scalar(c), "true", 4) == 0;
+        } else if (jc_key_is(k, klen, "transactions") && jc_peek(c) == '[') {
+            c->i++;
+            int tfirst = 1;
+            while (jc_next(c, ']', &tfirst)) {
+                Transaction *t = import_transaction(c, m);
+                if (!t) break;
+                // the web app keeps newest first, same as tx_head: append
+                if (tail) tail->next = t;
+                else acc->tx_head = t;
+                tail = t;
+            }
+        } else {
+            jc_skip(c);
+        }
+    }
+    return acc;
+}
+
+/* Imports accounts (with their transactions) and goals from a web app
+   export and adds them to the ledger under new ids. A malformed file adds
+   nothing. Returns number of accounts, -1 on error. */
+int import_json(const char *filename) {
+    COMMIT_SCOPE();
+    TRACE_SPAN("import_json");
+    double t0 = monotonic_seconds();
+    uint64_t span = trace_begin();
+    FILE *f = fopen(filename, "rb");
+    if (!f) {
+        perror("Error opening import file");
+        return -1;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (size < 0 || (unsigned long)size >= UINT32_MAX) {
+        printf("Import file too large.\n");
+        fclose(f);
+        return -1;
+    }
+    char *buf = mem_alloc(MEM_IMPORT, (size_t)size + 1);
+    if (!buf || fread(buf, 1, (size_t)size, f) != (size_t)size) {
+        printf("Could not read %s\n", filename);
+        mem_free(MEM_IMPORT, buf, (size_t)size + 1);
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+    buf[size] = '\0';
+    trace_end("import_json.read", span, size);
+
+    span = trace_begin();
+    size_t cap = (size_t)size / 8;
+    uint32_t *pos = mem_alloc(MEM_IMPORT, (cap + 1) * sizeof(uint32_t));
+    size_t n_pos = pos ? json_index(buf, (size_t)size, &pos, &cap) : (size_t)-1;
+    trace_end("import_json.index", span, (long long)n_pos);
+    if (n_pos == (size_t)-1) {
+        printf("Out of memory indexing %s\n", filename);
+        mem_free(MEM_IMPORT, pos, (cap + 1) * sizeof(uint32_t));
+        mem_free(MEM_IMPORT, buf, (size_t)size + 1);
+        return -1;
+    }
+    span = trace_begin();
+    JsonCursor c = { buf, pos, n_pos, 0, 0 };
+    UidMap m = { 0 };
+    Account *imported = NULL, *last = NULL;
+    int n_acc = 0, n_goals = 0;
+    long n_tx = 0;
+    int first_acc_id = next_account_id, first_tx_id = next_tx_id, first_goal_id = next_goal_id;
+
+    if (jc_expect(&c, '{')) {
+        int first = 1;
+        while (jc_next(&c, '}', &first)) {
+            const char *k; size_t klen;
+            if (!jc_string(&c, &k, &klen) || !jc_expect(&c, ':')) break;
+            if (jc_key_is(k, klen, "accounts") && jc_peek(&c) == '[') {
+                c.i++;
+                int afirst = 1;
+                while (jc_next(&c, ']', &afirst)) {
+                    Account *acc = import_account(&c, &m);
+                    if (!acc) break;
+                    acc->next = imported;
+                    imported = acc;
+                    if (!last) last = acc;
+                    n_acc++;
+                }
+            } else if (jc_key_is(k, klen, "goals") && jc_peek(&c) == '[') {
+                // goals do not reference accounts, so they can go in directly
+                c.i++;
+                int gfirst = 1;
+                while (jc_next(&c, ']', &gfirst)) n_goals += import_goal(&c);
+            } else {
+                jc_skip(&c);
+            }
+        }
+    }
+    trace_end("import_json.parse", span, n_acc);
+    if (c.error) {
+        printf("Malformed JSON in %s; nothing imported.\n", filename);
+        Account *a = imported;
+        while (a) {
+            Transaction *t = a->tx_head;
+            while (t) {
+                Transaction *tmp = t;
+                t = t->next;
+                epoch_retire_node(&tx_pool, tmp); // reachable through the map until now
+            }
+            Account *tmp = a;
+            a = a->next;
+            account_delete(tmp);
+        }
+        for (int id = first_goal_id; id < next_goal_id; id++)
+            if (find_goal(id)) goal_unregister(find_goal(id));
+        next_goal_id = first_goal_id;
+        n_acc = -1;
+        // account and transaction ids stay used (readers may have looked
+        // them up): followers skip the same ones
+        if (next_account_id != first_acc_id || next_tx_id != first_tx_id)
+            oplog_append("J|%d|%d", next_account_id, next_tx_id);
+    } else {
+        // resolve to_id references now that every account has its new id
+        for (Account *a = imported; a; a = a->next) {
+            for (Transaction *t = a->tx_head; t; t = t->next) {
+                if (t->to_account < 0) t->to_account = m.entries[-t->to_account - 1].acc_id;
+                category_apply(a, t);
+                stats_tx(t, 1);
+                n_tx++;
+            }
+            shm_mirror_account(a);
+        }
+        if (last) {
+            last->next = accounts_head;
+            PUBLISH(accounts_head, imported);
+        }
+        oplog_append("R");
+        double secs = monotonic_seconds() - t0;
+        printf("Imported %d accounts, %ld transactions, %d goals from %s (%.1f MB in %.3f s, %.1f MB/s)\n",
+               n_acc, n_tx, n_goals, filename, size / 1e6, secs, secs > 0 ? size / 1e6 / secs : 0.0);
+    }
+    mem_free(MEM_IMPORT, m.entries, m.entries_cap * sizeof(UidEntry));
+    mem_free(MEM_IMPORT, m.slots, m.cap * sizeof(uint32_t));
+    mem_free(MEM_IMPORT, pos, (cap + 1) * sizeof(uint32_t));
+    mem_free(MEM_IMPORT, buf, (size_t)size + 1);
+    return n_acc;
+}
+
+/* ------------------------------
+   Replication (leader/follower)
+   The primary listens on a Unix socket. Each follower that connects gets
+   its own sender thread, which first ships a snapshot:
+     SNAPSHOT|commit|next_account|next_tx|next_goal|next_sched|wheel_minute|bytes
+   followed by that many bytes in the save format, then streams operation
+   log records newer than the snapshot. The follower replays each record
+   through the same core functions on its own ledger (one writer thread),
+   so its read-only queries see a consistent, lock-free ledger. It answers
+     ACK|commit|applied|lag_sum_ns|lag_max_ns|total_assets|transactions
+   whenever it has drained its input, or RESYNC when a record cannot be
+   replayed (an undo of a step from before its snapshot). A bulk reload on
+   the primary (R) makes the sender ship a fresh snapshot. Row order is
+   rebuilt the way load_data builds it, so INTEREST transaction ids can be
+   numbered differently than on the primary; balances, transactions and
+   all other ids match.
+   ------------------------------*/
+#define REPL_MAX_FOLLOWERS 8
+
+typedef struct ReplFollower {
+    int fd;
+    int active;
+    pthread_t sender, acker;
+    uint64_t pos;          // next log offset to send
+    int resync;            // follower asked for a snapshot
+    int gaps_seen;         // oplog_gaps at the last snapshot
+    long snapshots;
+    long long bytes_sent;
+    // from the newest ACK
+    uint64_t acked;
+    long long applied, lag_sum_ns, lag_max_ns, transactions;
+    double total;
+} ReplFollower;
+
+ReplFollower repl_followers[REPL_MAX_FOLLOWERS];
+int repl_listen_fd = -1;
+int repl_stopping = 0;
+pthread_t repl_accept_thread;
+char repl_path[108];
+
+/* caller holds oplog_lock */
+uint64_t oplog_min_pos() {
+    uint64_t min = oplog_base + oplog_len;
+    for (int i = 0; i < REPL_MAX_FOLLOWERS; i++)
+        if (repl_followers[i].active && repl_followers[i].pos < min) min = repl_followers[i].pos;
+    return min;
+}
+
+/* like write_all, but a follower that hung up is an error, not SIGPIPE */
+int repl_send_all(int fd, const char *p, size_t n) {
+    while (n) {
+        ssize_t w = send(fd, p, n, MSG_NOSIGNAL);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return errno;
+        }
+        p += w;
+        n -= (size_t)w;
+    }
+    return 0;
+}
+
+/* returns the snapshot's commit clock (records below it are included),
+   0 on error */
+uint64_t repl_send_snapshot(ReplFollower *rf) {
+    Snapshot *s = snapshot_open();
+    while (!s && !repl_stopping) {
+        sched_yield();
+        s = snapshot_open();
+    }
+    if (!s) return 0;
+    char *body = NULL;
+    size_t len = 0;
+    FILE *m = open_memstream(&body, &len);
+    int ok = m && save_snapshot(m, s);
+    if (m) fclose(m);
+    char head[192];
+    int n = snprintf(head, sizeof(head), "SNAPSHOT|%llu|%d|%d|%d|%d|%lld|%zu\n", (unsigned long long)(s->snap - 1),
+                     s->next_account_id, s->next_tx_id, s->next_goal_id, s->next_sched_id, (long long)s->sched_now, len);
+    uint64_t snap = s->snap;
+    snapshot_close(s);
+    ok = ok && !repl_send_all(rf->fd, head, n) && !repl_send_all(rf->fd, body, len);
+    free(body);
+    if (!ok) return 0;
+    rf->snapshots++;
+    rf->bytes_sent += n + len;
+    return snap;
+}
+
+void *repl_sender_main(void *arg) {
+    ReplFollower *rf = arg;
+    char *chunk = NULL;
+    size_t chunk_cap = 0;
+    pthread_mutex_lock(&oplog_lock);
+    rf->gaps_seen = oplog_gaps;
+    pthread_mutex_unlock(&oplog_lock);
+    uint64_t skip_below = repl_send_snapshot(rf);
+    while (skip_below && !repl_stopping) {
+        pthread_mutex_lock(&oplog_lock);
+        while (!repl_stopping && rf->pos == oplog_base + oplog_len && !rf->resync && rf->gaps_seen == oplog_gaps)
+            pthread_cond_wait(&oplog_grew, &oplog_lock);
+        int fresh = rf->resync || rf->gaps_seen != oplog_gaps;
+        size_t n = 0;
+        if (fresh) { // whatever is logged now is covered by the new snapshot
+            rf->resync = 0;
+            rf->gaps_seen = oplog_gaps;
+            rf->pos = oplog_base + oplog_len;
+        } else {
+            if (rf->pos < oplog_base) rf->pos = oplog_base; // cannot happen while active
+            n = (size_t)(oplog_base + oplog_len - rf->pos);
+            const char *from = oplog_buf + (rf->pos - oplog_base);
+            if (n > chunk_cap) {
+                char *nc = realloc(chunk, n);
+                if (nc) {
+                    chunk = nc;
+                    chunk_cap = n;
+                } else { // the whole records that fit; a snapshot if not even one does
+                    n = chunk_cap;
+                    while (n && from[n - 1] != '\n') n--;
+                    if (!n) rf->resync = 1;
+                }
+            }
+            if (n) memcpy(chunk, from, n);
+            rf->pos += n;
+        }
+        pthread_mutex_unlock(&oplog_lock);
+        if (repl_stopping) break;
+        if (fresh) {
+            skip_below = repl_send_snapshot(rf);
+            continue;
+        }
+        // send record by record up to an R, which restarts from a snapshot
+        char *p = chunk, *end = chunk + n, *run = chunk;
+        while (p < end && skip_below) {
+            char *nl = memchr(p, '\n', end - p);
+            char *next = nl ? nl + 1 : end;
+            char *op = p;
+            for (int bars = 0; bars < 3 && op < next; op++) bars += *op == '|';
+            uint64_t commit = strtoull(p, NULL, 10);
+            if (commit < skip_below || *op == 'R') {
+                if (p > run && repl_send_all(rf->fd, run, p - run)) skip_below = 0;
+                else rf->bytes_sent += p - run;
+                if (skip_below && *op == 'R' && commit >= skip_below) skip_below = repl_send_snapshot(rf);
+                run = next;
+            }
+            p = next;
+        }
+        if (skip_below && end > run) {
+            if (repl_send_all(rf->fd, run, end - run)) skip_below = 0;
+            else rf->bytes_sent += end - run;
+        }
+    }
+    free(chunk);
+    shutdown(rf->fd, SHUT_RDWR); // wakes the ack reader
+    pthread_mutex_lock(&oplog_lock);
+    rf->active = 0; // stop holding back log trimming
+    pthread_mutex_unlock(&oplog_lock);
+    return NULL;
+}
+
+void *repl_acker_main(void *arg) {
+    ReplFollower *rf = arg;
+    char buf[4096];
+    size_t len = 0;
+    for (;;) {
+        ssize_t r = read(rf->fd, buf + len, sizeof(buf) - 1 - len);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) break;
+        len += (size_t)r;
+        buf[len] = '\0';
+        char *line = buf, *nl;
+        while ((nl = strchr(line, '\n'))) {
+            *nl = '\0';
+            unsigned long long acked;
+            long long applied, lag_sum, lag_max, txs;
+            double total;
+            if (sscanf(line, "ACK|%llu|%lld|%lld|%lld|%lf|%lld", &acked, &applied, &lag_sum, &lag_max, &total, &txs) == 6) {
+                rf->applied = applied;
+                rf->lag_sum_ns = lag_sum;
+                rf->lag_max_ns = lag_max;
+                rf->total = total;
+                rf->transactions = txs;
+                __atomic_store_n(&rf->acked, acked, __ATOMIC_RELEASE);
+            } else if (strcmp(line, "RESYNC") == 0) {
+                pthread_mutex_lock(&oplog_lock);
+                rf->resync = 1;
+                pthread_cond_broadcast(&oplog_grew);
+                pthread_mutex_unlock(&oplog_lock);
+            }
+            line = nl + 1;
+        }
+        len -= (size_t)(line - buf);
+        memmove(buf, line, len);
+        if (len == sizeof(buf) - 1) len = 0; // no newline in a full buffer: garbage
+    }
+    // the sender may be waiting for records; let it see the hang-up
+    pthread_mutex_lock(&oplog_lock);
+    rf->resync = 1;
+    pthread_cond_broadcast(&oplog_grew);
+    pthread_mutex_unlock(&oplog_lock);
+    return NULL;
+}
+
+void *repl_accept_main(void *arg) {
+    (void)arg;
+    while (!repl_stopping) {
+        int fd = accept(repl_listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            break; // listener shut down
+        }
+        for (int i = 0; i < REPL_MAX_FOLLOWERS; i++) { // reap followers that hung up
+            ReplFollower *old = &repl_followers[i];
+            if (old->fd && !__atomic_load_n(&old->active, __ATOMIC_ACQUIRE)) {
+                pthread_join(old->sender, NULL);
+                pthread_join(old->acker, NULL);
+                close(old->fd);
+                old->fd = 0;
+            }
+        }
+        ReplFollower *rf = NULL;
+        pthread_mutex_lock(&oplog_lock);
+        for (int i = 0; i < REPL_MAX_FOLLOWERS && !rf; i++)
+            if (!repl_followers[i].active && !repl_followers[i].fd) rf = &repl_followers[i];
+        if (rf) {
+            memset(rf, 0, sizeof(*rf));
+            rf->fd = fd;
+            rf->active = 1;
+            rf->pos = oplog_base + oplog_len;
+        }
+        pthread_mutex_unlock(&oplog_lock);
+        if (!rf) { close(fd); continue; }
+        if (pthread_create(&rf->sender, NULL, repl_sender_main, rf) != 0) {
+            pthread_mutex_lock(&oplog_lock);
+            rf->active = 0;
+            pthread_mutex_unlock(&oplog_lock);
+            close(fd);
+            rf->fd = 0;
+            continue;
+        }
+        if (pthread_create(&rf->acker, NULL, repl_acker_main, rf) != 0) {
+            shutdown(fd, SHUT_RDWR);
+            pthread_join(rf->sender, NULL);
+            pthread_mutex_lock(&oplog_lock);
+            rf->active = 0;
+            pthread_mutex_unlock(&oplog_lock);
+            close(fd);
+            rf->fd = 0;
+        }
+    }
+    return NULL;
+}
+
+/* starts logging and accepting followers on `path`; 1 ok, 0 error */
+int repl_serve(const char *path) {
+    if (repl_listen_fd >= 0) return 1;
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) return 0;
+    strcpy(addr.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return 0;
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, REPL_MAX_FOLLOWERS) < 0) {
+        close(fd);
+        return 0;
+    }
+    snprintf(repl_path, sizeof(repl_path), "%s", path);
+    repl_listen_fd = fd;
+    repl_stopping = 0;
+    {
+        COMMIT_SCOPE(); // no commit is half-logged when logging starts
+        oplog_enabled = 1;
+    }
+    if (pthread_create(&repl_accept_thread, NULL, repl_accept_main, NULL) != 0) {
+        oplog_enabled = 0;
+        close(fd);
+        unlink(path);
+        repl_listen_fd = -1;
+        return 0;
+    }
+    return 1;
+}
+
+/* disconnects every follower and stops logging */
+void repl_stop() {
+    if (repl_listen_fd < 0) return;
+    pthread_mutex_lock(&oplog_lock);
+    repl_stopping = 1;
+    pthread_cond_broadcast(&oplog_grew);
+    pthread_mutex_unlock(&oplog_lock);
+    shutdown(repl_listen_fd, SHUT_RDWR);
+    pthread_join(repl_accept_thread, NULL);
+    close(repl_listen_fd);
+    unlink(repl_path);
+    repl_listen_fd = -1;
+    for (int i = 0; i < REPL_MAX_FOLLOWERS; i++) {
+        ReplFollower *rf = &repl_followers[i];
+        if (!rf->fd) continue;
+        shutdown(rf->fd, SHUT_RDWR);
+        pthread_join(rf->sender, NULL);
+        pthread_join(rf->acker, NULL);
+        close(rf->fd);
+        rf->fd = 0;
+        rf->active = 0;
+    }
+    COMMIT_SCOPE();
+    oplog_enabled = 0;
+    pthread_mutex_lock(&oplog_lock);
+    mem_free(MEM_OPLOG, oplog_buf, oplog_cap);
+    oplog_buf = NULL;
+    oplog_len = oplog_cap = 0;
+    pthread_mutex_unlock(&oplog_lock);
+}
+
+/* every connected follower has applied everything logged so far */
+int repl_caught_up() {
+    uint64_t want = __atomic_load_n(&oplog_last_commit, __ATOMIC_ACQUIRE);
+    int any = 0;
+    for (int i = 0; i < REPL_MAX_FOLLOWERS; i++) {
+        ReplFollower *rf = &repl_followers[i];
+        if (!__atomic_load_n(&rf->active, __ATOMIC_ACQUIRE)) continue;
+        if (__atomic_load_n(&rf->acked, __ATOMIC_ACQUIRE) < want || !rf->snapshots) return 0;
+        any = 1;
+    }
+    return any;
+}
+
+int repl_follower_count() {
+    int n = 0;
+    for (int i = 0; i < REPL_MAX_FOLLOWERS; i++) n += repl_followers[i].active;
+    return n;
+}
+
+void show_repl_status() {
+    if (repl_listen_fd < 0) {
+        printf("Replication is off.\n");
+        return;
+    }
+    printf("Serving on %s, last logged commit %llu, log holds %zu bytes\n", repl_path,
+           (unsigned long long)oplog_last_commit, oplog_len);
+    int any = 0;
+    for (int i = 0; i < REPL_MAX_FOLLOWERS; i++) {
+        ReplFollower *rf = &repl_followers[i];
+        if (!rf->active) continue;
+        any = 1;
+        printf("  follower %d: acked commit %llu (%lld behind), %lld applied, lag avg %.1f us max %.1f us, "
+               "%ld snapshot(s), %.2f MB sent\n", i, (unsigned long long)rf->acked,
+               (long long)(oplog_last_commit > rf->acked ? oplog_last_commit - rf->acked : 0), rf->applied,
+               rf->applied ? rf->lag_sum_ns / 1e3 / rf->applied : 0, rf->lag_max_ns / 1e3, rf->snapshots,
+               rf->bytes_sent / 1048576.0);
+    }
+    if (!any) printf("  (no followers connected)\n");
+}
+
+/* ---- follower side ---- */
+
+typedef struct ReplReader {
+    int fd;
+    size_t start, end;
+    char buf[1 << 16];
+} ReplReader;
+
+typedef struct ReplFollowState {
+    int connected;
+    uint64_t commit;       // newest commit applied (or covered by the snapshot)
+    long long applied, lag_sum_ns, lag_max_ns;
+    long snapshots;
+} ReplFollowState;
+
+ReplFollowState repl_follow_state;
+
+/* next line without its newline, NULL at EOF; `idle` runs before any read
+   that may block */
+char *repl_read_line(ReplReader *r, void (*idle)(ReplReader *)) {
+    for (;;) {
+        char *nl = memchr(r->buf + r->start, '\n', r->end - r->start);
+        if (nl) {
+            *nl = '\0';
+            char *line = r->buf + r->start;
+            r->start = (size_t)(nl - r->buf) + 1;
+            return line;
+        }
+        if (r->start) {
+            memmove(r->buf, r->buf + r->start, r->end - r->start);
+            r->end -= r->start;
+            r->start = 0;
+        }
+        if (r->end == sizeof(r->buf)) return NULL; // a line longer than the buffer
+        if (idle) idle(r);
+        ssize_t n = read(r->fd, r->buf + r->end, sizeof(r->buf) - r->end);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return NULL;
+        r->end += (size_t)n;
+    }
+}
+
+/* copies `len` payload bytes to fd out; 0 on EOF */
+int repl_read_bytes(ReplReader *r, int out, size_t len) {
+    while (len) {
+        if (r->start == r->end) {
+            ssize_t n = read(r->fd, r->buf, sizeof(r->buf));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return 0;
+            r->start = 0;
+            r->end = (size_t)n;
+        }
+        size_t take = r->end - r->start < len ? r->end - r->start : len;
+        if (write_all(out, r->buf + r->start, take)) return 0;
+        r->start += take;
+        len -= take;
+    }
+    return 1;
+}
+
+void repl_send_ack(ReplReader *r) {
+    ReplFollowState *st = &repl_follow_state;
+    char line[192];
+    int n = snprintf(line, sizeof(line), "ACK|%llu|%lld|%lld|%lld|%.2f|%ld\n", (unsigned long long)st->commit,
+                     st->applied, st->lag_sum_ns, st->lag_max_ns, ledger_stats.total_assets, ledger_stats.transactions);
+    repl_send_all(r->fd, line, n);
+}
+
+/* SNAPSHOT header already parsed into h[]; replaces the whole ledger */
+int repl_load_snapshot(ReplReader *r, const long long *h) {
+    char path[] = "/tmp/fb_follow_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) return 0;
+    int ok = repl_read_bytes(r, fd, (size_t)h[6]);
+    close(fd);
+    if (ok) {
+        COMMIT_SCOPE();
+        ledger_clock = (time_t)(h[5] * 60); // the scheduler wheel starts where the primary's is
+        load_data(path);
+        ledger_clock = 0;
+        next_account_id = (int)h[1];
+        next_tx_id = (int)h[2];
+        next_goal_id = (int)h[3];
+        next_sched_id = (int)h[4];
+        while (undo_stack) free_undo_node(pop_undo()); // steps before the snapshot are not ours
+        repl_follow_state.commit = (uint64_t)h[0];
+        repl_follow_state.snapshots++;
+    }
+    unlink(path);
+    return ok;
+}
+
+/* one record; 0 when it cannot be replayed here (resync needed) */
+int repl_apply(char *rec) {
+    char *f[16];
+    int nf = 0, max = 16;
+    IdemKey key = { 0, 0 };
+    char *op_at = rec;
+    for (int bars = 0; bars < 3 && (op_at = strchr(op_at, '|')); bars++) op_at++;
+    if (op_at && strncmp(op_at, "Y|", 2) == 0) { // keyed: drop the key, keep it for after the replay
+        char *end;
+        key.hash = strtoull(op_at + 2, &end, 16);
+        if (*end == ':') key.check = strtoull(end + 1, &end, 16);
+        if (*end == '|') memmove(op_at, end + 1, strlen(end + 1) + 1);
+    }
+    for (char *p = rec; p && nf < max; ) {
+        f[nf++] = p;
+        if (nf == 4) max = *p == 'A' || *p == 'V' ? 6 : *p == 'G' ? 7 : 16; // a trailing name may hold '|'
+        if (nf == max) break;
+        char *bar = strchr(p, '|');
+        if (bar) *bar = '\0';
+        p = bar ? bar + 1 : NULL;
+    }
+    if (nf < 4) return 1; // not a record
+    uint64_t commit = strtoull(f[0], NULL, 10);
+    int64_t lag = monotonic_ns() - atoll(f[1]);
+    char op = *f[3];
+    ledger_clock = (time_t)atoll(f[2]);
+    int ok = 1, result = 0;
+    if (op == 'N' && nf > 4) {
+        char *end;
+        key.hash = strtoull(f[4], &end, 16);
+        if (*end == ':') key.check = strtoull(end + 1, NULL, 16);
+    }
+    if (key.hash) commit_begin(); // the mutation and its key in one commit, as on the primary
+    #define REPL_I(k) (nf > (k) ? atoi(f[k]) : 0)
+    #define REPL_D(k) (nf > (k) ? atof(f[k]) : 0)
+    switch (op) {
+    case 'A': create_account(nf > 5 ? f[5] : "", REPL_D(4)); break;
+    case 'V': open_account(nf > 5 ? f[5] : "", REPL_D(4), 1); break;
+    case 'D': result = deposit(REPL_I(4), REPL_D(5)); break;
+    case 'W': result = withdraw(REPL_I(4), REPL_D(5), REPL_I(6)); break;
+    case 'T': result = transfer_funds(REPL_I(4), REPL_I(5), REPL_D(6)); break;
+    case 'N': result = REPL_I(5); break;
+    case 'U': {
+        OpNode *top = undo_stack;
+        ok = top && nf > 7 && top->acc_id == REPL_I(4) && top->acc_id_to == REPL_I(5) &&
+             top->amount == REPL_D(6) && strcmp(top->op_type, f[7]) == 0;
+        if (ok && strcmp(top->op_type, "CREATE") == 0) // undo refuses while our readers hold snapshots
+            while (__atomic_load_n(&snapshot_count, __ATOMIC_ACQUIRE)) sched_yield();
+        if (ok) undo_last();
+        break;
+    }
+    case 'G': create_goal(nf > 6 ? f[6] : "", REPL_D(4), REPL_I(5)); break;
+    case 'C': contribute_goal(REPL_I(4), REPL_I(5), REPL_D(6)); break;
+    case 'X': delete_goal(REPL_I(4), REPL_I(5)); break;
+    case 'S': sched_add(REPL_I(4), REPL_I(5), REPL_I(6), REPL_I(7), REPL_D(8), REPL_I(9),
+                        nf > 10 ? atoll(f[10]) : 0, REPL_I(11), nf > 12 ? atoi(f[12]) : 0); break;
+    case 'K': cancel_schedule(REPL_I(4)); break;
+    case 'I': accrue_interest(REPL_D(4)); break;
+    case 'M': scheduler_advance(atoll(f[4])); break;
+    case 'L': velocity_set_limit(REPL_I(4), REPL_I(5), REPL_D(6)); break;
+    case 'J': // a failed import used these ids up
+        if (REPL_I(4) > next_account_id) next_account_id = REPL_I(4);
+        if (REPL_I(5) > next_tx_id) next_tx_id = REPL_I(5);
+        break;
+    default: ok = 0; // R or unknown: only a snapshot brings us level
+    }
+    #undef REPL_I
+    #undef REPL_D
+    if (key.hash) {
+        if (ok) idem_insert(key, result, ledger_time());
+        commit_end(NULL);
+    }
+    ledger_clock = 0;
+    if (!ok) return 0;
+    ReplFollowState *st = &repl_follow_state;
+    st->commit = commit;
+    st->applied++;
+    st->lag_sum_ns += lag;
+    if (lag > st->lag_max_ns) st->lag_max_ns = lag;
+    return 1;
+}
+
+/* connects to the primary (retrying for up to `wait_s` seconds) and applies
+   its stream until it hangs up; the calling thread is the ledger's writer.
+   Returns 0 if it never connected. */
+int repl_follow(const char *path, double wait_s) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) return 0;
+    strcpy(addr.sun_path, path);
+    int fd = -1;
+    double give_up = monotonic_seconds() + wait_s;
+    for (;;) {
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) return 0;
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) break;
+        close(fd);
+        if (monotonic_seconds() > give_up) return 0;
+        usleep(10000);
+    }
+    ReplReader *r = malloc(sizeof(ReplReader));
+    if (!r) { close(fd); return 0; }
+    r->fd = fd;
+    r->start = r->end = 0;
+    velocity_checks = 0; // the primary applied its limits before logging
+    tier_private("/tmp/fb_follow_history");
+    __atomic_store_n(&repl_follow_state.connected, 1, __ATOMIC_RELEASE);
+    int synced = 0; // records are skipped until a snapshot has loaded
+    char *line;
+    while ((line = repl_read_line(r, synced ? repl_send_ack : NULL))) {
+        long long h[7];
+        if (strncmp(line, "SNAPSHOT|", 9) == 0) {
+            if (sscanf(line + 9, "%lld|%lld|%lld|%lld|%lld|%lld|%lld", &h[0], &h[1], &h[2], &h[3], &h[4], &h[5], &h[6]) != 7 ||
+                !repl_load_snapshot(r, h))
+                break;
+            synced = 1;
+        } else if (synced && !repl_apply(line)) {
+            synced = 0;
+            repl_send_all(fd, "RESYNC\n", 7);
+        }
+    }
+    __atomic_store_n(&repl_follow_state.connected, 0, __ATOMIC_RELEASE);
+    close(fd);
+    free(r);
+    unlink(tier_path);
+    return 1;
+}
+
+void show_follow_status() {
+    ReplFollowState *st = &repl_follow_state;
+    printf("%s; at commit %llu, %lld records applied, lag avg %.1f us max %.1f us, %ld snapshot(s) loaded\n",
+           st->connected ? "Following the primary" : "Disconnected from the primary",
+           (unsigned long long)st->commit, st->applied, st->applied ? st->lag_sum_ns / 1e3 / st->applied : 0,
+           st->lag_max_ns / 1e3, st->snapshots);
+}
+
+/* ------------------------------
+   Loan engine (EMI / amortization)
+   Loans are stored column-wise (structure of arrays) so one month of the
+   schedule across many loans is a straight vector loop; the batch is split
+   across threads by loan range.
+   ------------------------------*/
+typedef struct LoanBatch {
+    size_t count;
+    double *principal;
+    double *monthly_rate;   // annual % / 1200
+    int *months;
+    double *emi;            // outputs
+    double *total_interest;
+} LoanBatch;
+
+/* all columns in one allocation; returns 0 on failure */
+int loan_batch_init(LoanBatch *b, size_t count) {
+    char *mem = malloc(count * (4 * sizeof(double) + sizeof(int)) + 1);
+    if (!mem) return 0;
+    b->count = count;
+    b->principal = (double *)mem;
+    b->monthly_rate = b->principal + count;
+    b->emi = b->monthly_rate + count;
+    b->total_interest = b->emi + count;
+    b->months = (int *)(b->total_interest + count);
+    return 1;
+}
+
+void loan_batch_free(LoanBatch *b) {
+    free(b->principal);
+    b->principal = NULL;
+    b->count = 0;
+}
+
+/* EMI = P r (1+r)^n / ((1+r)^n - 1), or P/n for an interest-free loan */
+double loan_emi(double principal, double monthly_rate, int months) {
+    if (months <= 0) return principal;
+    if (monthly_rate == 0) return principal / months;
+    double g = pow(1 + monthly_rate, months);
+    return principal * monthly_rate * g / (g - 1);
+}
+
+/* one month for n loans: interest on the open balance, the rest of the EMI
+   pays principal (never more than what is left) */
+void amortize_step(const double *rate, const double *emi, double *bal, size_t n,
+                   double *interest_out, double *principal_out, double *interest_sum) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    for (; i + 2 <= n; i += 2) {
+        __m128d b = _mm_loadu_pd(bal + i);
+        __m128d in = _mm_mul_pd(b, _mm_loadu_pd(rate + i));
+        __m128d pr = _mm_min_pd(_mm_sub_pd(_mm_loadu_pd(emi + i), in), b);
+        _mm_storeu_pd(bal + i, _mm_sub_pd(b, pr));
+        _mm_storeu_pd(interest_sum + i, _mm_add_pd(_mm_loadu_pd(interest_sum + i), in));
+        if (interest_out) _mm_storeu_pd(interest_out + i, in);
+        if (principal_out) _mm_storeu_pd(principal_out + i, pr);
+    }
+#endif
+    for (; i < n; i++) {
+        double in = bal[i] * rate[i];
+        double pr = emi[i] - in;
+        if (pr > bal[i]) pr = bal[i];
+        bal[i] -= pr;
+        interest_sum[i] += in;
+        if (interest_out) interest_out[i] = in;
+        if (principal_out) principal_out[i] = pr;
+    }
+}
+
+#define LOAN_BLOCK 256 // loans advanced together; their balances stay in L1
+
+/* Fills emi/total_interest for loans [first, first+count). If interest_out
+   and principal_out are given they receive the schedule month-major:
+   out[m * count + k] is month m+1 of loan first+k. */
+void loan_amortize_range(LoanBatch *b, size_t first, size_t count, int months,
+                         double *interest_out, double *principal_out) {
+    double bal[LOAN_BLOCK];
+    for (size_t i = first; i < first + count; i++) {
+        b->emi[i] = loan_emi(b->principal[i], b->monthly_rate[i], b->months[i]);
+        b->total_interest[i] = 0;
+    }
+    for (size_t blk = first; blk < first + count; blk += LOAN_BLOCK) {
+        size_t n = first + count - blk < LOAN_BLOCK ? first + count - blk : LOAN_BLOCK;
+        memcpy(bal, b->principal + blk, n * sizeof(double));
+        for (int m = 0; m < months; m++) {
+            size_t off = (size_t)m * count + (blk - first);
+            amortize_step(b->monthly_rate + blk, b->emi + blk, bal, n,
+                          interest_out ? interest_out + off : NULL,
+                          principal_out ? principal_out + off : NULL,
+                          b->total_interest + blk);
+        }
+    }
+}
+
+typedef struct LoanJob {
+    LoanBatch *batch;
+    int months;
+} LoanJob;
+
+void loan_job_range(void *ctx, size_t begin, size_t end) {
+    uint64_t span = trace_begin();
+    LoanJob *job = ctx;
+    loan_amortize_range(job->batch, begin, end - begin, job->months, NULL, NULL);
+    trace_end("loan.amortize", span, (long long)(end - begin));
+}
+
+/* EMI and total interest for every loan, months = longest term in the batch */
+void loan_batch_run(LoanBatch *b, int nthreads) {
+    LoanJob job = { b, 0 };
+    for (size_t i = 0; i < b->count; i++)
+        if (b->months[i] > job.months) job.months = b->months[i];
+    run_parallel(nthreads, b->count, LOAN_BLOCK, loan_job_range, &job);
+}
+
+/* the web app's calcLoan, plus the month-by-month split */
+void show_loan_schedule(double principal, double annual_rate, int years) {
+    LoanBatch b;
+    int months = years * 12;
+    if (months <= 0 || !loan_batch_init(&b, 1)) { printf("Invalid loan.\n"); return; }
+    double *interest = malloc(months * sizeof(double));
+    double *princ = malloc(months * sizeof(double));
+    if (!interest || !princ) {
+        printf("Out of memory.\n");
+    } else {
+        b.principal[0] = principal;
+        b.monthly_rate[0] = annual_rate / 1200;
+        b.months[0] = months;
+        loan_amortize_range(&b, 0, 1, months, interest, princ);
+        printf("EMI: %.2f  Total payment: %.2f  Total interest: %.2f\n",
+               b.emi[0], principal + b.total_interest[0], b.total_interest[0]);
+        printf("  Month   Interest   Principal     Balance\n");
+        double bal = principal;
+        for (int m = 0; m < months; m++) {
+            bal -= princ[m];
+            // first year, then yearly
+            if (m < 12 || (m + 1) % 12 == 0)
+                printf("  %5d %10.2f %11.2f %11.2f\n", m + 1, interest[m], princ[m], bal < 0.005 ? 0.0 : bal);
+        }
+    }
+    free(interest);
+    free(princ);
+    loan_batch_free(&b);
+}
+
+/* ------------------------------
+   Investment projection (Monte Carlo)
+   Each path draws monthly log-normal returns from a counter-based RNG keyed
+   by (seed, path, month), so any thread can produce any path and results
+   do not depend on how paths were split across threads.
+   ------------------------------*/
+typedef struct Projection {
+    double initial;
+    double monthly_contribution;
+    double annual_return;   // expected, e.g. 0.12
+    double volatility;      // annual standard deviation, 0 = fixed rate
+    int years;
+    int paths;
+    uint64_t seed;
+    double *values;         // [year * paths + path], value at end of year+1
+} Projection;
+
+uint64_t mix64(uint64_t x) {
+    x ^= x >> 30; x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27; x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+/* stateless: the same (seed, stream, counter) always gives the same bits */
+uint64_t rng_counter(uint64_t seed, uint64_t stream, uint64_t counter) {
+    return mix64(mix64(seed ^ (stream * 0x9e3779b97f4a7c15ULL)) + counter * 0xd1b54a32d192ed03ULL);
+}
+
+/* standard normal from one 64-bit draw (Box-Muller on its two halves) */
+double rng_normal(uint64_t bits) {
+    double u1 = ((bits >> 32) + 0.5) / 4294967296.0;
+    double u2 = ((bits & 0xffffffffULL) + 0.5) / 4294967296.0;
+    return sqrt(-2.0 * log(u1)) * cos(6.283185307179586 * u2);
+}
+
+void projection_paths(void *ctx, size_t begin, size_t end) {
+    TRACE_SPAN("projection.paths");
+    Projection *pr = ctx;
+    double mu = log1p(pr->annual_return) / 12;
+    double sigma = pr->volatility / sqrt(12.0);
+    double drift = mu - 0.5 * sigma * sigma;
+    double growth = exp(mu); // volatility 0: exactly (1+r)^(1/12)
+    for (size_t p = begin; p < end; p++) {
+        double v = pr->initial;
+        uint64_t counter = 0;
+        for (int y = 0; y < pr->years; y++) {
+            for (int m = 0; m < 12; m++) {
+                if (sigma > 0) v *= exp(drift + sigma * rng_normal(rng_counter(pr->seed, p, counter++)));
+                else v *= growth;
+                v += pr->monthly_contribution;
+            }
+            pr->values[(size_t)y * pr->paths + p] = v;
+        }
+    }
+}
+
+/* fills pr->values; returns 0 on allocation failure */
+int run_projection(Projection *pr, int nthreads) {
+    pr->values = malloc((size_t)pr->years * pr->paths * sizeof(double));
+    if (!pr->values) return 0;
+    run_parallel(nthreads, pr->paths, 64, projection_paths, pr);
+    return 1;
+}
+
+int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* percentile bands for one year; sorts that year's column in place */
+void projection_bands(Projection *pr, int year, const double *pcts, int npcts, double *out) {
+    double *col = pr->values + (size_t)year * pr->paths;
+    qsort(col, pr->paths, sizeof(double), cmp_double);
+    for (int i = 0; i < npcts; i++) {
+        size_t idx = (size_t)(pcts[i] / 100.0 * (pr->paths - 1) + 0.5);
+        out[i] = col[idx];
+    }
+}
+
+void show_projection(Projection *pr) {
+    static const double pcts[] = { 10, 25, 50, 75, 90 };
+    double band[5];
+    double t0 = monotonic_seconds();
+    if (!run_projection(pr, 0)) { printf("Out of memory.\n"); return; }
+    double secs = monotonic_seconds() - t0;
+    double invested = pr->initial;
+    printf("  Year   Invested        P10        P25        P50        P75        P90\n");
+    for (int y = 0; y < pr->years; y++) {
+        invested += pr->monthly_contribution * 12;
+        projection_bands(pr, y, pcts, 5, band);
+        printf("  %4d %10.0f %10.0f %10.0f %10.0f %10.0f %10.0f\n", y + 1, invested,
+               band[0], band[1], band[2], band[3], band[4]);
+    }
+    printf("%d paths x %d years in %.3f s (%.1f M path-years/s)\n", pr->paths, pr->years, secs,
+           secs > 0 ? (double)pr->paths * pr->years / secs / 1e6 : 0.0);
+    free(pr->values);
+    pr->values = NULL;
+}
+
+/* ------------------------------
+   UI helpers
+   ------------------------------*/
+/* ledger-wide figures straight off the balance column */
+void show_ledger_totals(double threshold) {
+    double lo, hi;
+    balance_min_max(&lo, &hi);
+    printf("Accounts: %d  Total balance: %.2f\n", account_rows, balance_sum());
+    printf("Lowest: %.2f  Highest: %.2f  Above %.2f: %d\n", lo, hi, threshold, balance_count_above(threshold));
+}
+
+/* O(1): everything is a running aggregate */
+void show_ledger_stats() {
+    printf("Accounts: %d  Transactions: %ld  Total assets: %.2f\n",
+           account_rows, ledger_stats.transactions, ledger_stats.total_assets);
+    printf("Today (%s): inflow %.2f  outflow %.2f\n",
+           ledger_stats.day[0] ? ledger_stats.day : "-", ledger_stats.inflow_today, ledger_stats.outflow_today);
+    long keys = idem_count();
+    if (keys || idem_hits)
+        printf("Idempotency keys: %ld held, %lld repeats answered, %lld dropped before %lds\n",
+               keys, idem_hits, idem_dropped_early, idem_window);
+    if (tier_age_days)
+        printf("History older than %d days on disk: %s, %lld bytes, %lld blocks read back\n",
+               tier_age_days, tier_path, (long long)tier_end, tier_blocks_read);
+}
+
+int stats_mismatch(const char *what, double running, double scanned) {
+    if (fabs(running - scanned) <= 0.005 + 1e-12 * fabs(scanned)) return 0;
+    printf("  MISMATCH %s: running %.2f, scan %.2f\n", what, running, scanned);
+    return 1;
+}
+
+/* counts t, and adds it to today's flows if it is from today */
+void stats_scan_tx(const Transaction *t, long *txs, double *inflow, double *outflow) {
+    (*txs)++;
+    if (strncmp(t->timestamp, ledger_stats.day, 10) != 0) return;
+    int undo, flow = tx_flow(t->type, &undo);
+    double amt = undo ? -t->amount : t->amount;
+    if (flow > 0) *inflow += amt;
+    else if (flow < 0) *outflow += amt;
+}
+
+/* recomputes every running aggregate by a full scan and reports any
+   disagreement; returns the number of mismatches */
+int check_ledger_stats() {
+    double assets = 0, inflow = 0, outflow = 0;
+    double cats[NUM_CATEGORIES];
+    long txs = 0;
+    int accounts = 0, bad = 0;
+    for (Account *a = accounts_head; a; a = a->next) {
+        accounts++;
+        assets += BALANCE(a);
+        ColdCursor c;
+        Transaction t;
+        int lazy = cold_open(&c, a);
+        for (Transaction *h = a->tx_head; h; h = h->next)
+            if (hot_tx_counts(lazy, h)) stats_scan_tx(h, &txs, &inflow, &outflow);
+        while (c.raw_left && cold_next(&c, &t)) stats_scan_tx(&t, &txs, &inflow, &outflow); // a lazy account's lines
+        cold_close(&c);
+        txs += a->cold_count; // older than a day, so nothing for today's flows
+    }
+    bad += stats_mismatch("accounts", account_rows, accounts);
+    bad += stats_mismatch("transactions", ledger_stats.transactions, txs);
+    bad += stats_mismatch("total assets", ledger_stats.total_assets, assets);
+    bad += stats_mismatch("column sum", balance_sum(), assets);
+    bad += stats_mismatch("inflow today", ledger_stats.inflow_today, inflow);
+    bad += stats_mismatch("outflow today", ledger_stats.outflow_today, outflow);
+    category_totals_scan(cats);
+    for (int c = 1; c < NUM_CATEGORIES; c++) bad += stats_mismatch(category_names[c], cat_spent_total[c], cats[c]);
+    printf(bad ? "Ledger stats: %d mismatch(es)\n" : "Ledger stats consistent.\n", bad);
+    return bad;
+}
+
+/* resident set size in bytes from /proc, -1 where that is unavailable */
+long long process_rss() {
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (!f) return -1;
+    long pages_total, pages_rss;
+    int ok = fscanf(f, "%ld %ld", &pages_total, &pages_rss) == 2;
+    fclose(f);
+    return ok ? (long long)pages_rss * sysconf(_SC_PAGESIZE) : -1;
+}
+
+/* bytes, objects, peak and pool overhead per subsystem, plus what the
+   ledger would need at 100M transactions with the current mix */
+void show_memory_report() {
+    const double MB = 1024.0 * 1024.0;
+    printf("%-14s %12s %11s %11s %11s %9s\n", "subsystem", "objects", "used_MB", "reserved_MB", "peak_MB", "overhead");
+    long long used = 0;
+    for (int t = 0; t < NUM_MEM_TAGS; t++) {
+        MemStats *m = &mem_stats[t];
+        used += m->used;
+        if (!m->peak) continue;
+        printf("%-14s %12lld %11.2f %11.2f %11.2f %8.1f%%\n", mem_tag_names[t], m->objects, m->used / MB,
+               m->reserved / MB, m->peak / MB, m->reserved ? 100.0 * (m->reserved - m->used) / m->reserved : 0.0);
+    }
+    printf("%-14s %12s %11.2f %11.2f %11.2f\n", "total", "", used / MB, mem_reserved_total / MB, mem_peak_total / MB);
+    long long rss = process_rss();
+    if (rss >= 0) printf("Process RSS: %.2f MB (%.2f MB not tracked above)\n", rss / MB, (rss - mem_reserved_total) / MB);
+
+    // per-transaction cost at today's ratios: its node, its share of undo
+    // nodes, and the account rows it comes with
+    long long txs = tx_pool.live;
+    if (txs > 0) {
+        double per_tx = (double)mem_stats[MEM_TRANSACTIONS].reserved / txs;
+        double undo_per_tx = (double)mem_stats[MEM_UNDO].used / txs;
+        double acc_per_tx = (double)(mem_stats[MEM_ACCOUNTS].reserved + mem_stats[MEM_ACCOUNT_TABLE].reserved) / txs;
+        double total = 1e8 * (per_tx + undo_per_tx + acc_per_tx);
+        printf("Per transaction: %.1f B node, %.1f B undo, %.1f B accounts\n", per_tx, undo_per_tx, acc_per_tx);
+        printf("At 100M transactions: ~%.2f GB (undo stack %.2f GB)\n", total / 1e9, 1e8 * undo_per_tx / 1e9);
+    } else {
+        printf("Per transaction: %zu B node, %zu B undo entry (no transactions yet)\n",
+               sizeof(Transaction), sizeof(OpNode));
+    }
+}
+
+void show_velocity_limits() {
+    for (int i = 0; i < VEL_WINDOWS; i++) {
+        const VelocityLimit *l = &velocity_limits[i];
+        printf("Per %-6s: ", velocity_window_names[i]);
+        if (l->max_count) printf("%d withdrawals/transfers  ", l->max_count);
+        if (l->max_amount) printf("%.2f  ", l->max_amount);
+        printf(l->max_count || l->max_amount ? "\n" : "no limit\n");
+    }
+    printf("Refused so far: %lld (accounts tracked: %lld)\n", velocity_refused, velocity_pool.live);
+}
+
+void list_accounts() {
+    printf("Accounts:\n");
+    epoch_enter();
+    Account *a = DEREF(accounts_head);
+    if (!a) printf("  (no accounts yet)\n");
+    while (a) {
+        printf("  ID:%d  Name:%s  Balance:%.2f%s\n", a->id, a->name, BALANCE_READ(a), a->savings ? "  (savings)" : "");
+        a = DEREF(a->next);
+    }
+    epoch_exit();
+}
+
+/* pie-chart data: constant-time read of the running totals */
+void show_category_totals(int acc_id) {
+    const double *totals = cat_spent_total;
+    if (acc_id) {
+        Account *a = find_account(acc_id);
+        if (!a) { printf("Account not found.\n"); return; }
+        totals = a->cat_spent;
+        printf("Spending by category for %s (ID %d):\n", a->name, a->id);
+    } else {
+        printf("Spending by category (all accounts):\n");
+    }
+    for (int c = 1; c < NUM_CATEGORIES; c++)
+        printf("  %-9s %.2f\n", category_names[c], totals[c]);
+}
+
+void print_goal(Goal *g) {
+    printf("  #%d %-20s %.2f / %.2f (%.0f%%)", g->id, g->name, g->saved, g->target,
+           g->target > 0 ? 100.0 * g->saved / g->target : 100.0);
+    if (g->target_date) printf("  due %04d-%02d-%02d", g->target_date / 10000, g->target_date / 100 % 100, g->target_date % 100);
+    printf("\n");
+}
+
+/* dashboard: totals are running sums, next due is the heap root, overdue
+   only walks the overdue part of the heap */
+void show_goals_dashboard() {
+    printf("Goals: %d (%d reached)  Saved %.2f of %.2f\n", goal_count, goals_completed,
+           goals_saved_total, goals_target_total);
+    Goal *next = next_due_goal();
+    if (next) {
+        printf("Next due:\n");
+        print_goal(next);
+    }
+    int today = today_yyyymmdd();
+    if (for_each_overdue_goal(today, NULL)) {
+        printf("Overdue:\n");
+        for_each_overdue_goal(today, print_goal);
+    }
+}
+
+#define COLD_PAGE 20
+
+void print_transaction(const Transaction *t) {
+    if (strcmp(t->type, "TRANSFER") == 0) {
+        printf("  [%s] %s %.2f  to/from acc %d  (%s)\n", t->timestamp, t->type, t->amount, t->to_account, t->type);
+    } else if (t->category > CAT_NONE && t->category < NUM_CATEGORIES) {
+        printf("  [%s] %s %.2f  (%s)\n", t->timestamp, t->type, t->amount, category_names[t->category]);
+    } else {
+        printf("  [%s] %s %.2f\n", t->timestamp, t->type, t->amount);
+    }
+}
+
+void show_account_transactions(int acc_id) {
+    Account *a = find_account(acc_id);
+    if (a && !account_page_in(a)) printf("Could not read this account's transactions from the data file.\n");
+    epoch_enter();
+    a = find_account(acc_id);
+    if (!a) { printf("Account not found.\n"); epoch_exit(); return; }
+    printf("Transactions for %s (ID %d) [newest first]:\n", a->name, a->id);
+    Transaction *t = DEREF(a->tx_head);
+    if (!t && !a->cold_count) printf("  (no transactions)\n");
+    while (t) {
+        print_transaction(t);
+        t = DEREF(t->next);
+    }
+    long cold = a->cold_count;
+    ColdCursor c;
+    cold_open(&c, a);
+    epoch_exit();
+    if (!cold) return;
+    // older ones come back from disk a page at a time
+    printf("  (%ld older transaction(s) on disk)\n", cold);
+    Transaction old;
+    int more = 1;
+    while (more) {
+        printf("Show %d more? (y/n): ", COLD_PAGE);
+        char ans[8];
+        if (scanf("%7s", ans) != 1 || (ans[0] != 'y' && ans[0] != 'Y')) break;
+        for (int i = 0; i < COLD_PAGE && (more = cold_next(&c, &old)); i++) print_transaction(&old);
+        if (!more) printf("  (end of history)\n");
+    }
+    cold_close(&c);
+}
+
+/* ------------------------------
+   Benchmark
+   finance_buddy --bench [accounts=N] [tx=M] [zipf=S] [transfer=R] [seed=X] [out=FILE] [trace=FILE]
+   Builds a synthetic ledger (N accounts, about M operations per account,
+   account picked with Zipf skew S, fraction R of operations are transfers,
+   the rest split between deposits and withdrawals), times each core
+   operation and writes the results as JSON. trace=FILE also records the
+   run as a Chrome trace. readers=K lock-free reader threads (default 2)
+   scan the ledger while the writer is idle, depositing, and creating and
+   undoing accounts. A snapshot reporter thread then sums the ledger over
+   and over while transfers commit; every sum must match. followers=F
+   (default 1) forks F follower processes, times how long they take to
+   load a snapshot of the bench ledger and catch up, then streams
+   transfers to them and records the replication lag. shm=0 skips timing
+   deposits with the shared-memory mirror on and reading it back through
+   an attached view. keys=N (default 1M) times N fresh idempotency keys,
+   repeats and unseen keys against the index, and retried keyed deposits.
+   Withdrawals and transfers are then timed with velocity limits off and
+   on, and a tight per-minute limit is checked to refuse what it should.
+   lazy=N (default 0, off) times startup with --lazy on a generated data
+   file of N transactions. loans=N (default 1M) runs N loans through the
+   batch amortization engine on one thread and on all of them. goals=N
+   (default 100k) times the goals dashboard's next due and overdue walk
+   over N goals. paths=N (default 10k) times a 30-year projection of N
+   paths on one thread and on all of them. schedules=N (default 10k) fires
+   N monthly standing orders through a simulated year a day at a time,
+   then catches up a second year in one step. The balance column's sum,
+   min/max and count-above kernels are timed against walking the account
+   list, and must agree with it. A day's interest is accrued on every
+   (savings) bench account and undone as one group. Per-category spending
+   is read from the running table and rescanned from every transaction,
+   and the two compared. Counts that must come out 0 (mismatches, lost or
+   missed entries) are checked: any that does not is named on stderr and
+   the run exits 1.
+   ------------------------------*/
+#define FINANCE_BUDDY_VERSION "2.0"
+
+typedef struct BenchConfig {
+    int accounts;
+    int tx_per_account;
+    double zipf;
+    double transfer_ratio;
+    uint64_t seed;
+    const char *out;
+    const char *trace;
+    int readers;
+    int followers;
+    int shm;
+    long keys;
+    long lazy;
+    long loans;
+    long goals;
+    int paths;
+    long schedules;
+} BenchConfig;
+
+typedef struct BenchResult {
+    char op[48];
+    long count;
+    double seconds;
+} BenchResult;
+
+BenchResult *bench_results = NULL;
+int bench_result_count = 0;
+int bench_result_cap = 0;
+int bench_checks_failed = 0;
+
+void bench_record(const char *op, long count, double seconds) {
+    if (bench_result_count == bench_result_cap) {
+        int ncap = bench_result_cap ? bench_result_cap * 2 : 128;
+        BenchResult *nr = realloc(bench_results, ncap * sizeof(BenchResult));
+        if (!nr) { // the record would be incomplete: fail the run
+            fprintf(stderr, "bench: out of memory recording %s\n", op);
+            bench_checks_failed++;
+            return;
+        }
+        bench_results = nr;
+        bench_result_cap = ncap;
+    }
+    BenchResult *r = &bench_results[bench_result_count++];
+    snprintf(r->op, sizeof(r->op), "%s", op);
+    r->count = count;
+    r->seconds = seconds;
+}
+
+/* a count that must come out 0: recorded like any other, and reported on
+   stderr (and in run_bench's exit status) when it does not */
+void bench_check(const char *op, long count) {
+    bench_record(op, count, 0);
+    if (!count) return;
+    fprintf(stderr, "bench: check %s failed: %ld\n", op, count);
+    bench_checks_failed++;
+}
+
+/* uniform double in [0,1) from the counter-based generator */
+double bench_uniform(const BenchConfig *cfg, uint64_t stream, uint64_t counter) {
+    return (rng_counter(cfg->seed, stream, counter) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* cumulative Zipf weights 1/k^s over ranks 1..n, normalised to 1 */
+double *zipf_cdf(int n, double s) {
+    double *cdf = malloc(n * sizeof(double));
+    if (!cdf) return NULL;
+    double total = 0;
+    for (int k = 0; k < n; k++) {
+        total += s > 0 ? pow(k + 1, -s) : 1.0;
+        cdf[k] = total;
+    }
+    for (int k = 0; k < n; k++) cdf[k] /= total;
+    return cdf;
+}
+
+/* rank 1..n for a uniform draw u; account id == rank */
+int zipf_pick(const double *cdf, int n, double u) {
+    int lo = 0, hi = n - 1;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (cdf[mid] < u) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo + 1;
+}
+
+/* keeps the core's chatter off the terminal while timing */
+int bench_mute_stdout() {
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    int devnull = open("/dev/null", O_WRONLY);
+    if (devnull >= 0) {
+        dup2(devnull, STDOUT_FILENO);
+        close(devnull);
+    }
+    return saved;
+}
+
+void bench_restore_stdout(int saved) {
+    fflush(stdout);
+    if (saved >= 0) {
+        dup2(saved, STDOUT_FILENO);
+        close(saved);
+    }
+}
+
+void bench_write_json(FILE *f, const BenchConfig *cfg) {
+    fprintf(f, "{\n  \"version\": \"%s\",\n", FINANCE_BUDDY_VERSION);
+    fprintf(f, "  \"config\": {\"accounts\": %d, \"tx_per_account\": %d, \"zipf\": %g, \"transfer_ratio\": %g, \"seed\": %llu},\n",
+            cfg->accounts, cfg->tx_per_account, cfg->zipf, cfg->transfer_ratio, (unsigned long long)cfg->seed);
+    fprintf(f, "  \"results\": [");
+    for (int i = 0; i < bench_result_count; i++) {
+        BenchResult *r = &bench_results[i];
+        double per_sec = r->seconds > 0 ? r->count / r->seconds : 0;
+        double ns = r->count ? r->seconds * 1e9 / r->count : 0;
+        fprintf(f, "%s\n    {\"op\": \"%s\", \"count\": %ld, \"seconds\": %.6f, \"ops_per_sec\": %.1f, \"ns_per_op\": %.1f}",
+                i ? "," : "", r->op, r->count, r->seconds, per_sec, ns);
+    }
+    fprintf(f, "\n  ]\n}\n");
+}
+
+/* full-ledger scans from reader threads while the bench thread writes */
+typedef struct BenchReaders {
+    int stop;
+    long scans;
+} BenchReaders;
+
+void *bench_reader_main(void *arg) {
+    BenchReaders *br = arg;
+    volatile double sink = 0;
+    while (!__atomic_load_n(&br->stop, __ATOMIC_ACQUIRE)) {
+        double sum = 0;
+        epoch_enter();
+        for (Account *a = DEREF(accounts_head); a; a = DEREF(a->next)) {
+            sum += BALANCE_READ(a);
+            for (Transaction *t = DEREF(a->tx_head); t; t = DEREF(t->next)) sum += t->amount;
+        }
+        epoch_exit();
+        sink = sum;
+        __atomic_add_fetch(&br->scans, 1, __ATOMIC_RELAXED);
+    }
+    (void)sink;
+    return NULL;
+}
+
+/* reader scans completed while `writes` runs, recorded as scans/second */
+void bench_readers_during(const char *name, BenchReaders *br, void (*writes)(long), long n) {
+    long before = __atomic_load_n(&br->scans, __ATOMIC_RELAXED);
+    double t0 = monotonic_seconds();
+    writes(n);
+    double secs = monotonic_seconds() - t0;
+    bench_record(name, __atomic_load_n(&br->scans, __ATOMIC_RELAXED) - before, secs);
+}
+
+void bench_write_idle(long ms) {
+    usleep((useconds_t)ms * 1000);
+}
+
+void bench_write_deposits(long n) {
+    for (long i = 0; i < n; i++) deposit(1 + (int)(i % account_rows), 1);
 }
 
-/* ------------------------------
-   Core operations
-   ------------------------------*/
-Account* create_account(const char *name, double opening_balance) {
-    Account *acc = malloc(sizeof(Account));
-    acc->id = next_account_id++;
-    strncpy(acc->name, name, sizeof(acc->name)-1);
-    acc->balance = opening_balance;
-    acc->tx_head = NULL;
-    acc->next = accounts_head;
-    accounts_head = acc;
+/* every pair unlinks and retires an account and its opening transaction */
+void bench_write_churn(long n) {
+    for (long i = 0; i < n; i++) {
+        create_account("churn", 1);
+        undo_last();
+    }
+}
 
-    // record opening as a deposit transaction for trace
-    Transaction *tx = create_transaction("DEPOSIT", opening_balance, 0);
-    add_transaction(acc, tx);
+/* snapshot reports taken back to back while the bench thread transfers;
+   transfers conserve money, so every report must show the same total */
+typedef struct BenchReports {
+    int stop;
+    double expected;
+    long reports;
+    long mismatches;
+} BenchReports;
 
-    push_undo("CREATE", acc->id, 0, opening_balance);
-    return acc;
+void *bench_report_main(void *arg) {
+    BenchReports *br = arg;
+    while (!__atomic_load_n(&br->stop, __ATOMIC_ACQUIRE)) {
+        Snapshot *s = snapshot_open();
+        if (!s) continue;
+        SnapshotReport r;
+        snapshot_report(s, &r);
+        snapshot_close(s);
+        if (fabs(r.total_balance - br->expected) > 0.005 + 1e-9 * fabs(br->expected)) br->mismatches++;
+        br->reports++;
+    }
+    return NULL;
 }
 
-int deposit(int acc_id, double amount) {
-    Account *acc = find_account(acc_id);
-    if (!acc) return 0;
-    acc->balance += amount;
-    Transaction *tx = create_transaction("DEPOSIT", amount, 0);
-    add_transaction(acc, tx);
-    push_undo("DEPOSIT", acc_id, 0, amount);
-    return 1;
+void bench_write_transfers(long n) {
+    for (long i = 0; i < n; i++) {
+        int from = 1 + (int)(i * 7919 % account_rows), to = 1 + (int)((i * 104729 + 1) % account_rows);
+        if (from != to) transfer_funds(from, to, 1);
+    }
 }
 
-int withdraw(int acc_id, double amount) {
-    Account *acc = find_account(acc_id);
-    if (!acc) return 0;
-    if (acc->balance < amount) return -1; // insufficient funds
-    acc->balance -= amount;
-    Transaction *tx = create_transaction("WITHDRAW", amount, 0);
-    add_transaction(acc, tx);
-    push_undo("WITHDRAW", acc_id, 0, amount);
-    return 1;
-}
+/* runs stmt once and records its time as `count` operations */
+#define BENCH_TIMED(name, count, stmt) do { \
+        double t0_ = monotonic_seconds(); \
+        stmt; \
+        bench_record(name, count, monotonic_seconds() - t0_); \
+    } while (0)
 
-int transfer_funds(int from_id, int to_id, double amount) {
-    if (from_id == to_id) return -2;
-    Account *from = find_account(from_id);
-    Account *to = find_account(to_id);
-    if (!from || !to) return 0;
-    if (from->balance < amount) return -1;
-    from->balance -= amount;
-    to->balance += amount;
-    Transaction *tx_from = create_transaction("TRANSFER", amount, to_id);
-    Transaction *tx_to = create_transaction("TRANSFER", amount, from_id);
-    add_transaction(from, tx_from);
-    add_transaction(to, tx_to);
-    push_undo("TRANSFER", from_id, to_id, amount);
+/* waits until every follower has applied the whole log; 0 on timeout */
+int bench_repl_wait(int followers, double timeout) {
+    double give_up = monotonic_seconds() + timeout;
+    while (repl_follower_count() < followers || !repl_caught_up()) {
+        if (monotonic_seconds() > give_up) return 0;
+        sched_yield();
+    }
     return 1;
 }
 
-/* Undo last operation */
-void undo_last() {
-    OpNode *op = pop_undo();
-    if (!op) {
-        printf("Nothing to undo.\n");
-        return;
+/* followers are separate processes with their own ledgers, forked before
+   any replication thread exists */
+void bench_replication(int followers) {
+    char sock[64];
+    snprintf(sock, sizeof(sock), "/tmp/fb_repl_%d.sock", (int)getpid());
+    pid_t kids[REPL_MAX_FOLLOWERS];
+    int forked = 0;
+    for (int i = 0; i < followers; i++) {
+        pid_t pid = fork();
+        if (pid == 0) _exit(repl_follow(sock, 30) ? 0 : 1);
+        if (pid > 0) kids[forked++] = pid;
     }
-    if (strcmp(op->op_type, "DEPOSIT") == 0) {
-        Account *acc = find_account(op->acc_id);
-        if (acc) {
-            if (acc->balance >= op->amount) {
-                acc->balance -= op->amount;
-                Transaction *tx = create_transaction("UNDO_DEPOSIT", op->amount, 0);
-                add_transaction(acc, tx);
-                printf("Undid deposit of %.2f from account %d\n", op->amount, op->acc_id);
-            } else {
-                printf("Cannot undo deposit: insufficient balance in account %d\n", op->acc_id);
-            }
+    double t0 = monotonic_seconds();
+    if (forked && repl_serve(sock)) {
+        if (bench_repl_wait(forked, 60))
+            bench_record("repl_catchup", ledger_stats.transactions, monotonic_seconds() - t0);
+        long transfers = 20000;
+        t0 = monotonic_seconds();
+        BENCH_TIMED("transfer_replicating", transfers, bench_write_transfers(transfers));
+        if (bench_repl_wait(forked, 60)) bench_record("repl_stream", transfers, monotonic_seconds() - t0);
+        long long applied = 0, lag_max = 0;
+        double lag_sum = 0;
+        long divergent = 0;
+        for (int i = 0; i < REPL_MAX_FOLLOWERS; i++) {
+            ReplFollower *rf = &repl_followers[i];
+            if (!rf->active) continue;
+            applied += rf->applied;
+            lag_sum += rf->lag_sum_ns / 1e9;
+            if (rf->lag_max_ns > lag_max) lag_max = rf->lag_max_ns;
+            divergent += rf->transactions != ledger_stats.transactions ||
+                         fabs(rf->total - ledger_stats.total_assets) > 0.005;
         }
-    } else if (strcmp(op->op_type, "WITHDRAW") == 0) {
-        Account *acc = find_account(op->acc_id);
-        if (acc) {
-            acc->balance += op->amount;
-            Transaction *tx = create_transaction("UNDO_WITHDRAW", op->amount, 0);
-            add_transaction(acc, tx);
-            printf("Undid withdraw of %.2f to account %d\n", op->amount, op->acc_id);
+        bench_record("repl_apply_lag", applied, lag_sum); // ns_per_op is the mean lag
+        bench_record("repl_apply_lag_max", 1, lag_max / 1e9);
+        bench_check("repl_divergent_followers", divergent);
+        repl_stop();
+    }
+    for (int i = 0; i < forked; i++) waitpid(kids[i], NULL, 0);
+}
+
+/* mirror upkeep on the write path, and a full read through an attached view */
+void bench_shared_mirror() {
+    char name[64];
+    snprintf(name, sizeof(name), "/fb_bench_%d", (int)getpid());
+    long deposits = 20000;
+    BENCH_TIMED("deposit_unmirrored", deposits, bench_write_deposits(deposits));
+    int ok = 0;
+    BENCH_TIMED("shm_publish", ledger_stats.transactions, ok = shm_publish(name));
+    if (ok) {
+        BENCH_TIMED("deposit_mirrored", deposits, bench_write_deposits(deposits));
+        ShmView v;
+        BENCH_TIMED("shm_attach", 1, ok = shm_attach(name, &v));
+        if (ok) {
+            ShmTotals t = { 0 };
+            int tries = 0;
+            BENCH_TIMED("shm_totals_scan", ledger_stats.transactions, tries = shm_view_totals(&v, &t, 100));
+            bench_check("shm_totals_mismatch", !tries || t.transactions != ledger_stats.transactions ||
+                        t.accounts != account_rows || fabs(t.total_balance - ledger_stats.total_assets) > 0.005);
+            shm_detach(&v);
         }
-    } else if (strcmp(op->op_type, "TRANSFER") == 0) {
-        Account *from = find_account(op->acc_id);
-        Account *to = find_account(op->acc_id_to);
-        if (from && to && to->balance >= op->amount) {
-            from->balance += op->amount;
-            to->balance -= op->amount;
-            Transaction *txFrom = create_transaction("UNDO_TRANSFER", op->amount, op->acc_id_to);
-            Transaction *txTo = create_transaction("UNDO_TRANSFER", op->amount, op->acc_id);
-            add_transaction(from, txFrom);
-            add_transaction(to, txTo);
-            printf("Undid transfer of %.2f from %d to %d\n", op->amount, op->acc_id, op->acc_id_to);
-        } else {
-            printf("Cannot undo transfer automatically (balances mismatch or accounts missing).\n");
+    }
+    shm_unpublish();
+}
+
+/* withdrawals and transfers with velocity limits off, then on but never
+   reached (the hot-path cost), then a tight limit that must refuse */
+void bench_velocity(const BenchConfig *cfg) {
+    long n = 20000;
+    int accounts = account_rows;
+    BENCH_TIMED("withdraw_limits_off", n,
+        for (long i = 0; i < n; i++) withdraw(1 + (int)(bench_uniform(cfg, 20, i) * accounts), 0.01, CAT_MISC));
+    for (int w = 0; w < VEL_WINDOWS; w++) velocity_set_limit(w, 1000000, 1e12);
+    BENCH_TIMED("withdraw_limits_on", n,
+        for (long i = 0; i < n; i++) withdraw(1 + (int)(bench_uniform(cfg, 20, i) * accounts), 0.01, CAT_MISC));
+    BENCH_TIMED("transfer_limits_on", n,
+        for (long i = 0; i < n; i++) {
+            int from = 1 + (int)(bench_uniform(cfg, 21, i) * accounts);
+            transfer_funds(from, from % accounts + 1, 0.01);
+        });
+    long checks = 1000000;
+    long long refused = velocity_refused;
+    BENCH_TIMED("velocity_check_and_count", checks,
+        for (long i = 0; i < checks; i++) {
+            Account *a = slot_account[(i * 7919) % account_rows];
+            if (velocity_allows(a, 0.01)) velocity_note(a, 0.01);
+        });
+    bench_record("velocity_refused_under_loose_limits", (long)(velocity_refused - refused), 0);
+    // 5 per minute: of 10 back-to-back withdrawals 5 go through; a minute
+    // later half the previous bucket still counts, two minutes later none
+    velocity_set_limit(VEL_MINUTE, 5, 0);
+    Account *probe = create_account("velocity", 1000);
+    time_t saved_clock = ledger_clock;
+    ledger_clock = saved_clock - saved_clock % 60 + 30; // mid-minute
+    int id = probe->id, done = 0, later = 0, much_later = 0;
+    for (int i = 0; i < 10; i++) done += withdraw(id, 1, CAT_MISC) == 1;
+    // the counters come back with a reload: the minute's 5 are still spent
+    char path[] = "/tmp/fb_bench_velocity_XXXXXX";
+    int fd = mkstemp(path), reloaded = 0;
+    if (fd >= 0) {
+        close(fd);
+        save_data(path);
+        load_data(path);
+        reloaded = withdraw(id, 1, CAT_MISC) == 1;
+        unlink(path);
+    }
+    bench_check("velocity_allowed_after_reload", reloaded);
+    ledger_clock += 60;
+    for (int i = 0; i < 10; i++) later += withdraw(id, 1, CAT_MISC) == 1;
+    ledger_clock += 120;
+    for (int i = 0; i < 10; i++) much_later += withdraw(id, 1, CAT_MISC) == 1;
+    ledger_clock = saved_clock;
+    bench_record("velocity_tight_allowed_of_10", done, 0);
+    bench_record("velocity_tight_allowed_next_minute", later, 0);
+    bench_record("velocity_tight_allowed_after_2min", much_later, 0);
+    for (int w = 0; w < VEL_WINDOWS; w++) velocity_set_limit(w, 0, 0);
+}
+
+/* a month passes and everything so far goes to the history file; then
+   the cost of reading it back, and a save/load round trip in which the
+   old transactions never enter memory. Leaves the clock a month on. */
+void bench_tiering(const char *path) {
+    tier_private("/tmp/fb_bench_history");
+    long txs = ledger_stats.transactions;
+    long long used = mem_stats[MEM_TRANSACTIONS].used, reserved = mem_stats[MEM_TRANSACTIONS].reserved;
+    ledger_clock += 31 * 86400;
+    tier_age_days = 30;
+    long moved = 0;
+    BENCH_TIMED("tier_evict", txs, moved = tier_evict());
+    epoch_synchronize();
+    bench_record("tier_moved", moved, 0);
+    bench_record("tier_file_bytes", (long)tier_end, 0);
+    bench_record("tx_used_bytes_before_tier", (long)used, 0);
+    bench_record("tx_used_bytes_after_tier", (long)mem_stats[MEM_TRANSACTIONS].used, 0);
+    long deposits = 20000;
+    BENCH_TIMED("deposit_after_tier", deposits, bench_write_deposits(deposits));
+    // page-in: the whole history of the hottest accounts, one block each
+    int shows = account_rows < 100 ? account_rows : 100;
+    long paged = 0;
+    long long blocks = tier_blocks_read;
+    BENCH_TIMED("cold_page_in", paged,
+        for (int id = 1; id <= shows; id++) {
+            Account *a = find_account(id);
+            if (!a) continue;
+            ColdCursor c;
+            Transaction t;
+            cold_open(&c, a);
+            while (cold_next(&c, &t)) paged++;
+            cold_close(&c);
+        });
+    bench_record("cold_blocks_read", (long)(tier_blocks_read - blocks), 0);
+    bench_check("tier_stats_mismatches", check_ledger_stats());
+    txs = ledger_stats.transactions;
+    save_data(path);
+    BENCH_TIMED("load_data_tiered", txs, load_data(path));
+    long cold = 0;
+    for (Account *a = accounts_head; a; a = a->next) cold += a->cold_count;
+    bench_record("tier_loaded_cold", cold, 0);
+    bench_check("tier_load_tx_lost", txs - ledger_stats.transactions);
+    bench_record("tx_reserved_bytes_before_tier", (long)reserved, 0);
+    bench_record("tx_reserved_bytes_tiered_load", (long)mem_stats[MEM_TRANSACTIONS].reserved, 0);
+    bench_check("tier_load_stats_mismatches", check_ledger_stats());
+}
+
+/* lazy=N: writes a data file of N transactions (500 per account)
+   straight to disk, then times a lazy startup on it, paging in the first
+   100 accounts, seeks through its footer index (from the page cache and,
+   as far as the kernel lets us drop it, from disk) against a scan for the
+   last account, and an eager load when N is small enough to fit */
+void bench_lazy_load(long txs) {
+    char path[] = "/tmp/fb_bench_lazy_XXXXXX";
+    int fd = mkstemp(path);
+    FILE *f = fd >= 0 ? fdopen(fd, "w") : NULL;
+    if (!f) return;
+    int per = 500, accounts = (int)((txs + per - 1) / per);
+    char day[16];
+    current_time_str(day, sizeof(day));
+    day[10] = '\0';
+    TxBlock b = { 0 };
+    Transaction t = { 0 };
+    current_time_str(t.timestamp, sizeof(t.timestamp));
+    SaveIndex ix = { 0 };
+    double t0 = monotonic_seconds();
+    save_printf(f, &ix, "LEDGER|%ld|%s\n", txs + 1, day);
+    long id = txs;
+    for (int acc = 1; acc <= accounts; acc++) {
+        b.len = b.count = 0;
+        b.inflow = b.outflow = 0;
+        memset(b.spent, 0, sizeof(b.spent));
+        for (int i = 0; i < per && id > 0; i++, id--) {
+            t.id = (int)id;
+            int wd = id % 3 == 0;
+            strcpy(t.type, wd ? "WITHDRAW" : "DEPOSIT");
+            t.amount = 1 + id % 100;
+            t.category = wd ? CAT_SHOPPING + (int)(id % 6) : CAT_NONE;
+            tx_block_add(&b, acc, &t, day);
         }
-    } else if (strcmp(op->op_type, "CREATE") == 0) {
-        // delete account created (simple removal from linked list) if present and zero or only opening balance
-        Account *prev = NULL, *cur = accounts_head;
-        while (cur) {
-            if (cur->id == op->acc_id) break;
-            prev = cur;
-            cur = cur->next;
+        if (!save_account_block(f, &ix, acc, "bench", 1, b.inflow - b.outflow, &b)) b.error = 1;
+    }
+    free(b.data);
+    save_footer(f, &ix);
+    int ok = fclose(f) == 0;
+    bench_record("lazy_file_write", txs, monotonic_seconds() - t0);
+    struct stat st;
+    if (ok && stat(path, &st) == 0) bench_record("lazy_file_bytes", (long)st.st_size, 0);
+    lazy_load = 1;
+    BENCH_TIMED("load_lazy", txs, load_data(path));
+    bench_record("load_lazy_tx_counted", ledger_stats.transactions, 0);
+    bench_record("load_lazy_tx_bytes", (long)mem_stats[MEM_TRANSACTIONS].used, 0);
+    // writes go on the head of the list: none of them pages anything in
+    long long pages = lazy_pages;
+    int writes = accounts < 100000 ? accounts : 100000;
+    BENCH_TIMED("deposit_lazy", writes,
+        for (int i = 1; i <= writes; i++) deposit(i, 1));
+    BENCH_TIMED("accrue_interest_lazy", accounts, accrue_interest(1.0));
+    bench_record("lazy_paged_in_by_writes", (long)(lazy_pages - pages), 0);
+    int shows = accounts < 100 ? accounts : 100;
+    pages = lazy_pages;
+    BENCH_TIMED("lazy_page_in", shows,
+        for (int i = 1; i <= shows; i++) account_page_in(find_account(i)));
+    bench_record("lazy_paged_in", (long)(lazy_pages - pages), 0);
+    fd = open(path, O_RDONLY);
+    LedgerIndex li;
+    long seeks = 10000, found = 0, bad = 0;
+    if (fd >= 0 && ledger_index_open(fd, &li) == 1) {
+        char *blk;
+        size_t len;
+        IndexEntry e;
+        found = 0;
+        BENCH_TIMED("index_find", seeks,
+            for (long i = 0; i < seeks; i++) found += ledger_index_find(&li, 1 + (int)(mix64(i) % accounts), &e));
+        bench_check("index_find_missed", seeks - found);
+        for (int pass = 0; pass < 2; pass++) {
+            if (pass) {
+                fsync(fd); // dirty pages cannot be dropped
+                posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+                seeks = 1000;
+            }
+            found = bad = 0;
+            BENCH_TIMED(pass ? "index_seek_dropped_cache" : "index_seek", seeks,
+                for (long i = 0; i < seeks; i++) {
+                    int r = ledger_block_read(&li, 1 + (int)(mix64(i + pass) % accounts), &blk, &len);
+                    if (r) {
+                        found++;
+                        bad += r < 0;
+                        free(blk);
+                    }
+                });
+            bench_check(pass ? "index_seek_dropped_cache_missed" : "index_seek_missed", seeks - found);
+            bench_check(pass ? "index_seek_dropped_cache_bad" : "index_seek_bad", bad);
         }
-        if (cur) {
-            // Only remove if balance equals opening amount and there are no other txs? We'll remove anyway but warn.
-            if (prev) prev->next = cur->next;
-            else accounts_head = cur->next;
-            // free txs
-            Transaction *t = cur->tx_head;
-            while (t) {
-                Transaction *tmp = t;
-                t = t->next;
-                free(tmp);
+        // the same lookup without the index: read lines until the ACC line
+        char want[32], line[512];
+        int wlen = snprintf(want, sizeof(want), "ACC|%d|", accounts);
+        FILE *scan = fopen(path, "r");
+        found = 0;
+        BENCH_TIMED("scan_seek_last", 1,
+            while (scan && fgets(line, sizeof(line), scan))
+                if (strncmp(line, want, wlen) == 0) { found = 1; break; });
+        bench_record("scan_seek_last_found", found, 0);
+        if (scan) fclose(scan);
+    }
+    if (fd >= 0) close(fd);
+    if (txs <= 5000000) {
+        bench_check("lazy_stats_mismatches", check_ledger_stats());
+        lazy_load = 0;
+        BENCH_TIMED("load_eager", txs, load_data(path));
+        bench_record("load_eager_tx_counted", ledger_stats.transactions, 0);
+        bench_record("load_eager_tx_bytes", (long)mem_stats[MEM_TRANSACTIONS].used, 0);
+    }
+    lazy_load = 0;
+    free_all_data();
+    // --seek on a damaged index: a bad IDX length fails the index CRC;
+    // with the footer's CRC patched to match, the read is still refused
+    if ((fd = open(path, O_RDWR)) >= 0 && fstat(fd, &st) == 0 && ledger_index_open(fd, &li) == 1 && li.count) {
+        char line[IDX_LINE_LEN], hex[9];
+        uint32_t crc;
+        LedgerIndex bad_ix;
+        int opened = 1, read = 1;
+        long failing = 0;
+        if (pread(fd, line, IDX_LINE_LEN, (off_t)li.idx_off) == IDX_LINE_LEN) {
+            memcpy(line + 32, "ffffffffffffffff", 16); // IDX|id|off|len|crc: the length
+            if (pwrite(fd, line, IDX_LINE_LEN, (off_t)li.idx_off) == IDX_LINE_LEN) opened = ledger_index_open(fd, &bad_ix);
+            if (ledger_index_crc(&li, &crc)) {
+                snprintf(hex, sizeof(hex), "%08x", crc);
+                if (pwrite(fd, hex, 8, st.st_size - 9) == 8 && ledger_index_open(fd, &bad_ix) == 1) {
+                    char *blk = NULL;
+                    size_t len;
+                    read = ledger_block_read(&bad_ix, li.first_id, &blk, &len);
+                    free(blk);
+                    failing = ledger_index_verify(&bad_ix);
+                }
             }
-            free(cur);
-            printf("Undid creation of account %d\n", op->acc_id);
-        } else {
-            printf("Account to undo creation not found.\n");
         }
-    } else {
-        printf("Unknown undo operation: %s\n", op->op_type);
+        bench_check("index_corrupt_opened", opened != -1);
+        bench_check("index_bad_range_read", read != -1);
+        bench_check("index_bad_range_passed_check", failing != 1);
     }
-    free(op);
+    if (fd >= 0) close(fd);
+    unlink(path);
 }
 
-/* ------------------------------
-   Persistence (save/load)
-   Simple flat format:
-   Accounts:
-   ACC|id|name|balance
-   TX|acc_id|tx_id|type|amount|to_acc|timestamp
-   ------------------------------*/
-void save_data(const char *filename) {
-    FILE *f = fopen(filename, "w");
-    if (!f) {
-        perror("Error opening file to save");
-        return;
-    }
-    Account *a = accounts_head;
-    while (a) {
-        fprintf(f, "ACC|%d|%s|%.2f\n", a->id, a->name, a->balance);
-        Transaction *t = a->tx_head;
-        while (t) {
-            // replace '|' in timestamp or type if any (not expected)
-            fprintf(f, "TX|%d|%d|%s|%.2f|%d|%s\n", a->id, t->id, t->type, t->amount, t->to_account, t->timestamp);
-            t = t->next;
+/* keys=N: N fresh keys through the index at a simulated 1M keys per
+   second of ledger time (so generations rotate inside the 24h window),
+   then repeats, unseen keys, and keyed deposits with retries */
+void bench_idempotency(long keys) {
+    char (*names)[24] = malloc(keys * sizeof(*names));
+    if (!names) return;
+    for (long i = 0; i < keys; i++) snprintf(names[i], sizeof(names[i]), "req-%016llx", (unsigned long long)mix64(i));
+    time_t saved_clock = ledger_clock;
+    idem_reset();
+    long long dropped = idem_dropped_early;
+    int r;
+    BENCH_TIMED("idem_new_key", keys, {
+        COMMIT_SCOPE(); // the index alone: one commit for the lot
+        for (long i = 0; i < keys; i++) {
+            ledger_clock = saved_clock + i / 1000000;
+            IdemKey k = idem_hash(names[i]);
+            if (!idem_find(k, &r)) idem_insert(k, 1, ledger_time());
         }
-        a = a->next;
+    });
+    bench_record("idem_keys_held", idem_count(), 0);
+    bench_record("idem_dropped_early", idem_dropped_early - dropped, 0);
+    long hits = 0;
+    BENCH_TIMED("idem_repeat", keys,
+        for (long i = 0; i < keys; i++) hits += idem_find(idem_hash(names[(i * 7919) % keys]), &r));
+    bench_check("idem_repeats_missed", keys - hits);
+    // a different key with the same first hash: the check must turn it away
+    long confused = 0;
+    long long collisions = idem_collisions;
+    for (long i = 0; i < keys; i += keys / 1000 + 1) {
+        IdemKey other = idem_hash(names[i]);
+        other.check ^= 1;
+        confused += idem_find(other, &r);
     }
-    fclose(f);
-    printf("Data saved to %s\n", filename);
+    bench_check("idem_collisions_confused", confused);
+    bench_record("idem_collisions_turned_away", (long)(idem_collisions - collisions), 0);
+    char unseen[24];
+    long long filtered = idem_filtered, probed = idem_probed;
+    BENCH_TIMED("idem_unseen", keys,
+        for (long i = 0; i < keys; i++) {
+            snprintf(unseen, sizeof(unseen), "new-%016llx", (unsigned long long)mix64(i));
+            idem_find(idem_hash(unseen), &r);
+        });
+    // misses that still probed a table: the filters' false positives
+    bench_record("idem_filter_false_positives", (long)(idem_probed - probed), 0);
+    bench_record("idem_filtered_unseen", (long)(idem_filtered - filtered), 0);
+    Snapshot *s = NULL;
+    BENCH_TIMED("idem_snapshot_copy", idem_count(), s = snapshot_open());
+    snapshot_close(s);
+    ledger_clock = saved_clock;
+    idem_reset();
+
+    long deposits = 20000;
+    BENCH_TIMED("deposit_keyed", deposits,
+        for (long i = 0; i < deposits; i++) deposit_keyed(names[i % keys], 1, 1));
+    double before = ledger_stats.total_assets;
+    BENCH_TIMED("deposit_keyed_retry", deposits,
+        for (long i = 0; i < deposits; i++) deposit_keyed(names[i % keys], 1, 1));
+    bench_check("idem_double_applied", (long)llround(ledger_stats.total_assets - before));
+    idem_reset();
+    free(names);
 }
 
-void free_all_data() {
-    Account *a = accounts_head;
-    while (a) {
-        Transaction *t = a->tx_head;
-        while (t) {
-            Transaction *tmp = t;
-            t = t->next;
-            free(tmp);
-        }
-        Account *atmp = a;
-        a = a->next;
-        free(atmp);
+/* loans=N: N loans of 1 to 30 years through loan_batch_run on one thread
+   and on every CPU; counts are loan-months (loans x longest term, which
+   every loan in a batch is stepped through). Both runs must agree, and
+   each loan's interest must match EMI x term - principal. */
+void bench_loans(long loans) {
+    LoanBatch b;
+    double *single = malloc(loans * sizeof(double));
+    if (!single || !loan_batch_init(&b, loans)) { free(single); return; }
+    for (long i = 0; i < loans; i++) {
+        uint64_t r = mix64(i);
+        b.principal[i] = 10000 + r % 5000000;
+        b.monthly_rate[i] = (r >> 24) % 1500 / 100.0 / 1200; // 0 to 15% a year
+        b.months[i] = 12 * (1 + (int)((r >> 40) % 30));
     }
-    accounts_head = NULL;
+    long months = 360L * loans;
+    BENCH_TIMED("loan_batch_1_thread", months, loan_batch_run(&b, 1));
+    memcpy(single, b.total_interest, loans * sizeof(double));
+    BENCH_TIMED("loan_batch", months, loan_batch_run(&b, 0));
+    long differ = 0, wrong = 0;
+    for (long i = 0; i < loans; i++) {
+        differ += single[i] != b.total_interest[i];
+        wrong += fabs(b.emi[i] * b.months[i] - b.principal[i] - b.total_interest[i]) > 0.01;
+    }
+    bench_check("loan_thread_mismatches", differ);
+    bench_check("loan_interest_mismatches", wrong);
+    free(single);
+    loan_batch_free(&b);
 }
 
-void load_data(const char *filename) {
-    FILE *f = fopen(filename, "r");
-    if (!f) {
-        // file may not exist => not an error
-        return;
+/* first run of bench order i: somewhere in the first period after start */
+int64_t bench_sched_first(long i, int64_t start, int64_t period) {
+    return start + 1 + (int64_t)(mix64(i) % (uint64_t)period);
+}
+
+/* schedules=N: N monthly deposit orders over the bench accounts, placed
+   two years back. The wheel is advanced a day at a time through the first
+   year (a running instance), then across the second year in one call (a
+   restart after a year down). Counts are runs fired; every order must run
+   once a period up to now, and every run must succeed. */
+void bench_scheduler(long orders, int accounts) {
+    int64_t now = clock_minutes(), year = 365 * 1440, period = 30 * 1440;
+    int64_t start = now - 2 * year;
+    scheduler_reset(start);
+    BENCH_TIMED("schedule_insert", orders,
+        for (long i = 0; i < orders; i++)
+            schedule_order(SCHED_DEPOSIT, 1 + (int)(i % accounts), 0, 1, CAT_NONE,
+                           bench_sched_first(i, start, period), (int)period, -1));
+    long runs = sched_runs, failures = sched_failures;
+    double t0 = monotonic_seconds();
+    for (int day = 1; day <= 365; day++) scheduler_advance(start + day * 1440);
+    bench_record("schedule_fire_daily", sched_runs - runs, monotonic_seconds() - t0);
+    long fired = sched_runs - runs;
+    runs = sched_runs;
+    BENCH_TIMED("schedule_catch_up_year", sched_runs - runs, scheduler_advance(now));
+    fired += sched_runs - runs;
+    long expected = 0;
+    for (long i = 0; i < orders; i++) expected += (now - bench_sched_first(i, start, period)) / period + 1;
+    bench_check("schedule_fire_mismatches", labs(expected - fired) + (sched_failures - failures));
+    scheduler_reset(now); // the orders would otherwise be saved and loaded with the bench ledger
+}
+
+/* paths=N: a 30-year Monte Carlo projection of N paths on one thread and
+   on every CPU; counts are path-years. Paths are keyed by index, so both
+   runs must produce the same values. */
+void bench_projection(int paths) {
+    Projection one = { 100000, 10000, 0.12, 0.18, 30, paths, 42, NULL }, all = one;
+    long path_years = (long)paths * one.years;
+    int ok = 0;
+    BENCH_TIMED("projection_1_thread", path_years, ok = run_projection(&one, 1));
+    if (ok) {
+        BENCH_TIMED("projection", path_years, ok = run_projection(&all, 0));
+        long differ = 0;
+        for (long i = 0; ok && i < path_years; i++) differ += one.values[i] != all.values[i];
+        bench_check("projection_thread_mismatches", differ);
     }
-    free_all_data();
-    char line[512];
-    int max_acc_id = 0;
-    int max_tx_id = 0;
-    while (fgets(line, sizeof(line), f)) {
-        // strip newline
-        char *nl = strchr(line, '\n'); if (nl) *nl = '\0';
-        if (strncmp(line, "ACC|", 4) == 0) {
-            int id;
-            char name[128];
-            double balance;
-            sscanf(line+4, "%d|%127[^|]|%lf", &id, name, &balance);
-            Account *acc = malloc(sizeof(Account));
-            acc->id = id;
-            strncpy(acc->name, name, sizeof(acc->name)-1);
-            acc->balance = balance;
-            acc->tx_head = NULL;
-            acc->next = accounts_head;
-            accounts_head = acc;
-            if (id > max_acc_id) max_acc_id = id;
-        } else if (strncmp(line, "TX|", 3) == 0) {
-            int acc_id, txid, toacc;
-            char type[64], ts[64];
-            double amt;
-            // TX|acc_id|tx_id|type|amount|to_acc|timestamp
-            // we need to parse carefully for timestamp which may contain spaces
-            char *p = line + 3;
-            char *parts[7]; int pi = 0;
-            parts[pi++] = p;
-            while (*p && pi < 7) {
-                if (*p == '|') {
-                    *p = '\0';
-                    parts[pi++] = p+1;
-                }
-                p++;
-            }
-            // now parts[]: [acc_id, tx_id, type, amount, to_acc, timestamp]
-            if (pi >= 6) {
-                acc_id = atoi(parts[0]);
-                txid = atoi(parts[1]);
-                strncpy(type, parts[2], sizeof(type)-1);
-                amt = atof(parts[3]);
-                toacc = atoi(parts[4]);
-                strncpy(ts, parts[5], sizeof(ts)-1);
-                Account *acc = find_account(acc_id);
-                if (acc) {
-                    Transaction *t = malloc(sizeof(Transaction));
-                    t->id = txid;
-                    strncpy(t->type, type, sizeof(t->type)-1);
-                    t->amount = amt;
-                    t->to_account = toacc;
-                    strncpy(t->timestamp, ts, sizeof(t->timestamp)-1);
-                    t->next = acc->tx_head;
-                    acc->tx_head = t;
-                    if (txid > max_tx_id) max_tx_id = txid;
-                }
-            }
-        }
+    free(one.values);
+    free(all.values);
+}
+
+/* goals=N: N goals due between two years back and two years ahead. The
+   dashboard's next due (the heap root) and overdue walk are timed, and
+   both are checked against a pass over every goal. The goals are then
+   deleted, so the rest of the run sees the ledger without them. */
+void bench_goals(long goals) {
+    int today = today_yyyymmdd(), first = next_goal_id;
+    BENCH_TIMED("goal_create", goals,
+        for (long i = 0; i < goals; i++) {
+            uint64_t r = mix64(i);
+            int y = today / 10000 - 2 + (int)(r % 5);
+            int m = 1 + (int)(r >> 8) % 12;
+            int d = 1 + (int)(r >> 16) % 28;
+            create_goal("bench", 1000, y * 10000 + m * 100 + d);
+        });
+    long calls = 1000000;
+    Goal *volatile sink = NULL;
+    BENCH_TIMED("goal_next_due", calls, for (long i = 0; i < calls; i++) sink = next_due_goal());
+    int passes = 100, overdue = 0;
+    BENCH_TIMED("goal_overdue", passes, for (int i = 0; i < passes; i++) overdue = for_each_overdue_goal(today, NULL));
+    bench_record("goal_overdue_found", overdue, 0);
+    Goal *next = NULL;
+    long late = 0;
+    for (int id = first; id < next_goal_id; id++) {
+        Goal *g = find_goal(id);
+        if (!g || !g->target_date || g->saved >= g->target) continue;
+        if (!next || goal_before(g, next)) next = g;
+        late += g->target_date < today;
     }
+    bench_check("goal_next_due_mismatch", next != next_due_goal());
+    bench_check("goal_overdue_mismatches", labs(late - overdue));
+    int last = next_goal_id;
+    BENCH_TIMED("goal_delete", goals,
+        for (int id = first; id < last; id++) delete_goal(id, 0));
+    (void)sink;
+}
+
+/* the balance column's kernels against walking accounts_head, each over
+   about 10M rows (the table read as many times as it takes); counts are
+   rows. The sums must agree to rounding, and min, max and count-above
+   exactly. */
+void bench_balance_column() {
+    int rows = account_rows, above = 0, walked_above = 0;
+    long reps = 1 + 10000000L / (rows > 0 ? rows : 1), cells = reps * rows;
+    double walked = 0, summed = 0, lo = 0, hi = 0, walked_lo = 0, walked_hi = 0, threshold = 1000;
+    // the fence keeps the compiler from calling a kernel once for all reps
+    BENCH_TIMED("balance_sum_scan", cells,
+        for (long r = 0; r < reps; r++) { __atomic_signal_fence(__ATOMIC_SEQ_CST); walked = balance_sum_scan(); });
+    BENCH_TIMED("balance_sum", cells,
+        for (long r = 0; r < reps; r++) { __atomic_signal_fence(__ATOMIC_SEQ_CST); summed = balance_sum(); });
+    BENCH_TIMED("balance_stats_scan", cells,
+        for (long r = 0; r < reps; r++) {
+            __atomic_signal_fence(__ATOMIC_SEQ_CST);
+            balance_stats_scan(threshold, &walked_lo, &walked_hi, &walked_above);
+        });
+    BENCH_TIMED("balance_min_max", cells,
+        for (long r = 0; r < reps; r++) { __atomic_signal_fence(__ATOMIC_SEQ_CST); balance_min_max(&lo, &hi); });
+    BENCH_TIMED("balance_count_above", cells,
+        for (long r = 0; r < reps; r++) {
+            __atomic_signal_fence(__ATOMIC_SEQ_CST);
+            above = balance_count_above(threshold);
+        });
+    bench_check("balance_kernel_mismatches", (fabs(walked - summed) > 0.005 + 1e-12 * fabs(walked)) +
+                (lo != walked_lo) + (hi != walked_hi) + (above != walked_above));
+}
+
+/* one day's interest on every account and the undo of the whole group;
+   counts are accounts. The undo must put total assets back where they
+   were, and each credit leaves an INTEREST and an UNDO_INTEREST line. */
+void bench_accrual() {
+    double before = ledger_stats.total_assets;
+    long txs = ledger_stats.transactions;
+    int rows = account_rows, credited = 0;
+    BENCH_TIMED("accrue_interest", rows, credited = accrue_interest(4.0));
+    bench_record("accrue_interest_credited", credited, 0);
+    if (credited > 0) BENCH_TIMED("accrue_interest_undo", credited, undo_last());
+    bench_check("accrue_undo_mismatches", (credited < 0) + (fabs(ledger_stats.total_assets - before) > 0.005) +
+                (ledger_stats.transactions != txs + 2L * (credited > 0 ? credited : 0)));
+}
+
+/* the per-category totals a report reads from cat_spent_total against a
+   category_totals_scan of every transaction (hot and on disk); the two
+   must agree */
+void bench_categories() {
+    double scanned[NUM_CATEGORIES], table[NUM_CATEGORIES];
+    BENCH_TIMED("category_totals_scan", ledger_stats.transactions, category_totals_scan(scanned));
+    long reads = 1000000;
+    volatile double sink = 0;
+    BENCH_TIMED("category_totals_table", reads,
+        for (long i = 0; i < reads; i++) {
+            memcpy(table, cat_spent_total, sizeof(table));
+            sink += table[1 + i % (NUM_CATEGORIES - 1)];
+        });
+    long wrong = 0;
+    for (int c = 1; c < NUM_CATEGORIES; c++)
+        wrong += fabs(cat_spent_total[c] - scanned[c]) > 0.005 + 1e-12 * fabs(scanned[c]);
+    bench_check("category_totals_mismatches", wrong);
+}
+
+/* a web app file with enough accounts to grow the uid map several times,
+   each with a transfer to another account, most of them later in the
+   file: every transfer has to come out pointing at that account */
+void bench_import_transfers(int accounts) {
+    char path[] = "/tmp/fb_bench_import_XXXXXX";
+    int fd = mkstemp(path);
+    FILE *f = fd >= 0 ? fdopen(fd, "w") : NULL;
+    if (!f) return;
+    fprintf(f, "{\"accounts\": [");
+    for (int i = 0; i < accounts; i++)
+        fprintf(f, "%s{\"id\": \"web-%d\", \"name\": \"imported\", \"balance\": 100, \"transactions\": "
+                "[{\"type\": \"transfer\", \"amount\": 1, \"to_id\": \"web-%d\", \"ts\": \"2024-01-01 00:00:00\"}]}",
+                i ? ", " : "", i, (int)(((long)i * 7919 + 13) % accounts));
+    fprintf(f, "]}\n");
     fclose(f);
-    next_account_id = max_acc_id + 1;
-    next_tx_id = max_tx_id + 1;
+    int first_id = next_account_id, n = 0;
+    BENCH_TIMED("import_json_transfers", accounts, n = import_json(path));
+    long wrong = n < 0 ? accounts : accounts - n;
+    for (int i = 0; i < n; i++) {
+        Account *a = find_account(first_id + i);
+        Transaction *t = a ? a->tx_head : NULL;
+        if (!t || t->to_account != first_id + (int)(((long)i * 7919 + 13) % accounts)) wrong++;
+    }
+    bench_check("import_transfer_target_mismatches", wrong);
+    unlink(path);
 }
 
-/* ------------------------------
-   UI helpers
-   ------------------------------*/
-void list_accounts() {
-    printf("Accounts:\n");
-    Account *a = accounts_head;
-    if (!a) { printf("  (no accounts yet)\n"); return; }
-    while (a) {
-        printf("  ID:%d  Name:%s  Balance:%.2f\n", a->id, a->name, a->balance);
-        a = a->next;
+int run_bench(const BenchConfig *cfg) {
+    int n = cfg->accounts;
+    long ops = (long)n * cfg->tx_per_account;
+    double *cdf = zipf_cdf(n, cfg->zipf);
+    if (!cdf) { fprintf(stderr, "bench: out of memory\n"); return 1; }
+    char path[] = "/tmp/fb_bench_XXXXXX";
+    int tmpfd = mkstemp(path);
+    if (tmpfd < 0) { perror("bench: mkstemp"); free(cdf); return 1; }
+    close(tmpfd);
+    int saved = bench_mute_stdout();
+    if (cfg->trace) trace_start();
+
+    BENCH_TIMED("create_account", n,
+        for (int i = 0; i < n; i++) open_account("bench", 1000, 1)); // savings, so accrual credits them all
+    long lookups = 1000000, found = 0;
+    BENCH_TIMED("find_account", lookups,
+        for (long i = 0; i < lookups; i++) found += find_account(1 + (int)((i * 7919) % n)) != NULL);
+    bench_check("find_account_missing", lookups - found);
+
+    // one pass generates the mix; each kind is timed on its own
+    long n_dep = 0, n_wd = 0, n_tr = 0;
+    int *kind = malloc(ops * sizeof(int)), *from = malloc(ops * sizeof(int)), *to = malloc(ops * sizeof(int));
+    double *amt = malloc(ops * sizeof(double));
+    if (!kind || !from || !to || !amt) {
+        bench_restore_stdout(saved);
+        fprintf(stderr, "bench: out of memory\n");
+        free(kind); free(from); free(to); free(amt);
+        free(cdf);
+        unlink(path);
+        return 1;
+    }
+    for (long i = 0; i < ops; i++) {
+        double u = bench_uniform(cfg, 1, i);
+        from[i] = zipf_pick(cdf, n, bench_uniform(cfg, 2, i));
+        to[i] = zipf_pick(cdf, n, bench_uniform(cfg, 3, i));
+        amt[i] = 1 + (int)(bench_uniform(cfg, 4, i) * 100);
+        if (u < cfg->transfer_ratio && n > 1) { kind[i] = 3; n_tr++; if (to[i] == from[i]) to[i] = from[i] % n + 1; }
+        else if (u < cfg->transfer_ratio + (1 - cfg->transfer_ratio) / 2) { kind[i] = 1; n_dep++; }
+        else { kind[i] = 2; n_wd++; }
+    }
+    BENCH_TIMED("deposit", n_dep,
+        for (long i = 0; i < ops; i++) if (kind[i] == 1) deposit(from[i], amt[i]));
+    BENCH_TIMED("withdraw", n_wd,
+        for (long i = 0; i < ops; i++) if (kind[i] == 2) withdraw(from[i], amt[i], 1 + (int)(i % (NUM_CATEGORIES - 1))));
+    BENCH_TIMED("transfer_funds", n_tr,
+        for (long i = 0; i < ops; i++) if (kind[i] == 3) transfer_funds(from[i], to[i], amt[i]));
+    free(kind); free(from); free(to); free(amt);
+
+    long undos = ops / 10;
+    BENCH_TIMED("undo_last", undos,
+        for (long i = 0; i < undos; i++) undo_last());
+    int shows = n < 100 ? n : 100; // the hottest accounts under Zipf
+    BENCH_TIMED("show_account_transactions", shows,
+        for (int id = 1; id <= shows; id++) show_account_transactions(id));
+    bench_categories();
+    bench_balance_column();
+    bench_accrual();
+    if (cfg->readers > 0) {
+        BenchReaders br = { 0, 0 };
+        pthread_t *threads = malloc(cfg->readers * sizeof(pthread_t));
+        int started = 0;
+        while (threads && started < cfg->readers &&
+               pthread_create(&threads[started], NULL, bench_reader_main, &br) == 0) started++;
+        long reclaimed = epoch_reclaimed;
+        bench_readers_during("reader_scans_writer_idle", &br, bench_write_idle, 500);
+        bench_readers_during("reader_scans_during_deposits", &br, bench_write_deposits, 20000);
+        bench_readers_during("reader_scans_during_churn", &br, bench_write_churn, 100000);
+        __atomic_store_n(&br.stop, 1, __ATOMIC_RELEASE);
+        for (int i = 0; i < started; i++) pthread_join(threads[i], NULL);
+        free(threads);
+        long pending = (long)(retired_len - retired_head);
+        bench_record("epoch_reclaimed_while_reading", epoch_reclaimed - reclaimed, 0);
+        BENCH_TIMED("epoch_synchronize", pending, epoch_synchronize());
     }
+    {
+        long transfers = 20000;
+        BENCH_TIMED("transfer_no_snapshot", transfers, bench_write_transfers(transfers));
+        BenchReports br = { 0, ledger_stats.total_assets, 0, 0 };
+        pthread_t reporter;
+        long created = versions_created;
+        int started = pthread_create(&reporter, NULL, bench_report_main, &br) == 0;
+        double t0 = monotonic_seconds();
+        BENCH_TIMED("transfer_under_snapshots", transfers, bench_write_transfers(transfers));
+        __atomic_store_n(&br.stop, 1, __ATOMIC_RELEASE);
+        if (started) pthread_join(reporter, NULL);
+        bench_record("snapshot_reports", br.reports, monotonic_seconds() - t0);
+        bench_check("snapshot_report_mismatches", br.mismatches);
+        bench_record("mvcc_versions_created", versions_created - created, 0);
+        bench_record("mvcc_version_peak_bytes", mem_stats[MEM_VERSIONS].peak, 0);
+        deposit(1, 0); // a commit, so the writer trims the chains
+        bench_record("mvcc_versions_awaiting_reclaim", mem_stats[MEM_VERSIONS].objects, 0);
+    }
+    {
+        // ids issued so far against what the id map holds for the live ones
+        long churn = 200000;
+        BENCH_TIMED("account_create_undo", churn, bench_write_churn(churn));
+        epoch_synchronize();
+        long long map_bytes = account_map ? (long long)account_map_bytes(account_map->pages) : 0;
+        for (int p = 0; account_map && p < account_map->pages; p++)
+            if (account_map->page[p]) map_bytes += sizeof(AccountMapPage);
+        bench_record("account_ids_issued", next_account_id - 1, 0);
+        bench_record("account_map_bytes", (long)map_bytes, 0);
+        bench_record("account_table_rows_cap", account_rows_cap, 0);
+    }
+    if (cfg->followers > 0) bench_replication(cfg->followers);
+    if (cfg->shm) bench_shared_mirror();
+    if (cfg->keys > 0) bench_idempotency(cfg->keys);
+    if (cfg->loans > 0) bench_loans(cfg->loans);
+    if (cfg->goals > 0) bench_goals(cfg->goals);
+    if (cfg->paths > 0) bench_projection(cfg->paths);
+    if (cfg->schedules > 0) bench_scheduler(cfg->schedules, n);
+    bench_velocity(cfg);
+    bench_tiering(path);
+    BENCH_TIMED("ledger_stats_check", 1, check_ledger_stats());
+    BENCH_TIMED("save_data", ledger_stats.transactions, save_data(path));
+    BENCH_TIMED("load_data", ledger_stats.transactions, load_data(path));
+    int fd = open(path, O_WRONLY | O_TRUNC);
+    BENCH_TIMED("export_json", ledger_stats.transactions, export_json(fd));
+    close(fd);
+    long before = ledger_stats.transactions;
+    BENCH_TIMED("import_json", before, import_json(path));
+    bench_import_transfers(5000);
+    if (cfg->lazy > 0) bench_lazy_load(cfg->lazy);
+    long trace_events = cfg->trace ? trace_stop(cfg->trace) : 0;
+
+    long probes = 1000000; // cost of one METRIC_SCOPE, 0 under FB_NO_METRICS
+    BENCH_TIMED("metric_probe", probes,
+        for (long i = 0; i < probes; i++) { METRIC_SCOPE(M_PROBE); });
+    // a span while tracing is off, then on (the ring wraps; nothing is written)
+    BENCH_TIMED("trace_span_off", probes,
+        for (long i = 0; i < probes; i++) { TRACE_SPAN("bench"); });
+    trace_start();
+    BENCH_TIMED("trace_span_on", probes,
+        for (long i = 0; i < probes; i++) { TRACE_SPAN("bench"); });
+    trace_quiesce();
+
+    bench_restore_stdout(saved);
+    if (trace_events < 0) fprintf(stderr, "bench: could not write trace %s\n", cfg->trace);
+    unlink(path);
+    unlink(tier_path);
+    free(cdf);
+    FILE *out = cfg->out ? fopen(cfg->out, "w") : stdout;
+    if (!out) { perror("bench: output"); return 1; }
+    bench_write_json(out, cfg);
+    if (out != stdout) fclose(out);
+    if (bench_checks_failed) fprintf(stderr, "bench: %d check(s) failed\n", bench_checks_failed);
+    return bench_checks_failed ? 1 : 0;
 }
 
-void show_account_transactions(int acc_id) {
-    Account *a = find_account(acc_id);
-    if (!a) { printf("Account not found.\n"); return; }
-    printf("Transactions for %s (ID %d) [newest first]:\n", a->name, a->id);
-    Transaction *t = a->tx_head;
-    if (!t) { printf("  (no transactions)\n"); return; }
-    while (t) {
-        if (strcmp(t->type, "TRANSFER") == 0) {
-            printf("  [%s] %s %.2f  to/from acc %d  (%s)\n", t->timestamp, t->type, t->amount, t->to_account, t->type);
-        } else {
-            printf("  [%s] %s %.2f\n", t->timestamp, t->type, t->amount);
-        }
-        t = t->next;
+/* argv after --bench: key=value pairs */
+int bench_main(int argc, char **argv) {
+    BenchConfig cfg = { 1000, 100, 1.0, 0.2, 42, NULL, NULL, 2, 1, 1, 1000000, 0, 1000000, 100000, 10000, 10000 };
+    for (int i = 0; i < argc; i++) {
+        char *eq = strchr(argv[i], '=');
+        if (!eq) { fprintf(stderr, "bench: expected key=value, got %s\n", argv[i]); return 2; }
+        *eq = '\0';
+        const char *v = eq + 1;
+        if (strcmp(argv[i], "accounts") == 0) cfg.accounts = atoi(v);
+        else if (strcmp(argv[i], "tx") == 0) cfg.tx_per_account = atoi(v);
+        else if (strcmp(argv[i], "zipf") == 0) cfg.zipf = atof(v);
+        else if (strcmp(argv[i], "transfer") == 0) cfg.transfer_ratio = atof(v);
+        else if (strcmp(argv[i], "seed") == 0) cfg.seed = strtoull(v, NULL, 10);
+        else if (strcmp(argv[i], "out") == 0) cfg.out = v;
+        else if (strcmp(argv[i], "trace") == 0) cfg.trace = v;
+        else if (strcmp(argv[i], "readers") == 0) cfg.readers = atoi(v);
+        else if (strcmp(argv[i], "followers") == 0) cfg.followers = atoi(v);
+        else if (strcmp(argv[i], "shm") == 0) cfg.shm = atoi(v);
+        else if (strcmp(argv[i], "keys") == 0) cfg.keys = atol(v);
+        else if (strcmp(argv[i], "lazy") == 0) cfg.lazy = atol(v);
+        else if (strcmp(argv[i], "loans") == 0) cfg.loans = atol(v);
+        else if (strcmp(argv[i], "goals") == 0) cfg.goals = atol(v);
+        else if (strcmp(argv[i], "paths") == 0) cfg.paths = atoi(v);
+        else if (strcmp(argv[i], "schedules") == 0) cfg.schedules = atol(v);
+        else { fprintf(stderr, "bench: unknown option %s\n", argv[i]); return 2; }
     }
+    if (cfg.accounts <= 0 || cfg.tx_per_account < 0 ||
+        cfg.followers < 0 || cfg.followers > REPL_MAX_FOLLOWERS) { fprintf(stderr, "bench: bad sizes\n"); return 2; }
+    ledger_clock = time(NULL); // one timestamp for the whole run
+    return run_bench(&cfg);
 }
 
 /* ------------------------------
@@ -386,16 +7541,238 @@ void print_menu() {
     puts("7) Undo last operation");
     puts("8) Save data");
     puts("9) Load data");
+    puts("10) Export JSON (finance_buddy_data.json)");
+    puts("11) Export transactions CSV");
+    puts("12) Import JSON from web app");
+    puts("13) Spending by category");
+    puts("14) Create savings goal");
+    puts("15) Contribute to goal");
+    puts("16) Goals dashboard");
+    puts("17) Delete goal");
+    puts("18) Loan EMI & schedule");
+    puts("19) Investment projection");
+    puts("20) Add standing order");
+    puts("21) List standing orders");
+    puts("22) Cancel standing order");
+    puts("23) Ledger totals");
+    puts("24) Credit daily interest to savings accounts");
+    puts("25) Ledger stats");
+    puts("26) Check ledger stats");
+    puts("27) Operation metrics");
+    puts(trace_enabled ? "28) Stop trace and write it" : "28) Start trace");
+    puts("29) Memory report");
+    puts("30) Save in background");
+    puts("31) Snapshot report");
+    puts(repl_listen_fd < 0 ? "32) Start replication" : "32) Stop replication");
+    puts("33) Replication status");
+    puts(shm_base ? "34) Stop sharing ledger in memory" : "34) Share ledger in memory (/finance_buddy)");
+    puts("35) Velocity limits");
+    puts("36) Move old transactions to disk");
+    puts("37) Retry-safe deposit/withdraw/transfer (with a request key)");
+    puts("38) Open savings account");
     puts("0) Exit");
     printf("Choose: ");
 }
 
-int main() {
+void *follower_thread_main(void *path) {
+    if (!repl_follow(path, 5)) printf("\nCould not connect to %s\n", (const char *)path);
+    return NULL;
+}
+
+/* one attempt at listing accounts (or one account's transactions when
+   acc_id > 0) into f; 0 if it overlapped a commit */
+int attach_list(ShmView *v, FILE *f, int acc_id) {
+    uint64_t seq = shm_read_begin(v);
+    int found = 0;
+    for (uint64_t off = __atomic_load_n(&((const ShmHeader *)v->base)->accounts, __ATOMIC_ACQUIRE); off; ) {
+        const ShmAccount *a = shm_view_at(v, off, sizeof(ShmAccount));
+        if (!a) return 0;
+        if (!acc_id) {
+            fprintf(f, "  ID:%d  Name:%.63s  Balance:%.2f\n", a->id, a->name, a->balance);
+        } else if (a->id == acc_id) {
+            found = 1;
+            fprintf(f, "Transactions for %.63s (ID %d) [newest first]:\n", a->name, a->id);
+            long guard = 0;
+            for (uint64_t toff = a->tx_head; toff; ) {
+                const ShmTx *t = shm_view_at(v, toff, sizeof(ShmTx));
+                if (!t || ++guard > (long)(v->size / sizeof(ShmTx))) return 0;
+                fprintf(f, "  [%.63s] %.15s %.2f", t->timestamp, t->type, t->amount);
+                if (t->to_account) fprintf(f, "  to/from %d", t->to_account);
+                fprintf(f, "\n");
+                toff = t->next;
+            }
+            break;
+        }
+        off = a->next;
+    }
+    if (acc_id && !found) fprintf(f, "Account not found.\n");
+    return shm_read_valid(v, seq);
+}
+
+/* finance_buddy --attach [/NAME] [totals | accounts | tx ID]: reads a
+   running instance's shared ledger (menu 34) without loading anything */
+int attach_main(int argc, char **argv) {
+    const char *name = "/finance_buddy";
+    if (argc > 0 && argv[0][0] == '/') { name = argv[0]; argc--; argv++; }
+    const char *cmd = argc > 0 ? argv[0] : "totals";
+    int acc_id = strcmp(cmd, "tx") == 0 && argc > 1 ? atoi(argv[1]) : 0;
+    if (strcmp(cmd, "totals") != 0 && strcmp(cmd, "accounts") != 0 && !acc_id) {
+        fprintf(stderr, "usage: --attach [/NAME] [totals | accounts | tx ID]\n");
+        return 2;
+    }
+    double t0 = monotonic_seconds();
+    ShmView v;
+    if (!shm_attach(name, &v)) {
+        fprintf(stderr, "No shared ledger %s (start one with menu option 34)\n", name);
+        return 1;
+    }
+    int ok = 1;
+    if (strcmp(cmd, "totals") == 0) {
+        ShmTotals t;
+        shm_view_header_totals(&v, &t);
+        printf("%lld accounts, %lld transactions, total balance %.2f (commit %llu)\n",
+               (long long)t.accounts, (long long)t.transactions, t.total_balance, (unsigned long long)t.commit);
+    } else {
+        // a few tries for a listing no commit overlapped, then the last one as read
+        char *out = NULL;
+        size_t len = 0;
+        for (int attempt = 0; attempt < 20; attempt++) {
+            free(out);
+            out = NULL;
+            FILE *f = open_memstream(&out, &len);
+            if (!f) break;
+            ok = attach_list(&v, f, acc_id);
+            fclose(f);
+            if (ok) break;
+        }
+        if (out) fwrite(out, 1, len, stdout);
+        free(out);
+        if (!ok) printf("(commits were running during the read: balances may be from different commits)\n");
+    }
+    const ShmHeader *h = (const ShmHeader *)v.base;
+    if (h->stale) printf("(the writer ran out of shared memory; this is the ledger as of commit %llu)\n",
+                         (unsigned long long)h->totals[h->totals_gen & 1].commit);
+    fprintf(stderr, "read in %.3f ms without loading the data file\n", (monotonic_seconds() - t0) * 1e3);
+    shm_detach(&v);
+    return 0;
+}
+
+/* finance_buddy --seek ID [FILE]: one account's block straight from a
+   saved data file through its footer index; --seek check [FILE] checks
+   every block against its checksum */
+int seek_main(int argc, char **argv) {
+    if (argc < 1 || (strcmp(argv[0], "check") != 0 && atoi(argv[0]) <= 0)) {
+        fprintf(stderr, "usage: --seek ID|check [FILE]\n");
+        return 2;
+    }
+    const char *path = argc > 1 ? argv[1] : "finance_data.txt";
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return 1;
+    }
+    double t0 = monotonic_seconds();
+    LedgerIndex ix;
+    int opened = ledger_index_open(fd, &ix);
+    if (opened <= 0) {
+        if (opened < 0) printf("The index of %s is damaged.\n", path);
+        else fprintf(stderr, "%s has no footer index (saved by an older version, or cut short)\n", path);
+        close(fd);
+        return 1;
+    }
+    int rc = 0;
+    if (strcmp(argv[0], "check") == 0) {
+        long bad = ledger_index_verify(&ix);
+        if (bad < 0) printf("The index of %s is damaged.\n", path);
+        else printf("%ld accounts, %ld failing their checksum\n", ix.count, bad);
+        rc = bad != 0;
+        fprintf(stderr, "checked in %.3f ms\n", (monotonic_seconds() - t0) * 1e3);
+    } else {
+        char *blk = NULL;
+        size_t len = 0;
+        int r = ledger_block_read(&ix, atoi(argv[0]), &blk, &len);
+        double secs = monotonic_seconds() - t0;
+        if (r == 0) {
+            printf("Account not found.\n");
+            rc = 1;
+        } else {
+            fwrite(blk, 1, len, stdout);
+            if (r < 0) printf("(this block fails its checksum: the file is damaged)\n");
+            rc = r < 0;
+        }
+        free(blk);
+        fprintf(stderr, "found in %.1f us without loading the data file\n", secs * 1e6);
+    }
+    close(fd);
+    return rc;
+}
+
+/* finance_buddy --follow SOCKET: a read-only replica of the primary */
+int follower_main(const char *path) {
+    pthread_t applier;
+    if (pthread_create(&applier, NULL, follower_thread_main, (void *)path) != 0) {
+        fprintf(stderr, "follow: cannot start\n");
+        return 1;
+    }
+    printf("Following the primary on %s (read-only)\n", path);
+    while (1) {
+        puts("\n--- Finance Buddy (follower) ---");
+        puts("1) List accounts");
+        puts("2) View transactions");
+        puts("3) Snapshot report");
+        puts("4) Replication status");
+        puts("0) Exit");
+        printf("Choose: ");
+        int choice;
+        if (scanf("%d", &choice) != 1) {
+            int c; while ((c = getchar()) != '\n' && c != EOF) {}
+            if (c == EOF) break;
+            continue;
+        }
+        if (choice == 0) break;
+        if (choice == 1) {
+            list_accounts();
+        } else if (choice == 2) {
+            int id; printf("Account ID: "); scanf("%d", &id);
+            show_account_transactions(id);
+        } else if (choice == 3) {
+            Snapshot *s = snapshot_open();
+            if (!s) {
+                printf("Too many snapshots open.\n");
+            } else {
+                SnapshotReport r;
+                snapshot_report(s, &r);
+                printf("%d accounts, %ld transactions, total balance %.2f\n", r.accounts, r.transactions, r.total_balance);
+                snapshot_close(s);
+            }
+        } else if (choice == 4) {
+            show_follow_status();
+        } else {
+            printf("Invalid choice.\n");
+        }
+    }
+    return 0; // the applier dies with the process
+}
+
+int main(int argc, char **argv) {
+    metrics_init();
+    signal(SIGUSR1, metrics_signal_handler); // kill -USR1 <pid> dumps metrics to stderr
+    if (argc > 1 && strcmp(argv[1], "--bench") == 0) return bench_main(argc - 2, argv + 2);
+    if (argc > 2 && strcmp(argv[1], "--follow") == 0) return follower_main(argv[2]);
+    if (argc > 1 && strcmp(argv[1], "--attach") == 0) return attach_main(argc - 2, argv + 2);
+    if (argc > 1 && strcmp(argv[1], "--seek") == 0) return seek_main(argc - 2, argv + 2);
+    if (argc > 1 && strcmp(argv[1], "--lazy") == 0) lazy_load = 1; // histories read when first used
     const char *datafile = "finance_data.txt";
+    const char *tracefile = "finance_buddy_trace.json";
+    const char *replsocket = "finance_buddy.sock";
+    scheduler_reset(clock_minutes());
+    tier_beside(datafile);
     load_data(datafile);
     printf("Welcome to Finance Buddy (Data file: %s)\n", datafile);
 
     while (1) {
+        long runs = scheduler_run_due();
+        if (runs) printf("\nRan %ld scheduled operation(s).\n", runs);
         print_menu();
         int choice;
         if (scanf("%d", &choice) != 1) { // flush
@@ -403,11 +7780,14 @@ int main() {
             continue;
         }
         if (choice == 0) {
+            repl_stop();
+            shm_unpublish();
+            save_data_wait();
             save_data(datafile);
             printf("Exiting. Data saved.\n");
             break;
         }
-        if (choice == 1) {
+        if (choice == 1 || choice == 38) {
             char name[64];
             double ob;
             printf("Enter account holder name: ");
@@ -416,8 +7796,9 @@ int main() {
             char *nl = strchr(name, '\n'); if (nl) *nl = '\0';
             printf("Enter opening balance: ");
             scanf("%lf", &ob);
-            Account *acc = create_account(name, ob);
-            printf("Created account %s with ID %d\n", acc->name, acc->id);
+            Account *acc = open_account(name, ob, choice == 38);
+            if (acc) printf("Created account %s with ID %d\n", acc->name, acc->id);
+            else printf("Could not create account.\n");
         } else if (choice == 2) {
             list_accounts();
         } else if (choice == 3) {
@@ -431,9 +7812,13 @@ int main() {
             int id; double amt;
             printf("Account ID: "); scanf("%d", &id);
             printf("Amount to withdraw: "); scanf("%lf", &amt);
-            int r = withdraw(id, amt);
+            int cat;
+            printf("Category (1 Shopping, 2 Hotel, 3 Study, 4 Travel, 5 Food, 6 Misc): ");
+            if (scanf("%d", &cat) != 1) cat = CAT_MISC;
+            int r = withdraw(id, amt, cat);
             if (r == 1) printf("Withdrawn %.2f from account %d\n", amt, id);
             else if (r == -1) printf("Insufficient funds.\n");
+            else if (r == -3) printf("Refused: over the account's velocity limit.\n");
             else printf("Account not found.\n");
         } else if (choice == 5) {
             int from, to; double amt;
@@ -445,16 +7830,222 @@ int main() {
             else if (r == -1) printf("Insufficient funds.\n");
             else if (r == 0) printf("One of accounts not found.\n");
             else if (r == -2) printf("Source and destination cannot be same.\n");
+            else if (r == -3) printf("Refused: over the source account's velocity limit.\n");
         } else if (choice == 6) {
             int id; printf("Account ID: "); scanf("%d", &id);
             show_account_transactions(id);
         } else if (choice == 7) {
             undo_last();
         } else if (choice == 8) {
+            save_data_wait();
             save_data(datafile);
         } else if (choice == 9) {
+            save_data_wait(); // same file
             load_data(datafile);
             printf("Data loaded.\n");
+        } else if (choice == 10 || choice == 11) {
+            char fname[256];
+            printf("Export file name: ");
+            if (scanf("%255s", fname) == 1) export_to_file(fname, choice == 11);
+        } else if (choice == 12) {
+            char fname[256];
+            printf("Import file name: ");
+            if (scanf("%255s", fname) == 1) import_json(fname);
+        } else if (choice == 13) {
+            int id; printf("Account ID (0 for all): "); scanf("%d", &id);
+            show_category_totals(id);
+        } else if (choice == 14) {
+            char name[64], date[32];
+            double target;
+            printf("Goal name: ");
+            while (getchar() != '\n');
+            fgets(name, sizeof(name), stdin);
+            char *nl = strchr(name, '\n'); if (nl) *nl = '\0';
+            printf("Target amount: "); scanf("%lf", &target);
+            printf("Target date (YYYY-MM-DD, - for none): "); scanf("%31s", date);
+            Goal *g = create_goal(name, target, parse_goal_date(date));
+            if (g) printf("Created goal %s with ID %d\n", g->name, g->id);
+            else printf("Could not create goal.\n");
+        } else if (choice == 15) {
+            int gid, id; double amt;
+            printf("Goal ID: "); scanf("%d", &gid);
+            printf("From account ID: "); scanf("%d", &id);
+            printf("Amount: "); scanf("%lf", &amt);
+            int r = contribute_goal(gid, id, amt);
+            if (r == 1) printf("Saved %.2f towards goal %d\n", amt, gid);
+            else if (r == -1) printf("Insufficient funds.\n");
+            else printf("Goal or account not found.\n");
+        } else if (choice == 16) {
+            show_goals_dashboard();
+        } else if (choice == 17) {
+            int gid, aid = 0; printf("Goal ID: "); scanf("%d", &gid);
+            Goal *g = find_goal(gid);
+            if (g && g->saved > 0) { printf("Account to receive its %.2f: ", g->saved); scanf("%d", &aid); }
+            int r = delete_goal(gid, aid);
+            if (r == 1) printf("Deleted goal %d\n", gid);
+            else if (r == -1) printf("Account not found; goal kept.\n");
+            else printf("Goal not found.\n");
+        } else if (choice == 18) {
+            double amt, rate; int years;
+            printf("Loan amount: "); scanf("%lf", &amt);
+            printf("Annual interest rate (%%): "); scanf("%lf", &rate);
+            printf("Tenure (years): "); scanf("%d", &years);
+            show_loan_schedule(amt, rate, years);
+        } else if (choice == 19) {
+            Projection pr = { 0 };
+            double ret, vol;
+            printf("Initial amount: "); scanf("%lf", &pr.initial);
+            printf("Monthly contribution: "); scanf("%lf", &pr.monthly_contribution);
+            printf("Expected annual return (%%): "); scanf("%lf", &ret);
+            printf("Annual volatility (%%, 0 for fixed rate): "); scanf("%lf", &vol);
+            printf("Years: "); scanf("%d", &pr.years);
+            printf("Paths (e.g. 10000): "); scanf("%d", &pr.paths);
+            pr.annual_return = ret / 100;
+            pr.volatility = vol / 100;
+            pr.seed = (uint64_t)time(NULL);
+            if (pr.years > 0 && pr.paths > 0) show_projection(&pr);
+            else printf("Invalid projection.\n");
+        } else if (choice == 20) {
+            int op, id, to = 0, cat = CAT_NONE, days, count;
+            double amt;
+            char date[32];
+            printf("Type (1 Deposit, 2 Withdraw, 3 Transfer): "); scanf("%d", &op);
+            printf("Account ID: "); scanf("%d", &id);
+            if (op == SCHED_TRANSFER) { printf("To account ID: "); scanf("%d", &to); }
+            printf("Amount: "); scanf("%lf", &amt);
+            if (op == SCHED_WITHDRAW) {
+                printf("Category (1 Shopping, 2 Hotel, 3 Study, 4 Travel, 5 Food, 6 Misc): ");
+                scanf("%d", &cat);
+            }
+            printf("First run (YYYY-MM-DD): "); scanf("%31s", date);
+            printf("Repeat every N days: "); scanf("%d", &days);
+            printf("Number of runs (0 = until cancelled): "); scanf("%d", &count);
+            struct tm tm = { 0 };
+            int ymd = parse_goal_date(date);
+            tm.tm_year = ymd / 10000 - 1900;
+            tm.tm_mon = ymd / 100 % 100 - 1;
+            tm.tm_mday = ymd % 100;
+            tm.tm_isdst = -1;
+            time_t first = mktime(&tm);
+            int sid = ymd ? schedule_order(op, id, to, amt, cat, (int64_t)first / 60, days * 24 * 60,
+                                           count > 0 ? count : -1) : 0;
+            if (sid) printf("Created standing order %d\n", sid);
+            else printf("Invalid standing order.\n");
+        } else if (choice == 21) {
+            list_schedules();
+        } else if (choice == 22) {
+            int sid; printf("Standing order ID: "); scanf("%d", &sid);
+            if (cancel_schedule(sid)) printf("Cancelled standing order %d\n", sid);
+            else printf("Standing order not found.\n");
+        } else if (choice == 23) {
+            double threshold;
+            printf("Count accounts above balance: "); scanf("%lf", &threshold);
+            show_ledger_totals(threshold);
+        } else if (choice == 24) {
+            double rate;
+            printf("Annual interest rate (%%): "); scanf("%lf", &rate);
+            int n = accrue_interest(rate);
+            if (n >= 0) printf("Credited interest to %d account(s)\n", n);
+            else printf("Out of memory.\n");
+        } else if (choice == 25) {
+            show_ledger_stats();
+        } else if (choice == 26) {
+            check_ledger_stats();
+        } else if (choice == 27) {
+            fflush(stdout);
+            metrics_dump_fd(STDOUT_FILENO);
+        } else if (choice == 28) {
+            if (!trace_enabled) {
+                trace_start();
+                printf("Tracing on. Choose 28 again to write %s\n", tracefile);
+            } else {
+                long n = trace_stop(tracefile);
+                if (n >= 0) printf("Wrote %ld trace events to %s\n", n, tracefile);
+            }
+        } else if (choice == 29) {
+            show_memory_report();
+        } else if (choice == 30) {
+            save_data_background(datafile);
+            printf("Saving to %s in the background.\n", datafile);
+        } else if (choice == 31) {
+            Snapshot *s = snapshot_open();
+            if (!s) {
+                printf("Too many snapshots open.\n");
+            } else {
+                SnapshotReport r;
+                snapshot_report(s, &r);
+                printf("As of commit %llu: %d accounts, %ld transactions, total balance %.2f\n",
+                       (unsigned long long)(s->snap - 1), r.accounts, r.transactions, r.total_balance);
+                snapshot_close(s);
+            }
+        } else if (choice == 32) {
+            if (repl_listen_fd >= 0) {
+                repl_stop();
+                printf("Replication stopped.\n");
+            } else if (repl_serve(replsocket)) {
+                printf("Serving followers on %s (run: finance_buddy --follow %s)\n", replsocket, replsocket);
+            } else {
+                perror("Could not start replication");
+            }
+        } else if (choice == 33) {
+            show_repl_status();
+        } else if (choice == 34) {
+            if (shm_name[0]) {
+                shm_unpublish();
+                printf("Stopped sharing the ledger.\n");
+            } else if (shm_publish("/finance_buddy")) {
+                printf("Sharing the ledger as /finance_buddy (read it with: finance_buddy --attach)\n");
+            } else {
+                perror("Could not share the ledger");
+            }
+        } else if (choice == 35) {
+            show_velocity_limits();
+            int w, count;
+            double amount;
+            printf("Change window (1 minute, 2 hour, 3 day, 0 none): ");
+            if (scanf("%d", &w) == 1 && w >= 1 && w <= VEL_WINDOWS) {
+                printf("Max withdrawals/transfers per %s (0 = no limit): ", velocity_window_names[w - 1]);
+                if (scanf("%d", &count) != 1) count = 0;
+                printf("Max amount per %s (0 = no limit): ", velocity_window_names[w - 1]);
+                if (scanf("%lf", &amount) != 1) amount = 0;
+                if (velocity_set_limit(w - 1, count, amount)) printf("Limit per %s updated.\n", velocity_window_names[w - 1]);
+                else printf("Invalid limit.\n");
+            }
+        } else if (choice == 36) {
+            int days;
+            printf("Move transactions older than how many days to %s (0 = keep all in memory)? ", tier_path);
+            if (scanf("%d", &days) == 1 && days >= 0) {
+                tier_age_days = days;
+                long moved = tier_evict();
+                if (moved < 0) printf("Could not move transactions (a save is running, or %s is not writable).\n", tier_path);
+                else printf("Moved %ld transaction(s) to disk (%lld bytes of history).\n", moved, (long long)tier_end);
+            }
+        } else if (choice == 37) {
+            // a request repeated with the same key gets the first result back
+            char key[128];
+            int kind, from = 0, to = 0, cat = CAT_MISC, r = 0;
+            double amt = 0;
+            printf("Request key: ");
+            if (scanf("%127s", key) != 1) continue;
+            printf("1 Deposit, 2 Withdraw, 3 Transfer: ");
+            if (scanf("%d", &kind) != 1 || kind < 1 || kind > 3) { printf("Invalid choice.\n"); continue; }
+            printf(kind == 3 ? "From account ID: " : "Account ID: "); scanf("%d", &from);
+            if (kind == 3) { printf("To account ID: "); scanf("%d", &to); }
+            printf("Amount: "); scanf("%lf", &amt);
+            if (kind == 2) {
+                printf("Category (1 Shopping, 2 Hotel, 3 Study, 4 Travel, 5 Food, 6 Misc): ");
+                if (scanf("%d", &cat) != 1) cat = CAT_MISC;
+            }
+            long long hits = idem_hits;
+            if (kind == 1) r = deposit_keyed(key, from, amt);
+            else if (kind == 2) r = withdraw_keyed(key, from, amt, cat);
+            else r = transfer_funds_keyed(key, from, to, amt);
+            if (idem_hits != hits) printf("Request %s was already applied; not applied again.\n", key);
+            if (r == 1) printf("Done.\n");
+            else if (r == -1) printf("Insufficient funds.\n");
+            else if (r == -2) printf("Source and destination cannot be same.\n");
+            else if (r == -3) printf("Refused: over the account's velocity limit.\n");
+            else printf("Account not found.\n");
         } else {
             printf("Invalid choice.\n");
         }
@@ -465,7 +8056,7 @@ int main() {
     while (undo_stack) {
         OpNode *tmp = undo_stack;
         undo_stack = undo_stack->next;
-        free(tmp);
+        free_undo_node(tmp);
     }
     return 0;
 }